@@ -9,10 +9,14 @@
 #include "cinder/gl/GlslProg.h"
 #include "cinder/gl/Texture.h"
 
+#include <functional>
+#include <future>
+
 #include "audiorenderer/audioframe.h"
 #include "audiorenderer/audiorenderer.h"
 #include "audiorenderer/audiorendererfactory.h"
 
+#include "movierenderer/audiofeeder.h"
 #include "movierenderer/moviedecoder.h"
 
 //
@@ -20,11 +24,14 @@
 namespace ph {
 namespace ffmpeg {
 
-typedef std::shared_ptr<class MovieGl> MovieGlRef;
+typedef std::shared_ptr<class MovieGl>     MovieGlRef;
+typedef std::shared_ptr<class MovieGlView> MovieGlViewRef;
 
 class MovieGl {
   public:
-	explicit MovieGl( const ci::fs::path &path, bool playAudio = true );
+	//! Opens the movie at \a path. If \a openInBackground is true, the movie is opened on a background thread (one movie
+	//! at a time) and calls are deferred until it is ready; the cached poster frame, if any, is shown in the meantime.
+	explicit MovieGl( const ci::fs::path &path, bool playAudio = true, bool openInBackground = false );
 	//MovieGl( const class MovieLoader &loader );
 	//MovieGl( const void *data, size_t dataSize, const std::string &fileNameHint, const std::string &mimeTypeHint = "" );
 	//MovieGl( DataSourceRef dataSource, const std::string mimeTypeHint = "" );
@@ -32,12 +39,19 @@ class MovieGl {
 	~MovieGl();
 
 	static MovieGlRef create( const ci::fs::path &path ) { return std::make_shared<MovieGl>( path ); }
+	//! Creates a movie that is opened in the background, see MovieGl().
+	static MovieGlRef createAsync( const ci::fs::path &path, bool playAudio = true ) { return std::make_shared<MovieGl>( path, playAudio, true ); }
+	//! Subscribes to the movie playing \a path in playback \a group, creating it on first use. All subscribers of a group share
+	//! one decoder, one audio renderer and one set of textures, so content mirrored on several outputs is decoded only once.
+	//! Playback is shared, visibility and target size are set per subscriber on the returned view.
+	static MovieGlViewRef create( const ci::fs::path &path, const std::string &group, bool playAudio = true );
 	//static MovieGlRef create( const MovieLoaderRef &loader );
 	//static MovieGlRef create( const void *data, size_t dataSize, const std::string &fileNameHint, const std::string &mimeTypeHint = "" )
 	//	 { return std::shared_ptr<MovieGl>( new MovieGl( data, dataSize, fileNameHint, mimeTypeHint ) ); }
 	//static MovieGlRef create( DataSourceRef dataSource, const std::string mimeTypeHint = "" )
 	//	 { return std::shared_ptr<MovieGl>( new MovieGl( dataSource, mimeTypeHint ) ); }
 
+	//! Decodes and uploads the frame for the current time. Movies shared by a playback group update only once per app frame.
 	void update();
 
 	//! Returns the gl::Texture representing the Movie's current frame, bound to the \c GL_TEXTURE_RECTANGLE_ARB target
@@ -65,7 +79,7 @@ class MovieGl {
 	//! Returns the total number of frames (video samples) in the movie
 	uint64_t getNumFrames() const;
 	//! Returns whether the first video track in the movie contains an alpha channel. Returns false in the absence of visual media.
-	///bool		hasAlpha() const;
+	bool hasAlpha() const;
 
 	//! Returns whether a movie contains at least one visual track, defined as Video, MPEG, Sprite, QuickDraw3D, Text, or TimeCode tracks
 	///bool		hasVisuals() const;
@@ -86,6 +100,22 @@ class MovieGl {
 
 	//! Sets whether the movie is set to loop during playback. If \a palindrome is true, the movie will "ping-pong" back and forth
 	void setLoop( bool loop = true );
+	//! Keeps one full pass of a looping movie in memory (up to \a maxBytes) and plays further passes from there, so short loops cost no decoding at all. If \a compress is true, frames are stored losslessly compressed.
+	void setLoopCache( bool enabled = true, size_t maxBytes = 256 * 1024 * 1024, bool compress = false );
+	//! Keeps the compressed packets of one full pass of a looping movie in memory (up to \a maxBytes), so that further passes don't touch the disk.
+	void setPacketCache( bool enabled = true, size_t maxBytes = 64 * 1024 * 1024 );
+	//! Sets how interlaced movies are deinterlaced. If \a fieldRate is true, every field is shown as a frame of its own (e.g. 25i plays as 50p).
+	void setDeinterlacing( Deinterlacer::Mode mode, bool fieldRate = false );
+	//! Filters the video with a libavfilter graph in the syntax of ffmpeg's -vf option, e.g. "crop=1280:720,eq=saturation=1.2". Pass an empty string to remove it.
+	void setVideoFilter( const std::string &description );
+	//! Filters the audio with a libavfilter graph in the syntax of ffmpeg's -af option, e.g. "loudnorm" or "atempo=1.25". Pass an empty string to remove it.
+	void setAudioFilter( const std::string &description );
+	//! Converts the audio to \a numChannels, e.g. 2 to downmix surround sound to stereo. Zero keeps the channels of the movie.
+	void setAudioChannels( int numChannels );
+	//! Trades the quality of the sample rate conversion to the audio device for CPU time.
+	void setAudioResampleQuality( AudioResampler::Quality quality );
+	//! Sets how far ahead audio is queued to the device, in milliseconds. Zero uses the default of \a mode.
+	void setAudioLatency( AudioRenderer::LatencyMode mode, int milliseconds = 0 );
 	//! Advances the movie by one frame (a single video sample). Ignores looping settings.
 	///void		stepForward();
 	//! Steps backward by one frame (a single video sample). Ignores looping settings.
@@ -93,6 +123,20 @@ class MovieGl {
 	//! Sets the playback rate, which begins playback immediately for nonzero values. 1.0 represents normal speed. Negative values indicate reverse playback and \c 0 stops.
 	///void		setRate( float rate );
 
+	//! Enables adaptive decoding: when the video falls behind, the decoder progressively skips the loop filter, non-reference frames and IDCT until it catches up.
+	void setAdaptiveDecoding( bool enabled = true );
+	//! Returns the current degradation level of the adaptive decoding policy.
+	MovieDecoder::DegradationLevel getDegradationLevel() const;
+
+	//! Sets how far (in seconds) the video may fall behind the audio before the decoder jumps ahead to a keyframe. Zero disables catching up.
+	void setCatchUpThreshold( float seconds );
+
+	//! Sets the size (in pixels) at which the movie is shown, so that decoding and uploading scale with the pixels actually shown. Pass a zero size to decode at full resolution.
+	void setTargetSize( const ci::ivec2 &size );
+	//! Offscreen movies are not uploaded and only decode keyframes to keep their position. Shared movies are set through their views.
+	void setVisible( bool visible = true );
+	bool isVisible() const { return mVisible; }
+
 	//! Sets the audio playback volume ranging from [0 - 1.0]
 	///void		setVolume( float volume );
 	//! Gets the audio playback volume ranging from [0 - 1.0]
@@ -120,39 +164,123 @@ class MovieGl {
 	void pause();
 	void resume();
 
+	//! Releases the decoder's codecs, threads and buffers, the audio renderer and all textures except the current frame, which stays available as a poster frame.
+	void hibernate();
+	//! Restores a hibernated movie to the position and play state it had before hibernate(). If the codecs cannot be reopened, the movie stays hibernated.
+	void wake();
+	bool isHibernating() const;
+
+	//! Enables the on-disk poster cache for all movies created afterwards. A movie shows its cached poster before it has been
+	//! opened; the first frame is cached automatically, savePoster() caches the current frame and position.
+	static void setPosterCacheDirectory( const ci::fs::path &directory );
+	//! Selects the audio renderer of movies opened from now on. Defaults to AudioRendererFactory::OPENAL_OUTPUT. Movies fall
+	//! back to AudioRendererFactory::NULL_OUTPUT if the renderer can't be created, e.g. on machines without an audio device.
+	static void setAudioOutputType( AudioRendererFactory::AudioOutputType type );
+	//! Caches the current frame as the poster shown the next time the movie is created, which then continues from its position, e.g. when the application quits.
+	void savePoster();
+
 	//! Sets a function which is called whenever the movie has rendered a new frame during playback. Generally only necessary for advanced users.
 	void setNewFrameCallback( void ( *aNewFrameCallback )( long, void * ), void *aNewFrameCallbackRefcon )
 	{
 	}
 
   private:
+	friend class MovieGlView;
+
 	void initializeShader();
+	void initializeDecoder( std::unique_ptr<MovieDecoder> decoder );
+	void uploadFrame( const VideoFrame &videoFrame );
+	//! Combines the visibility and target size of the views of a shared movie.
+	void updateViews();
+	//! Creates and configures the renderer of the selected type, or a NullRenderer if that fails.
+	std::unique_ptr<AudioRenderer> createAudioRenderer();
+	//! Creates a renderer of \a type for the audio of the decoder and sets the decoder's output format to match. Throws on failure.
+	std::unique_ptr<AudioRenderer> createAudioRenderer( AudioRendererFactory::AudioOutputType type );
+
+	//! Returns true once the decoder is available, finishing a background open if it just completed.
+	bool isOpen();
+	//! Queues \a call if the movie is still being opened. Returns true if the call was deferred.
+	bool deferUntilOpen( const std::function<void()> &call );
 
   private:
 	// copy ops are private to prevent copying
 	MovieGl( const MovieGl & ) = delete;
 	MovieGl &operator=( const MovieGl & ) = delete;
 
+	ci::fs::path mPath;
+
 	int32_t mWidth;
 	int32_t mHeight;
 
+	//! Size of the decoded frames, which is smaller than the movie while a target size is set
+	ci::ivec2 mFrameSize;
+	bool      mVisible;
+
 	float mDuration;
+	bool  mPlayAudio;
+
+	AudioRenderer::LatencyMode mAudioLatencyMode;
+	int                        mAudioLatency;
+
+	//! Playback group of a shared movie, empty if the movie is not shared
+	std::string                mGroup;
+	uint32_t                   mLastUpdateFrame;
+	std::vector<MovieGlView *> mViews;
+
+	//! Whether the next decoded frame is written to the poster cache as the first frame
+	bool       mWritePoster;
+	VideoFrame mCurrentFrame;
+
+	std::future<std::unique_ptr<MovieDecoder>> mOpening;
+	std::vector<std::function<void()>>         mPendingCalls;
+
+	VideoFrame::PixelFormat mPixelFormat;
 
 	//
 	std::unique_ptr<AudioRenderer> mAudioRenderer;
 	std::unique_ptr<MovieDecoder>  mMovieDecoder;
+	//! Decodes audio and feeds mAudioRenderer on threads of its own, so it must go before either of them
+	std::unique_ptr<AudioFeeder> mAudioFeeder;
 
 	ci::Timer mUpdateTimer;
 
 	ci::gl::Texture2dRef mYPlane;
 	ci::gl::Texture2dRef mUPlane;
 	ci::gl::Texture2dRef mVPlane;
+	ci::gl::Texture2dRef mAPlane;
+	ci::gl::Texture2dRef mRGBAPlane;
 	ci::gl::Texture2dRef mTexture;
 
 	ci::gl::GlslProgRef mShader;
+	ci::gl::GlslProgRef mRgbaShader;
 
 	ci::gl::FboRef mFbo;
 };
 
+//! A subscriber of a movie shared by a playback group, see MovieGl::create( path, group ). The movie decodes while any of
+//! its views is visible, at the largest target size of the visible views.
+class MovieGlView {
+  public:
+	explicit MovieGlView( const MovieGlRef &movie );
+	~MovieGlView();
+
+	//! Returns the shared movie, for playback control, update() and getTexture().
+	const MovieGlRef &getMovie() const { return mMovie; }
+
+	//! Sets the size (in pixels) at which this subscriber shows the movie, see MovieGl::setTargetSize().
+	void      setTargetSize( const ci::ivec2 &size );
+	ci::ivec2 getTargetSize() const { return mTargetSize; }
+	void      setVisible( bool visible = true );
+	bool      isVisible() const { return mVisible; }
+
+  private:
+	MovieGlView( const MovieGlView & ) = delete;
+	MovieGlView &operator=( const MovieGlView & ) = delete;
+
+	MovieGlRef mMovie;
+	ci::ivec2  mTargetSize;
+	bool       mVisible;
+};
+
 } // namespace ffmpeg
 } // namespace ph
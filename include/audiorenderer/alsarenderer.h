@@ -0,0 +1,105 @@
+#ifndef ALSA_RENDERER_H
+#define ALSA_RENDERER_H
+
+#if defined( __linux__ )
+
+#include <alsa/asoundlib.h>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "audiorenderer/audiorenderer.h"
+
+class AudioFrame;
+struct AudioFormat;
+
+//! Plays audio through ALSA directly, bypassing sound servers. Samples are converted straight into the ring buffer
+//! of the device through snd_pcm_mmap_begin() and snd_pcm_mmap_commit(), the period and buffer sizes follow the
+//! latency target, and the clock is derived from snd_pcm_delay(). Needs no hardware when pointed at the "null" or a
+//! "file" PCM. Link with libasound.
+class AlsaRenderer : public AudioRenderer {
+  public:
+	//! Sets the PCM opened by the renderers created afterwards, e.g. "hw:0,0", "null" or "file:'/tmp/out.raw',raw". Defaults to "default".
+	static void setDeviceName( const std::string &name );
+
+	AlsaRenderer();
+	virtual ~AlsaRenderer();
+
+	void   setFormat( const AudioFormat &format ) override;
+	void   setLatency( LatencyMode mode, int milliseconds ) override;
+	bool   hasQueuedFrames() override;
+	bool   hasBufferSpace() override;
+	void   queueFrame( const AudioFrame &frame ) override;
+	void   clearBuffers() override;
+	void   flushBuffers() override;
+	double getCurrentPts() override;
+	void   play() override;
+	void   pause() override;
+	void   stop() override;
+	void   adjustVolume( float offset ) override;
+
+  private:
+	AlsaRenderer( const AlsaRenderer & ) = delete;
+	AlsaRenderer &operator=( const AlsaRenderer & ) = delete;
+
+	//! Timestamp of the sample at a position in the stream, counted in frames written since the last reset.
+	struct PtsMarker {
+		int64_t position;
+		double  pts;
+	};
+
+	//! Applies the hardware and software parameters for the current format and latency. Drops queued audio.
+	void configure();
+	//! Writes as much of \a data as the device has room for. Returns the number of bytes written.
+	size_t write( const uint8_t *data, size_t size, double pts );
+	//! Writes samples left over from a frame that did not fit.
+	void writePending();
+	//! Keeps a copy of \a numFrames source frames about to be written at the current stream position.
+	void remember( const uint8_t *data, snd_pcm_uframes_t numFrames );
+	//! Moves the frames the device has not played yet back in front of the pending samples, before the device is reset.
+	void requeueUnplayed( snd_pcm_sframes_t delay, double pts );
+	//! Returns the timestamp of the sample at \a position, dropping the markers before it.
+	double getPtsAt( int64_t position );
+	void applyVolume( uint8_t *samples, size_t numSamples );
+	//! Starts a prepared device that has samples, unless paused.
+	void start();
+	//! Recovers from an underrun or a suspend. Returns false if the device is lost.
+	bool recover( int error );
+	snd_pcm_sframes_t getAvailable();
+
+	static std::string mDeviceName;
+
+	snd_pcm_t *mPcm;
+	bool       mCanPause;
+	bool       mPaused;
+	float      mVolume;
+
+	snd_pcm_format_t mPcmFormat;
+	bool             mConvertToS16;
+	unsigned int     mNumChannels;
+	unsigned int     mFrequency;
+	unsigned int     mSourceBytesPerFrame;
+	unsigned int     mDeviceBytesPerFrame;
+
+	LatencyMode       mLatencyMode;
+	int               mLatency;
+	snd_pcm_uframes_t mPeriodSize;
+	snd_pcm_uframes_t mBufferSize;
+
+	// the stream position of the markers only ever grows, until the device is reset
+	int64_t               mFramesWritten;
+	std::deque<PtsMarker> mPtsQueue;
+
+	// tail of the last frame, in the source format, for when the device was full
+	std::vector<uint8_t> mPending;
+	size_t               mPendingSize;
+	double               mPendingPts;
+
+	// the last mBufferSize frames written, in the source format, so that pausing a device without hardware pause loses nothing
+	std::vector<uint8_t> mHistory;
+};
+
+#endif
+
+#endif
@@ -6,6 +6,8 @@ struct AudioFormat {
 	unsigned int rate;
 	unsigned int numChannels;
 	unsigned int framesPerPacket;
+	//! Samples are 32-bit floats rather than integers
+	bool         isFloat;
 };
 
 #endif
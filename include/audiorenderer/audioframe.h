@@ -3,22 +3,34 @@
 
 #include "common/commontypes.h"
 
+//! Decoded samples with their presentation time. The samples live in a buffer from the AudioFramePool, which a frame
+//! keeps while it is reused and returns on destruction. Frames can be moved, but not copied.
 class AudioFrame {
   public:
 	AudioFrame();
+	AudioFrame( AudioFrame &&other );
+	AudioFrame &operator=( AudioFrame &&other );
 	virtual ~AudioFrame();
 
 	byte * getFrameData() const;
 	uint32 getDataSize() const;
 	double getPts() const;
 
-	void setFrameData( byte *data );
+	//! Copies getDataSize() bytes from \a data, so call setDataSize() first.
+	void setFrameData( const byte *data );
 	void setDataSize( uint32 size );
 	void setPts( double pts );
 
   private:
+	AudioFrame( const AudioFrame & ) = delete;
+	AudioFrame &operator=( const AudioFrame & ) = delete;
+
+	void releaseBuffer();
+
 	byte * mFrameData;
 	uint32 mDataSize;
+	uint32 mCapacity;
+	bool   mPooled;
 	double mPts;
 };
 
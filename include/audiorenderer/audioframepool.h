@@ -0,0 +1,32 @@
+#ifndef AUDIO_FRAME_POOL_H
+#define AUDIO_FRAME_POOL_H
+
+#include "common/commontypes.h"
+
+#include <mutex>
+#include <vector>
+
+//! A fixed set of equally sized sample buffers, shared by all AudioFrames. The storage is allocated once,
+//! so that taking and returning buffers never touches the heap.
+class AudioFramePool {
+  public:
+	static const uint32 BUFFER_SIZE = 64 * 1024;
+	static const int    NUM_BUFFERS = 32;
+
+	static AudioFramePool &instance();
+
+	//! Returns a buffer of BUFFER_SIZE bytes, or NULL if all of them are in use.
+	byte *acquire();
+	void  release( byte *buffer );
+
+  private:
+	AudioFramePool();
+	AudioFramePool( const AudioFramePool & ) = delete;
+	AudioFramePool &operator=( const AudioFramePool & ) = delete;
+
+	std::vector<byte>   mStorage;
+	std::vector<byte *> mFreeBuffers;
+	std::mutex          mMutex;
+};
+
+#endif
@@ -6,10 +6,21 @@ struct AudioFormat;
 
 class AudioRenderer {
   public:
+	//! How queued audio is split up: small buffers keep latency down, large ones make fewer calls into the device.
+	enum LatencyMode {
+		LATENCY_LOW,
+		LATENCY_NORMAL,
+		LATENCY_POWER_SAVING
+	};
+
 	AudioRenderer();
 	virtual ~AudioRenderer();
 
 	virtual void setFormat( const AudioFormat &format ) = 0;
+	//! Returns the sample rate the device runs at, or zero if unknown.
+	virtual int getDeviceSampleRate() { return 0; }
+	//! Sets the buffer granularity and how far ahead audio is queued. A latency of zero uses the mode's default.
+	virtual void setLatency( LatencyMode mode, int milliseconds ) = 0;
 
 	virtual void play() = 0;
 	virtual void pause() = 0;
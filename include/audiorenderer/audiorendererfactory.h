@@ -7,7 +7,11 @@ class AudioRendererFactory {
   public:
 	enum AudioOutputType {
 		OPENAL_OUTPUT,
-		ALSA_OUTPUT
+		ALSA_OUTPUT,
+		//! OpenAL Soft pulling samples through AL_SOFT_callback_buffer, see OpenAlSoftRenderer
+		OPENAL_SOFT_OUTPUT,
+		//! No device, a virtual clock consumes the audio, see NullRenderer
+		NULL_OUTPUT
 	};
 
 	static AudioRenderer *create( AudioOutputType type );
@@ -0,0 +1,67 @@
+#ifndef NULL_RENDERER_H
+#define NULL_RENDERER_H
+
+#include <chrono>
+#include <deque>
+
+#include "audiorenderer/audiorenderer.h"
+
+class AudioFrame;
+struct AudioFormat;
+
+//! Consumes audio without a device, against a virtual clock that runs at real time, at a multiple of it, or as fast as
+//! audio is queued. Queued frames are timestamped and played out like the buffers of OpenAlRenderer, so movies keep
+//! their audio clock, e.g. in CI containers or when benchmarking decoding without a real-time limit.
+class NullRenderer : public AudioRenderer {
+  public:
+	//! Sets the clock speed of the renderers created afterwards. 1 is real time, zero consumes audio as fast as it is queued.
+	static void setDefaultSpeed( double speed );
+
+	NullRenderer();
+	virtual ~NullRenderer();
+
+	void   setSpeed( double speed );
+	double getSpeed() const { return mSpeed; }
+
+	void   setFormat( const AudioFormat &format ) override;
+	void   setLatency( LatencyMode mode, int milliseconds ) override;
+	bool   hasQueuedFrames() override;
+	bool   hasBufferSpace() override;
+	void   queueFrame( const AudioFrame &frame ) override;
+	void   clearBuffers() override;
+	void   flushBuffers() override;
+	double getCurrentPts() override;
+	void   play() override;
+	void   pause() override;
+	void   stop() override;
+	void   adjustVolume( float offset ) override;
+
+  private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Buffer {
+		double pts;
+		double duration;
+	};
+
+	//! Plays out queued buffers for the virtual time passed since the last call.
+	void advance();
+
+	static double mDefaultSpeed;
+
+	double            mSpeed;
+	bool              mPlaying;
+	float             mVolume;
+	int               mBytesPerSecond;
+	double            mLatency;
+	Clock::time_point mLastUpdate;
+
+	std::deque<Buffer> mBuffers;
+	double             mQueuedDuration;
+	//! Seconds played of the front buffer
+	double mOffset;
+	//! End of the last buffer played out, the clock holds there while nothing is queued
+	double mLastPts;
+};
+
+#endif
@@ -5,11 +5,14 @@
 
 #include <al/al.h>
 #include <al/alc.h>
+#include <cstdint>
 #include <deque>
+#include <vector>
 
 #include "audiorenderer/audiorenderer.h"
 
-#define NUM_BUFFERS 10
+// upper bound on the buffers derived from the latency target
+#define MAX_BUFFERS 64
 
 class AudioFrame;
 struct AudioFormat;
@@ -20,6 +23,8 @@ class OpenAlRenderer : public AudioRenderer {
 	virtual ~OpenAlRenderer();
 
 	void   setFormat( const AudioFormat &format ) override;
+	int    getDeviceSampleRate() override;
+	void   setLatency( LatencyMode mode, int milliseconds ) override;
 	bool   hasQueuedFrames() override;
 	bool   hasBufferSpace() override;
 	void   queueFrame( const AudioFrame &frame ) override;
@@ -32,21 +37,43 @@ class OpenAlRenderer : public AudioRenderer {
 	void   stop() override;
 	void   adjustVolume( float offset ) override;
 
+	//! Returns the OpenAL format for the sample type and channel count, or zero if the implementation lacks it.
+	static ALenum findFormat( unsigned int bits, unsigned int numChannels, bool isFloat );
+
   private:
 	bool isPlaying();
+	//! Derives the buffer size and count from the latency settings and the current format.
+	void updateBufferLayout();
+	//! Hands staged samples to OpenAL, one full buffer at a time. A partial buffer is only sent when the source would otherwise starve.
+	void submitBuffers( bool allowPartial );
+	void unqueueProcessed();
 
 	static ALCdevice * mPAudioDevice;
 	static ALCcontext *mPAlcContext;
 	static int         mRefCount;
 
-	ALuint             mAudioSource;
-	ALuint             mAudioBuffers[NUM_BUFFERS];
-	int                mCurrentBuffer;
-	float              mVolume;
-	ALenum             mAudioFormat;
-	ALsizei            mNumChannels;
-	ALsizei            mFrequency;
-	std::deque<double> mPtsQueue;
+	ALuint              mAudioSource;
+	ALuint              mAudioBuffers[MAX_BUFFERS];
+	int                 mNumBuffers;
+	std::vector<ALuint> mFreeBuffers;
+	float               mVolume;
+	ALenum              mAudioFormat;
+	ALsizei             mNumChannels;
+	ALsizei             mFrequency;
+	std::deque<double>  mPtsQueue;
+
+	// float samples the device cannot take are converted to 16 bits
+	bool                 mConvertToS16;
+	std::vector<int16_t> mConversionBuffer;
+
+	// decoded frames are coalesced into buffers of a fixed duration
+	LatencyMode          mLatencyMode;
+	int                  mLatency;
+	int                  mBytesPerSecond;
+	size_t               mBufferBytes;
+	std::vector<uint8_t> mStaging;
+	size_t               mStagingSize;
+	double               mStagingPts;
 };
 
 #endif
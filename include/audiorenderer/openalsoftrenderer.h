@@ -0,0 +1,93 @@
+#ifndef OPENAL_SOFT_RENDERER_H
+#define OPENAL_SOFT_RENDERER_H
+
+#pragma comment( lib, "OpenAL32.lib" )
+
+#include <al/al.h>
+#include <al/alc.h>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "audiorenderer/audioframe.h"
+#include "audiorenderer/audiorenderer.h"
+#include "common/spscring.h"
+
+struct AudioFormat;
+
+//! Plays audio through the OpenAL Soft extensions instead of a queue of buffers. With AL_SOFT_callback_buffer the
+//! mixer pulls samples on demand from a ring of decoded frames, so no more than the latency target is ever queued,
+//! and the clock follows the samples actually handed to the mixer. With ALC_SOFT_loopback there is no device: the
+//! sources are only mixed when renderLoopback() is called, which makes playback headless and deterministic.
+//! Creates its own OpenAL context, so it is not meant to be used next to OpenAlRenderer in the same process.
+class OpenAlSoftRenderer : public AudioRenderer {
+  public:
+	//! Mixes into a loopback device instead of the default device, for the renderers created while none exist.
+	static void setLoopback( bool enabled, int sampleRate = 48000 );
+	//! Mixes \a numSamples interleaved stereo float samples of all sources into \a buffer. Fails unless in loopback mode.
+	static bool renderLoopback( float *buffer, int numSamples );
+
+	OpenAlSoftRenderer();
+	virtual ~OpenAlSoftRenderer();
+
+	void   setFormat( const AudioFormat &format ) override;
+	int    getDeviceSampleRate() override;
+	void   setLatency( LatencyMode mode, int milliseconds ) override;
+	bool   hasQueuedFrames() override;
+	bool   hasBufferSpace() override;
+	void   queueFrame( const AudioFrame &frame ) override;
+	void   clearBuffers() override;
+	void   flushBuffers() override;
+	double getCurrentPts() override;
+	void   play() override;
+	void   pause() override;
+	void   stop() override;
+	void   adjustVolume( float offset ) override;
+
+  private:
+	OpenAlSoftRenderer( const OpenAlSoftRenderer & ) = delete;
+	OpenAlSoftRenderer &operator=( const OpenAlSoftRenderer & ) = delete;
+
+	static void openDevice();
+	static void closeDevice();
+	//! AL_SOFT_callback_buffer callback, called on the mixer thread.
+	static ALsizei AL_APIENTRY bufferCallback( ALvoid *userData, ALvoid *data, ALsizei numBytes );
+
+	ALsizei render( uint8_t *data, ALsizei numBytes );
+	bool    isPlaying();
+
+	static ALCdevice * mPAudioDevice;
+	static ALCcontext *mPAlcContext;
+	static int         mRefCount;
+	static bool        mUseLoopback;
+	static int         mLoopbackSampleRate;
+
+	ALuint  mAudioSource;
+	ALuint  mAudioBuffer;
+	float   mVolume;
+	ALenum  mAudioFormat;
+	ALsizei mFrequency;
+	int     mBytesPerSecond;
+	uint8_t mSilence;
+
+	// float samples the device cannot take are converted to 16 bits
+	bool                 mConvertToS16;
+	std::vector<int16_t> mConversionBuffer;
+
+	// frames between the feeding thread and the mixer, which only ever touches mRenderFrame and the consumer side
+	SpscRing<AudioFrame> mRing;
+	//! Held by the mixer while it renders. clearBuffers() takes it to empty the ring from both ends, the mixer never waits for it.
+	std::mutex           mRenderMutex;
+	AudioFrame           mStagingFrame;
+	AudioFrame           mRenderFrame;
+	uint32_t             mRenderOffset;
+	std::atomic<int>     mQueuedBytes;
+	std::atomic<double>  mRenderedPts;
+
+	LatencyMode mLatencyMode;
+	int         mLatency;
+	int         mLatencyBytes;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+//! Maps keys to values, evicting the least recently used entry once the capacity is reached.
+template <typename Key, typename Value>
+class LruCache {
+  public:
+	explicit LruCache( size_t capacity )
+	    : m_Capacity( capacity )
+	{
+	}
+
+	//! Returns the value for \a key and marks it as most recently used, or NULL if it is not cached.
+	Value *get( const Key &key )
+	{
+		auto itr = m_Index.find( key );
+		if( itr == m_Index.end() )
+			return NULL;
+
+		m_Entries.splice( m_Entries.begin(), m_Entries, itr->second );
+		return &itr->second->second;
+	}
+
+	bool contains( const Key &key ) const { return m_Index.count( key ) > 0; }
+
+	void put( const Key &key, const Value &value )
+	{
+		auto itr = m_Index.find( key );
+		if( itr != m_Index.end() ) {
+			itr->second->second = value;
+			m_Entries.splice( m_Entries.begin(), m_Entries, itr->second );
+			return;
+		}
+
+		if( m_Capacity == 0 )
+			return;
+
+		while( m_Entries.size() >= m_Capacity ) {
+			m_Index.erase( m_Entries.back().first );
+			m_Entries.pop_back();
+		}
+
+		m_Entries.emplace_front( key, value );
+		m_Index[key] = m_Entries.begin();
+	}
+
+	void clear()
+	{
+		m_Index.clear();
+		m_Entries.clear();
+	}
+
+	void setCapacity( size_t capacity )
+	{
+		m_Capacity = capacity;
+		while( m_Entries.size() > m_Capacity ) {
+			m_Index.erase( m_Entries.back().first );
+			m_Entries.pop_back();
+		}
+	}
+
+	size_t getCapacity() const { return m_Capacity; }
+	size_t size() const { return m_Entries.size(); }
+
+  private:
+	typedef std::list<std::pair<Key, Value>> EntryList;
+
+	EntryList                                             m_Entries;
+	std::unordered_map<Key, typename EntryList::iterator> m_Index;
+	size_t                                                m_Capacity;
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef SAMPLE_CONVERSION_H
+#define SAMPLE_CONVERSION_H
+
+#include <cstddef>
+#include <cstdint>
+
+class SampleConversion {
+  public:
+	//! Converts \a count float samples in [-1, 1] to 16-bit integers, clipping whatever lies outside.
+	static void floatToS16( const float *src, int16_t *dst, size_t count );
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+//! Fixed-capacity queue for exactly one producer thread and one consumer thread, without locks. Items are swapped in
+//! and out of preallocated slots rather than copied, so buffers owned by the items circulate between the two threads
+//! instead of being allocated per item.
+template <typename T>
+class SpscRing {
+  public:
+	explicit SpscRing( size_t capacity )
+	    : m_Slots( capacity + 1 )
+	    , m_Head( 0 )
+	    , m_Tail( 0 )
+	{
+	}
+
+	//! Producer side. Swaps \a item into the ring, leaving it with the contents of a recycled slot. Returns false if the ring is full.
+	bool push( T &item )
+	{
+		const size_t tail = m_Tail.load( std::memory_order_relaxed );
+		const size_t next = advance( tail );
+		if( next == m_Head.load( std::memory_order_acquire ) )
+			return false;
+
+		std::swap( m_Slots[tail], item );
+		m_Tail.store( next, std::memory_order_release );
+		return true;
+	}
+
+	//! Consumer side. Swaps the oldest item into \a item. Returns false if the ring is empty.
+	bool pop( T &item )
+	{
+		const size_t head = m_Head.load( std::memory_order_relaxed );
+		if( head == m_Tail.load( std::memory_order_acquire ) )
+			return false;
+
+		std::swap( m_Slots[head], item );
+		m_Head.store( advance( head ), std::memory_order_release );
+		return true;
+	}
+
+	bool empty() const { return m_Head.load( std::memory_order_acquire ) == m_Tail.load( std::memory_order_acquire ); }
+	bool full() const { return advance( m_Tail.load( std::memory_order_acquire ) ) == m_Head.load( std::memory_order_acquire ); }
+
+	//! Drops all items. Only safe while neither the producer nor the consumer is running.
+	void clear() { m_Head.store( m_Tail.load() ); }
+
+  private:
+	size_t advance( size_t index ) const { return ( index + 1 ) % m_Slots.size(); }
+
+	std::vector<T> m_Slots;
+
+	// written by the consumer and the producer respectively
+	std::atomic<size_t> m_Head;
+	std::atomic<size_t> m_Tail;
+};
+
+#endif
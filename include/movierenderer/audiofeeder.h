@@ -0,0 +1,70 @@
+#ifndef AUDIO_FEEDER_H
+#define AUDIO_FEEDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "audiorenderer/audioframe.h"
+#include "audiorenderer/audiorenderer.h"
+#include "common/spscring.h"
+
+class MovieDecoder;
+
+//! Keeps the audio renderer of a movie fed independently of the render loop. A thread per movie decodes audio ahead
+//! into a lock-free ring, and a single output thread shared by all movies moves frames from the rings to their
+//! renderers and samples the renderer clocks. The render thread only reads the clock, so a stalled frame no longer
+//! starves the audio device.
+class AudioFeeder {
+  public:
+	AudioFeeder( MovieDecoder &decoder, AudioRenderer &renderer );
+	~AudioFeeder();
+
+	//! Returns the presentation time of the audio being played. Safe to call from any thread.
+	double getClock() const { return m_Clock.load(); }
+
+	void play();
+	void pause();
+	//! Stops the renderer and drops all decoded audio.
+	void stop();
+	void setLatency( AudioRenderer::LatencyMode mode, int milliseconds );
+
+	//! Waits for decoding and output to stop and drops all decoded audio. Until resume() the caller has the audio
+	//! stream of the decoder and the renderer to itself, e.g. to seek or to change the output format.
+	void suspend();
+	void resume();
+
+  private:
+	AudioFeeder( const AudioFeeder & ) = delete;
+	AudioFeeder &operator=( const AudioFeeder & ) = delete;
+
+	void runDecoder();
+	//! Lets the decoder thread check for work, e.g. when a packet arrives or the ring has space again.
+	void wakeDecoder();
+	//! Queues decoded frames while the renderer has space and samples its clock. Runs on the output thread.
+	void service();
+
+	static void runOutput( unsigned int generation );
+	static void addFeeder( AudioFeeder *feeder );
+	static void removeFeeder( AudioFeeder *feeder );
+
+	MovieDecoder & m_Decoder;
+	AudioRenderer &m_Renderer;
+
+	SpscRing<AudioFrame> m_Ring;
+	AudioFrame           m_DecodedFrame;
+	AudioFrame           m_OutputFrame;
+
+	std::thread             m_DecodeThread;
+	std::mutex              m_DecodeMutex;
+	std::mutex              m_WakeMutex;
+	std::condition_variable m_WakeCondition;
+	bool                    m_bWakeDecoder;
+	std::mutex              m_RendererMutex;
+	std::atomic<bool>       m_bStop;
+	std::atomic<bool>       m_bPaused;
+	std::atomic<double>     m_Clock;
+};
+
+#endif
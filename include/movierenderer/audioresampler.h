@@ -0,0 +1,79 @@
+#ifndef AUDIO_RESAMPLER_H
+#define AUDIO_RESAMPLER_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+#include <libswresample/swresample.h>
+}
+
+//! Converts decoded audio to the interleaved format, sample rate and channel count of the output device in a single pass.
+//! The converter is built once and only rebuilt when the input format or the output settings change. Downmixing
+//! multichannel float audio to stereo happens here, with vectorised kernels, before libswresample converts the rest.
+//! When only the sample format or layout changes, a kernel specialised for the formats and channel count does the
+//! work, and libswresample is not involved at all.
+class AudioResampler {
+  public:
+	enum Quality {
+		//! Short filters, for many simultaneous streams or slow machines
+		QUALITY_FAST,
+		//! The defaults of libswresample
+		QUALITY_NORMAL,
+		//! Long filters with interpolated coefficients
+		QUALITY_HIGH
+	};
+
+	//! Converts \a numSamples samples per channel from \a src to interleaved \a dst.
+	typedef void ( *Kernel )( const uint8_t *const *src, uint8_t *dst, int numSamples );
+
+	AudioResampler();
+	~AudioResampler();
+
+	//! Sets the output format. Zero for \a sampleRate or \a numChannels keeps those of the input.
+	void setOutput( AVSampleFormat format, int sampleRate = 0, int numChannels = 0 );
+	void    setQuality( Quality quality );
+	Quality getQuality() const { return m_Quality; }
+
+	//! Converts \a frame into \a buffer of \a bufferSize bytes. Returns the number of bytes written, or -1 if no converter could be built.
+	int convert( const AVFrame *frame, uint8_t *buffer, int bufferSize );
+	//! Drops the converter and the samples it buffers, e.g. after seeking.
+	void reset();
+
+  private:
+	AudioResampler( const AudioResampler & ) = delete;
+	AudioResampler &operator=( const AudioResampler & ) = delete;
+
+	static const int MAX_DOWNMIX_SOURCES = 4;
+
+	static Kernel findKernel( int inputFormat, AVSampleFormat outputFormat, int numChannels );
+
+	bool configure( const AVFrame *frame, uint64_t inputLayout );
+	bool setupDownmix( uint64_t inputLayout );
+	void downmix( const AVFrame *frame );
+
+	std::mutex     m_Mutex;
+	bool           m_bConfigured;
+	Kernel         m_pKernel;
+	SwrContext *   m_pContext;
+	AVSampleFormat m_OutputFormat;
+	int            m_OutputSampleRate;
+	int            m_OutputChannels;
+	Quality        m_Quality;
+	bool           m_bOutputChanged;
+	int            m_InputFormat;
+	int            m_InputSampleRate;
+	uint64_t       m_InputLayout;
+	int            m_NumOutputChannels;
+
+	// planes and gains that make up the left and right output channel
+	bool               m_bDownmix;
+	int                m_NumDownmixSources[2];
+	int                m_DownmixSources[2][MAX_DOWNMIX_SOURCES];
+	float              m_DownmixGains[2][MAX_DOWNMIX_SOURCES];
+	std::vector<float> m_DownmixBuffer;
+};
+
+#endif
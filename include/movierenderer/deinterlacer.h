@@ -0,0 +1,92 @@
+#ifndef DEINTERLACER_H
+#define DEINTERLACER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+class FramePool;
+
+//! Turns interlaced frames into progressive ones, right after decoding. Works on 8-bit planar formats, splits
+//! every frame into slices that are filtered in parallel, and can output one frame per field (e.g. 50p from 25i).
+//! Runs on the thread that decodes the video, only the slices are filtered on threads of its own.
+class Deinterlacer {
+  public:
+	enum Mode {
+		//! Leaves the fields interleaved
+		DEINTERLACE_WEAVE,
+		//! Interpolates the missing lines of every field
+		DEINTERLACE_BOB,
+		//! Blends both fields, which trades combing for ghosting. Always outputs one frame per frame.
+		DEINTERLACE_BLEND,
+		//! Motion-adaptive, edge-directed interpolation after the yadif filter. Adds one frame of latency.
+		DEINTERLACE_YADIF
+	};
+
+	//! Output frames are allocated from \a pool. Uses \a numThreads slice threads, zero picks a number based on the number of cores.
+	explicit Deinterlacer( FramePool &pool, int numThreads = 0 );
+	~Deinterlacer();
+
+	void setMode( Mode mode );
+	Mode getMode() const { return m_Mode; }
+	//! Outputs a frame for every field instead of for every frame, doubling the frame rate.
+	void setFieldRate( bool enabled ) { m_bFieldRate = enabled; }
+	bool isFieldRate() const { return m_bFieldRate; }
+
+	//! Returns true if \a frame is interlaced and has to pass through the deinterlacer.
+	bool accepts( const AVFrame *frame ) const;
+	//! Feeds an interlaced frame shown at \a pts for \a duration seconds.
+	void push( const AVFrame *frame, double pts, double duration );
+	//! Moves the next progressive frame into \a frame. Returns false if there is none.
+	bool pop( AVFrame *frame, double &pts );
+	//! Outputs the frame held back for the look-ahead of yadif, e.g. at the end of the stream.
+	void drain();
+	//! Drops all frames, e.g. after seeking.
+	void flush();
+
+  private:
+	Deinterlacer( const Deinterlacer & ) = delete;
+	Deinterlacer &operator=( const Deinterlacer & ) = delete;
+
+	struct Output {
+		AVFrame *frame;
+		double   pts;
+	};
+
+	void output( const AVFrame *prev, const AVFrame *cur, const AVFrame *next, double pts, double duration );
+	void filter( AVFrame *dst, const AVFrame *prev, const AVFrame *cur, const AVFrame *next, int field, bool secondField, int slice, int numSlices ) const;
+
+	//! Runs \a job for every slice, on the slice threads and the calling thread, and waits for all of them.
+	void runSlices( const std::function<void( int slice, int numSlices )> &job );
+	void runWorker();
+
+	FramePool &        m_FramePool;
+	Mode               m_Mode;
+	bool               m_bFieldRate;
+	AVFrame *          m_pPrevious;
+	AVFrame *          m_pCurrent;
+	double             m_CurrentPts;
+	double             m_CurrentDuration;
+	std::deque<Output> m_Output;
+
+	std::vector<std::thread>                               m_Threads;
+	std::mutex                                             m_Mutex;
+	std::condition_variable                                m_StartCondition;
+	std::condition_variable                                m_DoneCondition;
+	const std::function<void( int slice, int numSlices )> *m_pJob;
+	int                                                    m_NumSlices;
+	int                                                    m_NextSlice;
+	int                                                    m_PendingSlices;
+	uint64_t                                               m_Generation;
+	bool                                                   m_bDone;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef FILTER_GRAPH_H
+#define FILTER_GRAPH_H
+
+#include <cstdint>
+#include <string>
+
+extern "C" {
+#include <libavfilter/avfilter.h>
+#include <libavutil/frame.h>
+}
+
+//! A libavfilter graph for one stream, described in the syntax of ffmpeg's -vf and -af options (e.g. "crop=1280:720,eq=saturation=1.2"
+//! or "loudnorm,atempo=1.25"). The graph is built from the first frame pushed into it, and rebuilt whenever the input format changes.
+class FilterGraph {
+  public:
+	//! \a type is AVMEDIA_TYPE_VIDEO or AVMEDIA_TYPE_AUDIO. Filters that support slice threading use \a numThreads, zero picks a number based on the number of cores.
+	FilterGraph( const std::string &description, AVMediaType type, int numThreads = 0 );
+	~FilterGraph();
+
+	const std::string &getDescription() const { return m_Description; }
+
+	//! Feeds a decoded \a frame that is shown at \a pts seconds. Returns false if the graph could not be built for the frame,
+	//! in which case it should be used unfiltered.
+	bool push( AVFrame *frame, double pts );
+	//! Moves the next filtered frame into \a frame. Returns false if the graph needs more input first.
+	bool pull( AVFrame *frame, double &pts );
+	//! Drops buffered frames and filter state, e.g. after seeking. The graph is rebuilt on the next push().
+	void reset();
+
+  private:
+	FilterGraph( const FilterGraph & ) = delete;
+	FilterGraph &operator=( const FilterGraph & ) = delete;
+
+	bool matches( const AVFrame *frame ) const;
+	bool configure( const AVFrame *frame );
+
+	std::string      m_Description;
+	AVMediaType      m_Type;
+	int              m_NumThreads;
+	AVFilterGraph *  m_pGraph;
+	AVFilterContext *m_pSource;
+	AVFilterContext *m_pSink;
+	bool             m_bConfigured;
+	int              m_Format;
+	int              m_Width;
+	int              m_Height;
+	int              m_SampleRate;
+	uint64_t         m_ChannelLayout;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+//! Hands out refcounted frame buffers from a pool per format and resolution. Buffers return to their pool
+//! when the last reference (e.g. the last VideoFrame) is dropped. Strides and planes are 64-byte aligned.
+class FramePool {
+  public:
+	static const int ALIGNMENT = 64;
+
+	FramePool();
+	~FramePool();
+
+	//! Optionally backs new buffers with transparent huge pages, where the platform supports it.
+	void setUseHugePages( bool enabled ) { m_bUseHugePages = enabled; }
+	bool isUsingHugePages() const { return m_bUseHugePages; }
+
+	//! Allocates pooled buffers for \a frame. Its format, width and height must be set.
+	bool allocate( AVFrame *frame );
+	//! Releases all pools. Buffers still in use are freed when their last reference drops.
+	void clear();
+
+	//! AVCodecContext::get_buffer2 callback. Expects AVCodecContext::opaque to point to a FramePool.
+	static int getBuffer( AVCodecContext *context, AVFrame *frame, int flags );
+
+  private:
+	FramePool( const FramePool & ) = delete;
+	FramePool &operator=( const FramePool & ) = delete;
+
+	struct Key {
+		int format;
+		int width;
+		int height;
+
+		bool operator<( const Key &other ) const
+		{
+			if( format != other.format )
+				return format < other.format;
+			if( width != other.width )
+				return width < other.width;
+			return height < other.height;
+		}
+	};
+
+	struct Pool {
+		AVBufferPool *pool = nullptr;
+		int           lineSize[4] = {};
+		int           size = 0;
+		uint64_t      lastUsed = 0;
+	};
+
+	bool allocate( AVFrame *frame, int alignedWidth, int alignedHeight, const int *strideAlign );
+	void evictUnusedPools();
+
+	static AVBufferRef *allocBuffer( void *opaque, int size );
+	static void         freeBuffer( void *opaque, uint8_t *data );
+
+	std::mutex          m_Mutex;
+	std::map<Key, Pool> m_Pools;
+	uint64_t            m_UseCount;
+	bool                m_bUseHugePages;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef LOOP_CACHE_H
+#define LOOP_CACHE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "movierenderer/videoframe.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+class AudioFrame;
+
+//! Keeps the decoded video frames and resampled audio of one full pass of a looping movie in memory,
+//! so that subsequent passes can be served without reading or decoding anything. Video frames can
+//! optionally be stored compressed with a fast lossless codec (FFV Huffyuv) to stretch the memory budget.
+class LoopCache {
+  public:
+	explicit LoopCache( size_t maxBytes, bool compress = false );
+	~LoopCache();
+
+	//! Appends a frame to the current pass. Returns false (and clears the cache) once the memory budget is exceeded.
+	bool addVideoFrame( const VideoFrame &frame );
+	bool addAudioFrame( const AudioFrame &frame );
+
+	//! Marks the end of the pass, after which frames can be served from the cache.
+	void finishVideo() { m_bVideoComplete = !m_VideoFrames.empty(); }
+	void finishAudio() { m_bAudioComplete = !m_AudioFrames.empty(); }
+
+	bool isVideoComplete() const { return m_bVideoComplete; }
+	bool isAudioComplete() const { return m_bAudioComplete; }
+
+	//! Returns the next frame of a complete pass, wrapping around at the end.
+	bool nextVideoFrame( VideoFrame &frame );
+	bool nextAudioFrame( AudioFrame &frame );
+
+	//! Positions playback at the first frames at or after \a seconds.
+	void seek( double seconds );
+	void clear();
+
+	size_t getSize() const { return m_Size; }
+	size_t getMaxSize() const { return m_MaxSize; }
+
+  private:
+	LoopCache( const LoopCache & ) = delete;
+	LoopCache &operator=( const LoopCache & ) = delete;
+
+	struct CachedVideoFrame {
+		VideoFrame              frame;
+		AVPacket *              packet = nullptr;
+		VideoFrame::PixelFormat format = VideoFrame::PIXEL_FORMAT_YUV420P;
+		double                  pts = 0.0;
+	};
+
+	struct CachedAudioFrame {
+		std::vector<uint8_t> data;
+		double               pts = 0.0;
+	};
+
+	bool openCodecs( const AVFrame *frame );
+	void closeCodecs();
+	bool encode( const VideoFrame &frame, CachedVideoFrame &cached );
+	bool decode( const CachedVideoFrame &cached, VideoFrame &frame );
+
+	std::vector<CachedVideoFrame> m_VideoFrames;
+	std::vector<CachedAudioFrame> m_AudioFrames;
+	size_t                        m_NextVideoFrame;
+	size_t                        m_NextAudioFrame;
+	size_t                        m_Size;
+	size_t                        m_MaxSize;
+	bool                          m_bCompress;
+	bool                          m_bVideoComplete;
+	bool                          m_bAudioComplete;
+	AVCodecContext *              m_pEncoderContext;
+	AVCodecContext *              m_pDecoderContext;
+	AVFrame *                     m_pDecodedFrame;
+};
+
+#endif
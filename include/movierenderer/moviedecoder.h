@@ -2,15 +2,20 @@
 #define MOVIEDECODER_H
 
 #pragma comment( lib, "avcodec.lib" )
+#pragma comment( lib, "avfilter.lib" )
 #pragma comment( lib, "avformat.lib" )
 #pragma comment( lib, "avutil.lib" )
 #pragma comment( lib, "swresample.lib" )
 #pragma comment( lib, "swscale.lib" )
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <string>
 #include <thread>
+#include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -19,6 +24,13 @@ extern "C" {
 }
 
 #include "audiorenderer/audioformat.h"
+#include "common/lrucache.h"
+#include "movierenderer/audioresampler.h"
+#include "movierenderer/deinterlacer.h"
+#include "movierenderer/filtergraph.h"
+#include "movierenderer/framepool.h"
+#include "movierenderer/loopcache.h"
+#include "movierenderer/packetcache.h"
 #include "movierenderer/videoframe.h"
 
 #define MAX_AUDIO_FRAME_SIZE 192000
@@ -27,21 +39,104 @@ class AudioFrame;
 
 class MovieDecoder {
   public:
+	//! Steps taken by the adaptive decoding policy when video decoding falls behind, from cheap to drastic.
+	enum DegradationLevel {
+		DEGRADATION_NONE,
+		DEGRADATION_SKIP_LOOP_FILTER,
+		DEGRADATION_SKIP_NONREF_FRAMES,
+		DEGRADATION_SKIP_IDCT,
+		DEGRADATION_MAX = DEGRADATION_SKIP_IDCT
+	};
+
+	//! The palette hasAlpha() looked at last and whether it has transparent entries, to skip the check while the palette stays the same.
+	struct PaletteAlpha {
+		PaletteAlpha()
+		    : hasAlpha( false )
+		{
+		}
+
+		std::vector<uint8_t> palette;
+		bool                 hasAlpha;
+	};
+
 	explicit MovieDecoder( const std::string &filename );
 	~MovieDecoder();
 
 	bool decodeVideoFrame( VideoFrame &videoFrame );
 	bool decodeAudioFrame( AudioFrame &audioFrame );
-	void seekToTime( double seconds );
+	//! Calls \a callback on the reader thread whenever an audio packet is queued, so an audio decoding thread can wait
+	//! for packets instead of polling. An empty function removes the callback.
+	void setAudioPacketCallback( const std::function<void()> &callback );
+	//! Returns true while audio packets are queued. decodeAudioFrame() may consume a packet without returning a frame.
+	bool hasAudioPackets();
+	//! Seeks to \a seconds. An accurate seek decodes up to the requested position instead of stopping at the preceding keyframe.
+	void seekToTime( double seconds, bool accurate = false );
 	void seekToFrame( uint32_t frame );
+	//! Random access for analysis and editing tools: returns the frame at \a frameNumber, decoding from the nearest preceding
+	//! keyframe in the seek index. Recently decoded frames are cached. Only available while the movie is not playing.
+	bool getFrameAt( uint32_t frameNumber, VideoFrame &frame );
+	bool getFrameAtTime( double seconds, VideoFrame &frame );
+	//! Sets how many decoded frames getFrameAt() keeps around.
+	void setFrameCacheSize( size_t numFrames ) { m_FrameCache.setCapacity( numFrames ); }
 	void start();
 	void pause();
 	void resume();
 	void stop();
-	void loop( bool enabled = true ) { m_bLoop = enabled; }
+	void loop( bool enabled = true );
+	//! Keeps the decoded frames of one full pass of a looping movie in memory (up to \a maxBytes) and serves
+	//! further passes from there instead of reading and decoding the file again. When \a compress is true,
+	//! video frames are stored losslessly compressed, which trades some CPU time for a smaller footprint.
+	void setLoopCache( bool enabled, size_t maxBytes = 256 * 1024 * 1024, bool compress = false );
+	bool isLoopCached() const { return m_bVideoFromCache || m_bAudioFromCache; }
+	//! Keeps the demuxed packets of one full pass of a looping movie in memory (up to \a maxBytes), so that
+	//! further passes are read from RAM instead of from disk. Costs far less memory than setLoopCache().
+	void setPacketCache( bool enabled, size_t maxBytes = 64 * 1024 * 1024 );
+	//! Selects how interlaced video is turned into progressive frames. With \a fieldRate, every field becomes a frame
+	//! of its own, so that e.g. 25i plays back as 50p.
+	void setDeinterlacing( Deinterlacer::Mode mode, bool fieldRate = false );
+	Deinterlacer::Mode getDeinterlaceMode() const { return m_DeinterlaceMode; }
+	//! Runs decoded video through a libavfilter graph, in the syntax of ffmpeg's -vf option (e.g. "crop=1280:720,eq=saturation=1.2").
+	//! Filtering happens after deinterlacing and before the conversion for display. An empty string removes the filter.
+	void setVideoFilter( const std::string &description );
+	//! Runs decoded audio through a libavfilter graph, in the syntax of ffmpeg's -af option (e.g. "loudnorm" or "atempo=1.25").
+	//! Whatever format the graph outputs is converted for the device afterwards. An empty string removes the filter.
+	void setAudioFilter( const std::string &description );
+	//! Releases codecs, the reader thread, packet queues and buffers, keeping only the probed stream information and seek index.
+	void hibernate();
+	//! Opens new codecs and restores the position and play state from before hibernate().
+	//! Returns false and stays hibernated if a codec could not be opened.
+	bool wake();
+	bool isHibernating() const { return m_bHibernating; }
+	//! Backs newly allocated frame buffers with transparent huge pages, where supported.
+	void setUseHugePages( bool enabled = true ) { m_FramePool.setUseHugePages( enabled ); }
+
+	//! Enables the adaptive decoding policy, which trades quality for speed while the video clock lags behind.
+	void setAdaptiveDecoding( bool enabled = true );
+	bool isAdaptiveDecoding() const { return m_bAdaptiveDecoding; }
+	//! Reports how far (in seconds) the video clock lags behind the playback clock. Drives the adaptive decoding policy.
+	void updateLag( double lag );
+	void setDegradationLevel( DegradationLevel level );
+	DegradationLevel getDegradationLevel() const { return m_DegradationLevel; }
+
+	//! Sets how far (in seconds) the video may fall behind before the decoder jumps ahead to a keyframe. Zero disables catching up.
+	void   setCatchUpThreshold( double seconds ) { m_CatchUpThreshold = seconds; }
+	double getCatchUpThreshold() const { return m_CatchUpThreshold; }
+	//! If the video clock lags more than the catch-up threshold behind \a targetPts, skips ahead to a keyframe
+	//! when that is cheaper than decoding forward. Returns true if packets were skipped.
+	bool catchUp( double targetPts );
+
+	//! Sets the size (in pixels) at which the video is shown. Uses the codec's lowres decoding where supported,
+	//! otherwise frames are downscaled after decoding. Pass zero to decode at the native size.
+	void setTargetSize( int width, int height );
+	//! Offscreen movies only decode keyframes, just enough to keep their position.
+	void setVisible( bool visible );
+	bool isVisible() const { return m_bVisible; }
+	//! Returns the lowres factor currently in use: frames are decoded at 1 / 2^lowres of their size.
+	int getLowres() const { return m_pVideoCodecContext ? m_pVideoCodecContext->lowres : 0; }
 
 	bool hasVideo() const { return m_bHasVideo; }
 	bool hasAudio() const { return m_bHasAudio; }
+	bool hasAlpha() const;
 	bool isInitialized() const { return m_bInitialized; }
 
 	bool isPlaying() const { return m_bPlaying; }
@@ -59,6 +154,12 @@ class MovieDecoder {
 
 	double      getAudioTimeBase() const;
 	AudioFormat getAudioFormat();
+	//! Converts audio to \a sampleRate and \a numChannels, e.g. those of the output device. Zero keeps the rate or channels of the stream.
+	//! Multichannel audio is downmixed when \a numChannels is 2. Takes effect for the format returned by getAudioFormat().
+	void setAudioOutput( int sampleRate, int numChannels );
+	int  getAudioOutputChannels() const { return m_AudioOutputChannels; }
+	//! Trades resampling quality for CPU time.
+	void setAudioResampleQuality( AudioResampler::Quality quality ) { m_AudioResampler.setQuality( quality ); }
 
 	double getVideoClock() const;
 	double getAudioClock() const;
@@ -68,29 +169,62 @@ class MovieDecoder {
 	double   getFramesPerSecond() const;
 	uint64_t getNumberOfFrames() const;
 
+	//! Returns the format decoded frames of \a source are converted to before they are handed out.
+	static AVPixelFormat getTargetPixelFormat( AVPixelFormat source );
+	//! Returns true if \a frame has an alpha channel or a palette with transparent entries. \a cache holds the result for the last palette.
+	static bool hasAlpha( const AVFrame *frame, PaletteAlpha &cache );
+
+	//! Initializes FFmpeg
+	static void startFFmpeg();
+
   private:
 	// copy ops are private to prevent copying
 	MovieDecoder( const MovieDecoder & ) = delete;            // no implementation
 	MovieDecoder &operator=( const MovieDecoder & ) = delete; // no implementation
 
 	void readPackets();
-	bool queuePacket( std::queue<AVPacket> &packetQueue, AVPacket *packet ) const;
+	bool readPacket( AVPacket *packet );
+	bool seekPacketCache();
+	bool rewindPacketCache();
+	bool queuePacket( std::deque<AVPacket> &packetQueue, AVPacket *packet ) const;
 	bool queueVideoPacket( AVPacket *packet );
 	bool queueAudioPacket( AVPacket *packet );
-	bool popPacket( std::queue<AVPacket> &packetQueue, AVPacket *packet ) const;
+	bool popPacket( std::deque<AVPacket> &packetQueue, AVPacket *packet ) const;
 	bool popVideoPacket( AVPacket *packet );
+	//! Pops the next video packet if it is a flush packet.
+	bool popVideoFlushPacket();
 	bool popAudioPacket( AVPacket *packet );
-	void clearQueue( std::queue<AVPacket> &packetQueue ) const;
-	void createAVFrame( AVFrame **avFrame, int width, int height, AVPixelFormat format ) const;
+	void clearQueue( std::deque<AVPacket> &packetQueue ) const;
+	void freePacket( AVPacket &packet ) const;
+	void createAVFrame( AVFrame **avFrame, int width, int height, AVPixelFormat format );
 
 	bool initializeVideo();
 	bool initializeAudio();
+	void stopReader();
 
 	bool decodeVideoPacket( AVPacket &packet );
+	//! Drops the frames held by the deinterlacer and the video filter graph.
+	void resetVideoFilters();
+	bool outputVideoFrame( VideoFrame &frame );
+	void applyDiscardSettings();
+	//! Opens a new decoder for the video at \a lowres and swaps it in. Keeps the current decoder and returns false on failure.
+	bool reopenVideoCodec( int lowres );
+	//! Returns the largest lowres factor that still covers the target size.
+	int  getTargetLowres() const;
+	//! Opens a decoder context for \a stream from its codec parameters, configured like the ones of initializeVideo() and initializeAudio(). Returns NULL on failure.
+	AVCodecContext *openCodecContext( AVStream *stream, AVCodec *codec, int lowres );
+	//! Frees a context from openCodecContext(), or closes the context embedded in \a stream.
+	void freeCodecContext( AVCodecContext *&context, AVStream *stream );
+	void getOutputSize( int &width, int &height ) const;
 	void convertVideoFrame( AVPixelFormat target );
 
-	//! Initializes FFmpeg
-	static void startFFmpeg();
+	//! Runs \a frame through \a filter, guarded by \a mutex, and replaces it with the next filtered frame. Returns false if the filter holds on to it for now.
+	bool filterFrame( std::unique_ptr<FilterGraph> &filter, std::mutex &mutex, AVFrame *frame, double &pts );
+	bool pullFilteredFrame( std::unique_ptr<FilterGraph> &filter, std::mutex &mutex, AVFrame *frame, double &pts );
+
+	bool cacheVideoFrame( VideoFrame &frame );
+	bool cacheAudioFrame( AudioFrame &frame );
+	void resetLoopCache( double seconds );
 
   private:
 	int                  m_VideoStream;
@@ -102,17 +236,19 @@ class MovieDecoder {
 	AVCodec *            m_pAudioCodec;
 	AVStream *           m_pVideoStream;
 	AVStream *           m_pAudioStream;
-	AVSampleFormat       m_SourceFormat;
 	AVSampleFormat       m_TargetFormat;
-	uint8_t              m_AudioBuffer[MAX_AUDIO_FRAME_SIZE * 4];
+	std::vector<uint8_t> m_AudioBuffer;
 	AVFrame *            m_pFrame;
 	AVFrame *            m_pConvertedFrame;
+	AVFrame *            m_pAudioFrame;
+	struct SwsContext *  m_pSwsContext;
+	FramePool            m_FramePool;
 	AVPacket             m_FlushPacket;
-	SwrContext *         m_pSwrContext;
+	AVPacket             m_EndOfStreamPacket;
 	int                  m_MaxVideoQueueSize;
 	int                  m_MaxAudioQueueSize;
-	std::queue<AVPacket> m_VideoQueue;
-	std::queue<AVPacket> m_AudioQueue;
+	std::deque<AVPacket> m_VideoQueue;
+	std::deque<AVPacket> m_AudioQueue;
 	std::mutex           m_VideoQueueMutex;
 	std::mutex           m_AudioQueueMutex;
 	std::mutex           m_DecodeVideoMutex;
@@ -127,10 +263,61 @@ class MovieDecoder {
 	bool                 m_bLoop;
 	bool                 m_bDone;
 	bool                 m_bSeeking;
+	bool                 m_bEndOfStream;
 	int                  m_SeekFlags;
 	int64_t              m_SeekTimestamp;
 	double               m_AudioClock;
 	double               m_VideoClock;
+	bool                 m_bAdaptiveDecoding;
+	DegradationLevel     m_DegradationLevel;
+	int                  m_LaggingUpdates;
+	int                  m_HeadroomUpdates;
+	double               m_CatchUpThreshold;
+	std::atomic<bool>    m_bCatchingUp;
+	bool                 m_bWaitForKeyFrame;
+	PaletteAlpha         m_PaletteAlpha;
+	std::atomic<bool>    m_bPaletteHasAlpha;
+	bool                 m_bVisible;
+	int                  m_TargetWidth;
+	int                  m_TargetHeight;
+	double               m_VideoSeekTarget;
+	double               m_AudioSeekTarget;
+	bool                 m_bHibernating;
+	bool                 m_bWasStarted;
+	bool                 m_bWasPaused;
+	double               m_HibernatePosition;
+
+	std::unique_ptr<LoopCache> m_pLoopCache;
+	std::mutex                 m_LoopCacheMutex;
+	bool                       m_bRecordingVideo;
+	bool                       m_bRecordingAudio;
+	bool                       m_bVideoFromCache;
+	bool                       m_bAudioFromCache;
+	double                     m_LastCachedVideoPts;
+	double                     m_LastCachedAudioPts;
+
+	std::unique_ptr<PacketCache> m_pPacketCache;
+	std::mutex                   m_PacketCacheMutex;
+	bool                         m_bRecordingPackets;
+
+	LruCache<int64_t, VideoFrame> m_FrameCache;
+	int64_t                       m_RandomAccessFrame;
+	bool                          m_bRandomAccessed;
+
+	std::unique_ptr<Deinterlacer> m_pDeinterlacer;
+	Deinterlacer::Mode            m_DeinterlaceMode;
+	bool                          m_bDeinterlaceFieldRate;
+
+	AudioResampler m_AudioResampler;
+	int            m_AudioOutputSampleRate;
+	int            m_AudioOutputChannels;
+
+	std::unique_ptr<FilterGraph> m_pVideoFilter;
+	std::mutex                   m_VideoFilterMutex;
+	std::unique_ptr<FilterGraph> m_pAudioFilter;
+	std::mutex                   m_AudioFilterMutex;
+
+	std::function<void()> m_AudioPacketCallback;
 };
 
 #endif
@@ -0,0 +1,80 @@
+#ifndef OFFLINE_DECODER_H
+#define OFFLINE_DECODER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include "movierenderer/framepool.h"
+#include "movierenderer/moviedecoder.h"
+#include "movierenderer/videoframe.h"
+
+//! Decodes all video frames of a file as fast as possible, for batch work such as analysis, export or thumbnail sheets.
+//! The file is split into segments at the keyframes of the seek index, which are decoded concurrently by independent
+//! demuxers and codecs. Frames are delivered in presentation order through a reorder buffer of bounded size.
+class OfflineDecoder {
+  public:
+	//! Called in presentation order for every frame. Return false to stop decoding.
+	typedef std::function<bool( const VideoFrame &frame )> FrameCallback;
+
+	//! Uses \a numThreads workers (zero picks one per core) and buffers at most \a maxBufferedFrames out-of-order frames.
+	explicit OfflineDecoder( const std::string &filename, int numThreads = 0, size_t maxBufferedFrames = 64 );
+	~OfflineDecoder();
+
+	//! Decodes the whole file, invoking \a callback on the calling thread. Returns the number of frames delivered.
+	uint64_t decode( const FrameCallback &callback );
+	//! Stops a running decode() as soon as possible. Can be called from any thread.
+	void cancel();
+
+	int    getFrameWidth() const;
+	int    getFrameHeight() const;
+	double getDuration() const;
+	double getFramesPerSecond() const;
+	//! Returns the number of segments the file is split into, which limits the achievable parallelism.
+	size_t getNumSegments() const { return m_Segments.size(); }
+
+  private:
+	OfflineDecoder( const OfflineDecoder & ) = delete;
+	OfflineDecoder &operator=( const OfflineDecoder & ) = delete;
+
+	struct Segment {
+		int64_t start; // pts of the first keyframe, in the stream's time base
+		int64_t end;   // pts of the keyframe starting the next segment, or AV_NOPTS_VALUE for the last one
+
+		std::deque<VideoFrame> frames;
+		bool                   done = false;
+	};
+
+	void createSegments();
+	void decodeSegments();
+	bool decodeSegment( size_t index, AVFormatContext *formatContext, AVCodecContext *codecContext, AVFrame *frame, struct SwsContext **swsContext, MovieDecoder::PaletteAlpha &paletteAlpha );
+	bool deliverFrame( size_t index, AVFrame *frame, struct SwsContext **swsContext, MovieDecoder::PaletteAlpha &paletteAlpha );
+
+	std::string          m_Filename;
+	AVFormatContext *    m_pFormatContext;
+	AVStream *           m_pVideoStream;
+	int                  m_VideoStream;
+	int                  m_NumThreads;
+	size_t               m_MaxBufferedFrames;
+	FramePool            m_FramePool;
+	std::vector<Segment> m_Segments;
+
+	std::mutex              m_Mutex;
+	std::condition_variable m_Condition;
+	std::atomic<size_t>     m_NextSegmentToDecode;
+	size_t                  m_NextSegmentToDeliver;
+	size_t                  m_NumBufferedFrames;
+	std::atomic<bool>       m_bCancelled;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef PACKET_CACHE_H
+#define PACKET_CACHE_H
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+//! Keeps the demuxed (still compressed) packets of one full pass of a looping movie in memory,
+//! so that subsequent passes are read from RAM instead of from disk.
+class PacketCache {
+  public:
+	explicit PacketCache( size_t maxBytes );
+	~PacketCache();
+
+	//! Appends a reference to \a packet. Returns false (and clears the cache) once the memory budget is exceeded.
+	bool add( const AVPacket *packet );
+	//! Marks the end of the pass, after which packets can be replayed.
+	void finish() { m_bComplete = !m_Packets.empty(); }
+	bool isComplete() const { return m_bComplete; }
+
+	//! Returns a new reference to the next packet, or false at the end of the pass.
+	bool next( AVPacket *packet );
+	void rewind() { m_NextPacket = 0; }
+	//! Positions replay at the last keyframe of \a streamIndex at or before \a timestamp (in the stream's time base).
+	void seek( int streamIndex, int64_t timestamp );
+	void clear();
+
+	size_t getSize() const { return m_Size; }
+	size_t getMaxSize() const { return m_MaxSize; }
+
+  private:
+	PacketCache( const PacketCache & ) = delete;
+	PacketCache &operator=( const PacketCache & ) = delete;
+
+	std::vector<AVPacket *> m_Packets;
+	size_t                  m_NextPacket;
+	size_t                  m_Size;
+	size_t                  m_MaxSize;
+	bool                    m_bComplete;
+};
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef POSTER_CACHE_H
+#define POSTER_CACHE_H
+
+#include <string>
+
+#include "movierenderer/videoframe.h"
+
+//! Stores single decoded frames on disk as raw planes, which load without decoding. Used to show a poster frame
+//! before the movie itself has been opened.
+class PosterCache {
+  public:
+	//! Properties of the movie stored alongside the poster, so they are known before the movie is opened.
+	struct Info {
+		int    width = 0;
+		int    height = 0;
+		double duration = 0.0;
+		double position = 0.0;
+	};
+
+	//! Returns the path of the poster \a name of \a filename in \a directory. The path changes whenever the file is modified.
+	static std::string getPath( const std::string &directory, const std::string &filename, const std::string &name );
+
+	static bool write( const std::string &path, const VideoFrame &frame, const Info &info );
+	static bool read( const std::string &path, VideoFrame &frame, Info &info );
+};
+
+#endif
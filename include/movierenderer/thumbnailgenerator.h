@@ -0,0 +1,74 @@
+#ifndef THUMBNAIL_GENERATOR_H
+#define THUMBNAIL_GENERATOR_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct SwsContext;
+
+//! Creates thumbnail strips (contact sheets) of many files at once. Only the keyframe nearest to every sample
+//! position is decoded, scaled down straight into the atlas and, if a cache directory is set, stored on disk as JPEG.
+class ThumbnailGenerator {
+  public:
+	//! A grid of equally sized thumbnails in a single RGBA image, row by row.
+	struct Strip {
+		int                  columns = 0;
+		int                  rows = 0;
+		int                  thumbnailWidth = 0;
+		int                  thumbnailHeight = 0;
+		std::vector<double>  times;  // position of every thumbnail in seconds
+		std::vector<uint8_t> pixels; // RGBA, getWidth() * getHeight() * 4 bytes
+
+		int  getWidth() const { return columns * thumbnailWidth; }
+		int  getHeight() const { return rows * thumbnailHeight; }
+		bool isValid() const { return !pixels.empty(); }
+	};
+
+	//! Starts \a numThreads workers, zero picks one per core.
+	explicit ThumbnailGenerator( int numThreads = 0 );
+	~ThumbnailGenerator();
+
+	//! Strips are read from and written to \a path. Pass an empty path to disable the cache.
+	void setCacheDirectory( const std::string &path );
+
+	//! Queues \a filename. The strip holds \a count thumbnails, \a thumbnailWidth pixels wide, in rows of \a columns.
+	std::future<Strip> generate( const std::string &filename, int count = 10, int thumbnailWidth = 160, int columns = 10 );
+	//! Number of files still waiting for a worker.
+	size_t getNumPending();
+
+  private:
+	ThumbnailGenerator( const ThumbnailGenerator & ) = delete;
+	ThumbnailGenerator &operator=( const ThumbnailGenerator & ) = delete;
+
+	struct Job {
+		std::string         filename;
+		int                 count;
+		int                 thumbnailWidth;
+		int                 columns;
+		std::promise<Strip> promise;
+	};
+
+	void run();
+
+	std::string getCachePath( const Job &job ) const;
+
+	static bool createStrip( const Job &job, Strip &strip, SwsContext **swsContext );
+	static bool readStrip( const std::string &path, Strip &strip, SwsContext **swsContext );
+	static bool writeStrip( const std::string &path, const Strip &strip, SwsContext **swsContext );
+
+	std::vector<std::thread> m_Workers;
+	std::deque<Job>          m_Jobs;
+	std::mutex               m_Mutex;
+	std::condition_variable  m_Condition;
+	std::string              m_CacheDirectory;
+	bool                     m_bDone;
+};
+
+#endif
@@ -3,45 +3,100 @@
 
 #include "common/commontypes.h"
 
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+//! Holds a reference to the (refcounted) buffers of a decoded frame. Copying a VideoFrame only adds a reference,
+//! so frames can be queued, cached or handed to another thread without copying pixel data.
 class VideoFrame {
   public:
+	enum PixelFormat {
+		PIXEL_FORMAT_YUV420P,
+		PIXEL_FORMAT_YUVA420P,
+		PIXEL_FORMAT_RGBA
+	};
+
+	static const int MAX_PLANES = 4;
+
+	struct Plane {
+		byte *data = nullptr;
+		int   lineSize = 0;
+		int   width = 0;
+		int   height = 0;
+		int   bitDepth = 0;
+	};
+
 	VideoFrame();
+	VideoFrame( const VideoFrame &other );
+	VideoFrame( VideoFrame &&other ) noexcept;
+	~VideoFrame();
+
+	VideoFrame &operator=( const VideoFrame &other );
+	VideoFrame &operator=( VideoFrame &&other ) noexcept;
+
+	//! Adds a reference to the buffers of \a frame. Returns false if \a frame is not refcounted.
+	bool reference( const AVFrame *frame, PixelFormat format );
+	//! Drops the reference to the frame buffers.
+	void release();
 
 	bool isValid() const
 	{
-		return ( m_YPlane && m_UPlane && m_VPlane && m_Width > 0 && m_Height > 0 );
+		if( !m_pFrame || m_Width <= 0 || m_Height <= 0 )
+			return false;
+
+		switch( m_PixelFormat ) {
+		case PIXEL_FORMAT_RGBA:
+			return m_NumPlanes >= 1;
+		case PIXEL_FORMAT_YUVA420P:
+			return m_NumPlanes >= 4;
+		default:
+			return m_NumPlanes >= 3;
+		}
 	}
 
-	size_t getYDataSize() const;
-	size_t getUDataSize() const;
-	size_t getVDataSize() const;
-	byte * getYPlane() const;
-	byte * getUPlane() const;
-	byte * getVPlane() const;
-	double getPts() const;
-	int    getWidth() const;
-	int    getHeight() const;
-	int    getYLineSize() const;
-	int    getULineSize() const;
-	int    getVLineSize() const;
-
-	void storeYPlane( byte *data, int lineSize );
-	void storeUPlane( byte *data, int lineSize );
-	void storeVPlane( byte *data, int lineSize );
+	//! Returns true if the frame has transparent pixels. Packed RGBA frames converted from opaque sources do not.
+	bool hasAlpha() const { return m_bHasAlpha; }
+	//! Overrides the alpha reported for the format, which is set by reference().
+	void setHasAlpha( bool hasAlpha ) { m_bHasAlpha = hasAlpha; }
+
+	int            getNumPlanes() const { return m_NumPlanes; }
+	const Plane &  getPlane( int index ) const { return m_Planes[index]; }
+	const AVFrame *getAVFrame() const { return m_pFrame; }
+
+	size_t      getYDataSize() const;
+	size_t      getUDataSize() const;
+	size_t      getVDataSize() const;
+	size_t      getADataSize() const;
+	size_t      getRGBADataSize() const;
+	byte *      getYPlane() const;
+	byte *      getUPlane() const;
+	byte *      getVPlane() const;
+	byte *      getAPlane() const;
+	byte *      getRGBAPlane() const;
+	PixelFormat getPixelFormat() const;
+	double      getPts() const;
+	int         getWidth() const;
+	int         getHeight() const;
+	int         getYLineSize() const;
+	int         getULineSize() const;
+	int         getVLineSize() const;
+	int         getALineSize() const;
+	int         getRGBALineSize() const;
+
 	void setPts( double pts );
-	void setWidth( int width );
-	void setHeight( int height );
 
   private:
-	byte * m_YPlane = nullptr;
-	byte * m_UPlane = nullptr;
-	byte * m_VPlane = nullptr;
-	double m_Pts = 0.0;
-	int    m_Width = 0;
-	int    m_Height = 0;
-	int    m_YLineSize = 0;
-	int    m_ULineSize = 0;
-	int    m_VLineSize = 0;
+	size_t getDataSize( int index ) const;
+
+	AVFrame *   m_pFrame = nullptr;
+	Plane       m_Planes[MAX_PLANES];
+	int         m_NumPlanes = 0;
+	PixelFormat m_PixelFormat = PIXEL_FORMAT_YUV420P;
+	bool        m_bHasAlpha = false;
+	double      m_Pts = 0.0;
+	int         m_Width = 0;
+	int         m_Height = 0;
 };
 
 #endif
@@ -4,60 +4,366 @@
 #include "cinder/gl/draw.h"
 #include "cinder/gl/scoped.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "movierenderer/postercache.h"
+
 using namespace ci;
 
 namespace ph {
 namespace ffmpeg {
 
-MovieGl::MovieGl(const fs::path &path, bool playAudio)
-    : mWidth( 0 )
+namespace {
+
+//! Movies shared by playback groups, keyed by file path and group name
+std::map<std::pair<std::string, std::string>, std::weak_ptr<MovieGl>> sSharedMovies;
+std::mutex                                                           sSharedMoviesMutex;
+
+//! Directory of the poster frame cache, empty if disabled
+std::string sPosterCacheDirectory;
+
+//! Audio renderer created for new movies
+AudioRendererFactory::AudioOutputType sAudioOutputType = AudioRendererFactory::OPENAL_OUTPUT;
+
+//! Opens movies in the background, one at a time, so that many movies created at once don't compete for the disk
+class DecoderOpener {
+  public:
+	static DecoderOpener &instance()
+	{
+		static DecoderOpener opener;
+		return opener;
+	}
+
+	std::future<std::unique_ptr<MovieDecoder>> open( const std::string &filename )
+	{
+		std::packaged_task<std::unique_ptr<MovieDecoder>()> task( [filename] { return std::make_unique<MovieDecoder>( filename ); } );
+		auto                                                 result = task.get_future();
+
+		std::lock_guard<std::mutex> lock( mMutex );
+		mTasks.push_back( std::move( task ) );
+		mCondition.notify_one();
+
+		return result;
+	}
+
+  private:
+	DecoderOpener()
+	    : mDone( false )
+	{
+		mThread = std::thread( [this] {
+			while( true ) {
+				std::packaged_task<std::unique_ptr<MovieDecoder>()> task;
+				{
+					std::unique_lock<std::mutex> lock( mMutex );
+					mCondition.wait( lock, [this] { return mDone || !mTasks.empty(); } );
+					if( mDone )
+						break;
+
+					task = std::move( mTasks.front() );
+					mTasks.pop_front();
+				}
+
+				task();
+			}
+		} );
+	}
+
+	~DecoderOpener()
+	{
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mDone = true;
+			mCondition.notify_all();
+		}
+
+		mThread.join();
+	}
+
+	std::deque<std::packaged_task<std::unique_ptr<MovieDecoder>()>> mTasks;
+	std::mutex                                                      mMutex;
+	std::condition_variable                                         mCondition;
+	std::thread                                                     mThread;
+	bool                                                            mDone;
+};
+
+//! Writes poster frames in the background, so that update() doesn't wait for the disk. Pending writes finish on exit.
+class PosterWriter {
+  public:
+	static PosterWriter &instance()
+	{
+		static PosterWriter writer;
+		return writer;
+	}
+
+	void write( const std::string &path, const VideoFrame &frame, const PosterCache::Info &info )
+	{
+		std::lock_guard<std::mutex> lock( mMutex );
+		mTasks.push_back( Task{ path, frame, info } );
+		mCondition.notify_one();
+	}
+
+  private:
+	struct Task {
+		std::string       path;
+		VideoFrame        frame;
+		PosterCache::Info info;
+	};
+
+	PosterWriter()
+	    : mDone( false )
+	{
+		mThread = std::thread( [this] {
+			while( true ) {
+				Task task;
+				{
+					std::unique_lock<std::mutex> lock( mMutex );
+					mCondition.wait( lock, [this] { return mDone || !mTasks.empty(); } );
+					if( mTasks.empty() )
+						break;
+
+					task = std::move( mTasks.front() );
+					mTasks.pop_front();
+				}
+
+				PosterCache::write( task.path, task.frame, task.info );
+			}
+		} );
+	}
+
+	~PosterWriter()
+	{
+		{
+			std::lock_guard<std::mutex> lock( mMutex );
+			mDone = true;
+			mCondition.notify_all();
+		}
+
+		mThread.join();
+	}
+
+	std::deque<Task>        mTasks;
+	std::mutex              mMutex;
+	std::condition_variable mCondition;
+	std::thread             mThread;
+	bool                    mDone;
+};
+
+} // namespace
+
+MovieGl::MovieGl(const fs::path &path, bool playAudio, bool openInBackground)
+    : mPath( path )
+    , mWidth( 0 )
     , mHeight( 0 )
+    , mVisible( true )
     , mDuration( 0.0f )
+    , mPlayAudio( playAudio )
+    , mAudioLatencyMode( AudioRenderer::LATENCY_NORMAL )
+    , mAudioLatency( 0 )
+    , mLastUpdateFrame( std::numeric_limits<uint32_t>::max() )
+    , mWritePoster( false )
+    , mPixelFormat( VideoFrame::PIXEL_FORMAT_YUV420P )
     , mAudioRenderer( nullptr )
     , mMovieDecoder( nullptr )
 {
-	mMovieDecoder = std::make_unique<MovieDecoder>( path.generic_string() );
+	//
+	initializeShader();
+
+	// show the cached poster frame right away, preferably the one at the last saved position
+	bool              resumeAtPoster = false;
+	PosterCache::Info info;
+	if( !sPosterCacheDirectory.empty() ) {
+		VideoFrame        poster;
+		const std::string filename = path.generic_string();
+
+		resumeAtPoster = PosterCache::read( PosterCache::getPath( sPosterCacheDirectory, filename, "position" ), poster, info );
+		if( resumeAtPoster || PosterCache::read( PosterCache::getPath( sPosterCacheDirectory, filename, "first" ), poster, info ) ) {
+			mWidth = info.width;
+			mHeight = info.height;
+			mDuration = float( info.duration );
+
+			uploadFrame( poster );
+		}
+		else {
+			mWritePoster = true;
+		}
+	}
+
+	if( openInBackground )
+		mOpening = DecoderOpener::instance().open( path.generic_string() );
+	else
+		initializeDecoder( std::make_unique<MovieDecoder>( path.generic_string() ) );
+
+	// the movie continues where the poster was saved, deferred until it is open
+	if( resumeAtPoster )
+		seekToTime( float( info.position ) );
+}
+
+MovieGl::~MovieGl()
+{
+	if( mMovieDecoder )
+		stop();
+}
+
+void MovieGl::initializeDecoder( std::unique_ptr<MovieDecoder> decoder )
+{
+	mMovieDecoder = std::move( decoder );
 	if( !mMovieDecoder->isInitialized() )
 		throw std::logic_error( "MovieDecoder: Failed to initialize" );
 
-	// initialize OpenAL audio renderer
+	mWidth = static_cast<int32_t>( mMovieDecoder->getFrameWidth() );
+	mHeight = static_cast<int32_t>( mMovieDecoder->getFrameHeight() );
+	mDuration = static_cast<float>( mMovieDecoder->getDuration() );
+
+	// initialize the audio renderer
 	if( mMovieDecoder->hasAudio() ) {
-		const auto audioFormat = mMovieDecoder->getAudioFormat();  // must call getAudioFormat to initialize properly
-		if (playAudio)
-		{
-			mAudioRenderer = std::unique_ptr<AudioRenderer>( AudioRendererFactory::create( AudioRendererFactory::OPENAL_OUTPUT ) );
-			mAudioRenderer->setFormat( audioFormat );
+		if( mPlayAudio ) {
+			mAudioRenderer = createAudioRenderer();
+			mAudioFeeder = std::unique_ptr<AudioFeeder>( new AudioFeeder( *mMovieDecoder, *mAudioRenderer ) );
+		}
+		else {
+			mMovieDecoder->getAudioFormat(); // must call getAudioFormat to initialize properly
 		}
 	}
+}
 
-	//
-	initializeShader();
+bool MovieGl::isOpen()
+{
+	if( mMovieDecoder )
+		return true;
+
+	if( !mOpening.valid() || mOpening.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready )
+		return false;
+
+	try {
+		initializeDecoder( mOpening.get() );
+	}
+	catch( const std::exception &e ) {
+		CI_LOG_E( "failed to open " << mPath << ": " << e.what() );
+		mMovieDecoder.reset();
+		mPendingCalls.clear();
+		return false;
+	}
+
+	// replay what was requested while the movie was being opened
+	auto calls = std::move( mPendingCalls );
+	for( auto &call : calls )
+		call();
+
+	return true;
 }
 
-MovieGl::~MovieGl()
+bool MovieGl::deferUntilOpen( const std::function<void()> &call )
+{
+	if( isOpen() )
+		return false;
+
+	// calls are dropped if the movie failed to open
+	if( mOpening.valid() )
+		mPendingCalls.push_back( call );
+
+	return true;
+}
+
+void MovieGl::setPosterCacheDirectory( const fs::path &directory )
+{
+	sPosterCacheDirectory = directory.generic_string();
+}
+
+void MovieGl::setAudioOutputType( AudioRendererFactory::AudioOutputType type )
 {
-	stop();
+	sAudioOutputType = type;
+}
+
+std::unique_ptr<AudioRenderer> MovieGl::createAudioRenderer()
+{
+	try {
+		return createAudioRenderer( sAudioOutputType );
+	}
+	catch( const std::exception &e ) {
+		// still play, against a virtual clock
+		CI_LOG_W( "no audio output for " << mPath << ": " << e.what() );
+		return createAudioRenderer( AudioRendererFactory::NULL_OUTPUT );
+	}
+}
+
+std::unique_ptr<AudioRenderer> MovieGl::createAudioRenderer( AudioRendererFactory::AudioOutputType type )
+{
+	std::unique_ptr<AudioRenderer> renderer( AudioRendererFactory::create( type ) );
+	renderer->setLatency( mAudioLatencyMode, mAudioLatency );
+
+	// convert to the rate of the device along with the sample format, instead of leaving it to the driver
+	mMovieDecoder->setAudioOutput( renderer->getDeviceSampleRate(), mMovieDecoder->getAudioOutputChannels() );
+	renderer->setFormat( mMovieDecoder->getAudioFormat() ); // must call getAudioFormat to initialize properly
+
+	return renderer;
+}
+
+void MovieGl::savePoster()
+{
+	if( !isOpen() || !mCurrentFrame.isValid() )
+		return;
+
+	PosterCache::Info info;
+	info.width = mWidth;
+	info.height = mHeight;
+	info.duration = mDuration;
+	info.position = mCurrentFrame.getPts();
+
+	PosterWriter::instance().write( PosterCache::getPath( sPosterCacheDirectory, mPath.generic_string(), "position" ), mCurrentFrame, info );
+}
+
+MovieGlViewRef MovieGl::create( const fs::path &path, const std::string &group, bool playAudio )
+{
+	if( group.empty() )
+		return std::make_shared<MovieGlView>( std::make_shared<MovieGl>( path, playAudio ) );
+
+	std::lock_guard<std::mutex> lock( sSharedMoviesMutex );
+
+	// forget groups whose subscribers are all gone
+	for( auto itr = sSharedMovies.begin(); itr != sSharedMovies.end(); ) {
+		if( itr->second.expired() )
+			itr = sSharedMovies.erase( itr );
+		else
+			++itr;
+	}
+
+	const auto key = std::make_pair( path.generic_string(), group );
+
+	auto movie = sSharedMovies[key].lock();
+	if( !movie ) {
+		movie = std::make_shared<MovieGl>( path, playAudio );
+		movie->mGroup = group;
+
+		sSharedMovies[key] = movie;
+	}
+
+	return std::make_shared<MovieGlView>( movie );
 }
 
 void MovieGl::update()
 {
-	if( !mMovieDecoder->isInitialized() )
+	if( !isOpen() || !mMovieDecoder->isInitialized() || mMovieDecoder->isHibernating() )
 		return;
 
-	// decode audio
-	double currentPts;
-	if (mAudioRenderer)	{
-		while( mAudioRenderer->hasBufferSpace() ) {
-			AudioFrame audioFrame;
-			if( mMovieDecoder->decodeAudioFrame( audioFrame ) )
-				mAudioRenderer->queueFrame( audioFrame );
-			else
-				break;
-		}
+	// every subscriber of a shared movie calls update(), but frames are decoded and uploaded only once
+	if( !mGroup.empty() ) {
+		const uint32_t frame = app::getElapsedFrames();
+		if( frame == mLastUpdateFrame )
+			return;
+
+		mLastUpdateFrame = frame;
+	}
 
-		//
-		mAudioRenderer->flushBuffers();
-		currentPts = mAudioRenderer->getCurrentPts();
+	// audio is decoded and played by the feeder, only its clock is needed here
+	double currentPts;
+	if( mAudioFeeder ) {
+		currentPts = mAudioFeeder->getClock();
 	}
 	else {
 		if( mMovieDecoder->hasAudio() ) {
@@ -75,6 +381,12 @@ void MovieGl::update()
 	VideoFrame videoFrame;
 	double currentVideoClock = mMovieDecoder->getVideoClock();
 	const double frameDuration = 1. / mMovieDecoder->getFramesPerSecond();
+
+	mMovieDecoder->updateLag( currentPts - currentVideoClock );
+
+	// when far behind, jump to a keyframe instead of decoding every frame in between
+	mMovieDecoder->catchUp( currentPts );
+
 	while( mMovieDecoder->getVideoClock() < currentPts + ( hasVideo ? 0. : frameDuration * 0.5) && count++ < 100 ) {
 		if( mMovieDecoder->decodeVideoFrame( videoFrame ) ) {
 			if( hasVideo ) {
@@ -91,75 +403,136 @@ void MovieGl::update()
 			break;
 	}
 
-	if( hasVideo ) {
-		// resize textures if needed
-		if( !mYPlane || !mUPlane || !mVPlane || !mFbo || videoFrame.getHeight() != mHeight || videoFrame.getWidth() != mWidth ) {
-			mWidth = videoFrame.getWidth();
-			mHeight = videoFrame.getHeight();
+	if( hasVideo && !sPosterCacheDirectory.empty() ) {
+		mCurrentFrame = videoFrame;
 
-			{
-				const auto fmt = gl::Texture2d::Format().internalFormat( GL_RED ).swizzleMask( GL_RED, GL_RED, GL_RED, GL_ONE );
+		// the first frame after opening becomes the poster for the next start
+		if( mWritePoster ) {
+			mWritePoster = false;
 
-				mYPlane = gl::Texture2d::create( videoFrame.getYLineSize(), mHeight, fmt );
-				mUPlane = gl::Texture2d::create( videoFrame.getULineSize(), mHeight / 2, fmt );
-				mVPlane = gl::Texture2d::create( videoFrame.getVLineSize(), mHeight / 2, fmt );
-			}
+			PosterCache::Info info;
+			info.width = mWidth;
+			info.height = mHeight;
+			info.duration = mDuration;
 
-			{
-				const auto tfmt = gl::Texture2d::Format() /*.target( GL_TEXTURE_RECTANGLE_ARB )*/; // .internalFormat( GL_RGB );
-				const auto fmt = gl::Fbo::Format().colorTexture( tfmt );
+			PosterWriter::instance().write( PosterCache::getPath( sPosterCacheDirectory, mPath.generic_string(), "first" ), videoFrame, info );
+		}
+	}
 
-				mFbo = gl::Fbo::create( mWidth, mHeight, fmt );
-			}
+	// offscreen movies only keep their position
+	if( hasVideo && mVisible )
+		uploadFrame( videoFrame );
+}
+
+void MovieGl::uploadFrame( const VideoFrame &videoFrame )
+{
+	const bool isPacked = videoFrame.getPixelFormat() == VideoFrame::PIXEL_FORMAT_RGBA;
+	const bool hasAlphaPlane = videoFrame.getPixelFormat() == VideoFrame::PIXEL_FORMAT_YUVA420P;
+
+	// resize textures if needed
+	if( !mFbo || videoFrame.getPixelFormat() != mPixelFormat || videoFrame.getWidth() != mFrameSize.x || videoFrame.getHeight() != mFrameSize.y ) {
+		mFrameSize = ivec2( videoFrame.getWidth(), videoFrame.getHeight() );
+		mPixelFormat = videoFrame.getPixelFormat();
+
+		mYPlane.reset();
+		mUPlane.reset();
+		mVPlane.reset();
+		mAPlane.reset();
+		mRGBAPlane.reset();
+
+		if( isPacked ) {
+			const auto fmt = gl::Texture2d::Format().internalFormat( GL_RGBA );
+
+			mRGBAPlane = gl::Texture2d::create( videoFrame.getRGBALineSize() / 4, mFrameSize.y, fmt );
 		}
+		else {
+			const auto fmt = gl::Texture2d::Format().internalFormat( GL_RED ).swizzleMask( GL_RED, GL_RED, GL_RED, GL_ONE );
 
-		// upload texture data
-		if( mYPlane ) {
-			gl::ScopedTextureBind scpTex0( mYPlane, 0 );
-			glTexSubImage2D( mYPlane->getTarget(), 0, 0, 0, mYPlane->getWidth(), mYPlane->getHeight(), mYPlane->getInternalFormat(), GL_UNSIGNED_BYTE, videoFrame.getYPlane() );
+			mYPlane = gl::Texture2d::create( videoFrame.getYLineSize(), videoFrame.getPlane( 0 ).height, fmt );
+			mUPlane = gl::Texture2d::create( videoFrame.getULineSize(), videoFrame.getPlane( 1 ).height, fmt );
+			mVPlane = gl::Texture2d::create( videoFrame.getVLineSize(), videoFrame.getPlane( 2 ).height, fmt );
+
+			if( hasAlphaPlane )
+				mAPlane = gl::Texture2d::create( videoFrame.getALineSize(), videoFrame.getPlane( 3 ).height, fmt );
 		}
 
-		if( mUPlane ) {
-			gl::ScopedTextureBind scpTex0( mUPlane, 0 );
-			glTexSubImage2D( mUPlane->getTarget(), 0, 0, 0, mUPlane->getWidth(), mUPlane->getHeight(), mUPlane->getInternalFormat(), GL_UNSIGNED_BYTE, videoFrame.getUPlane() );
+		{
+			const auto tfmt = gl::Texture2d::Format() /*.target( GL_TEXTURE_RECTANGLE_ARB )*/; // .internalFormat( GL_RGB );
+			const auto fmt = gl::Fbo::Format().colorTexture( tfmt );
+
+			mFbo = gl::Fbo::create( mFrameSize.x, mFrameSize.y, fmt );
 		}
+	}
+
+	// upload texture data
+	if( mRGBAPlane ) {
+		gl::ScopedTextureBind scpTex0( mRGBAPlane, 0 );
+		glTexSubImage2D( mRGBAPlane->getTarget(), 0, 0, 0, mRGBAPlane->getWidth(), mRGBAPlane->getHeight(), GL_RGBA, GL_UNSIGNED_BYTE, videoFrame.getRGBAPlane() );
+	}
 
-		if( mVPlane ) {
-			gl::ScopedTextureBind scpTex0( mVPlane, 0 );
-			glTexSubImage2D( mVPlane->getTarget(), 0, 0, 0, mVPlane->getWidth(), mVPlane->getHeight(), mVPlane->getInternalFormat(), GL_UNSIGNED_BYTE, videoFrame.getVPlane() );
+	if( mYPlane ) {
+		gl::ScopedTextureBind scpTex0( mYPlane, 0 );
+		glTexSubImage2D( mYPlane->getTarget(), 0, 0, 0, mYPlane->getWidth(), mYPlane->getHeight(), mYPlane->getInternalFormat(), GL_UNSIGNED_BYTE, videoFrame.getYPlane() );
+	}
+
+	if( mUPlane ) {
+		gl::ScopedTextureBind scpTex0( mUPlane, 0 );
+		glTexSubImage2D( mUPlane->getTarget(), 0, 0, 0, mUPlane->getWidth(), mUPlane->getHeight(), mUPlane->getInternalFormat(), GL_UNSIGNED_BYTE, videoFrame.getUPlane() );
+	}
+
+	if( mVPlane ) {
+		gl::ScopedTextureBind scpTex0( mVPlane, 0 );
+		glTexSubImage2D( mVPlane->getTarget(), 0, 0, 0, mVPlane->getWidth(), mVPlane->getHeight(), mVPlane->getInternalFormat(), GL_UNSIGNED_BYTE, videoFrame.getVPlane() );
+	}
+
+	if( mAPlane ) {
+		gl::ScopedTextureBind scpTex0( mAPlane, 0 );
+		glTexSubImage2D( mAPlane->getTarget(), 0, 0, 0, mAPlane->getWidth(), mAPlane->getHeight(), mAPlane->getInternalFormat(), GL_UNSIGNED_BYTE, videoFrame.getAPlane() );
+	}
+
+	// render to FBO
+	{
+		gl::ScopedFramebuffer scpFbo( mFbo );
+
+		// set viewport and matrices
+		gl::ScopedViewport scpViewport( mFrameSize );
+		gl::ScopedMatrices scpMatrices;
+		gl::setMatricesWindow( mFrameSize, false );
+
+		// bind and initialize shader
+		const auto &shader = isPacked ? mRgbaShader : mShader;
+		gl::ScopedGlslProg scpGlsl( shader );
+		shader->uniform( "texUnit1", 0 );
+		shader->uniform( "brightness", 0.0f );
+		shader->uniform( "gamma", vec3( 1.0f ) );
+		shader->uniform( "contrast", 1.0f );
+
+		gl::clear();
+
+		// render video
+		const auto &lumaPlane = isPacked ? mRGBAPlane : mYPlane;
+		const vec2 upperLeftTexCoord = vec2(0.f, 1.f);
+		const vec2 lowerRightTexCoord = vec2( 1.f * float(mFrameSize.x) / float(lumaPlane->getWidth()), 0.f );  // ignore Y,U,V padding
+
+		if( isPacked ) {
+			gl::ScopedTextureBind scpTex0( mRGBAPlane, 0 );
+			gl::drawSolidRect( mFbo->getBounds(), upperLeftTexCoord, lowerRightTexCoord);
 		}
+		else {
+			shader->uniform( "texUnit2", 1 );
+			shader->uniform( "texUnit3", 2 );
+			shader->uniform( "texUnit4", 3 );
+			shader->uniform( "hasAlpha", hasAlphaPlane );
 
-		// render to FBO
-		{
-			gl::ScopedFramebuffer scpFbo( mFbo );
-
-			// set viewport and matrices
-			gl::ScopedViewport scpViewport( getSize() );
-			gl::ScopedMatrices scpMatrices;
-			gl::setMatricesWindow( getSize(), false );
-
-			// bind and initialize shader
-			gl::ScopedGlslProg scpGlsl( mShader );
-			mShader->uniform( "texUnit1", 0 );
-			mShader->uniform( "texUnit2", 1 );
-			mShader->uniform( "texUnit3", 2 );
-			mShader->uniform( "brightness", 0.0f );
-			mShader->uniform( "gamma", vec3( 1.0f ) );
-			mShader->uniform( "contrast", 1.0f );
-
-			// render video
 			gl::ScopedTextureBind scpTex0( mYPlane, 0 );
 			gl::ScopedTextureBind scpTex1( mUPlane, 1 );
 			gl::ScopedTextureBind scpTex2( mVPlane, 2 );
-			gl::clear();
-
-			const vec2 upperLeftTexCoord = vec2(0.f, 1.f);
-			const vec2 lowerRightTexCoord = vec2( 1.f * float(getWidth()) / float(mYPlane->getWidth()), 0.f );  // ignore Y,U,V padding
+			gl::ScopedTextureBind scpTex3( hasAlphaPlane ? mAPlane : mYPlane, 3 );
 			gl::drawSolidRect( mFbo->getBounds(), upperLeftTexCoord, lowerRightTexCoord);
 		}
-
-		mTexture = mFbo->getColorTexture();
 	}
+
+	mTexture = mFbo->getColorTexture();
 }
 
 const gl::Texture2dRef &MovieGl::getTexture() const
@@ -169,64 +542,123 @@ const gl::Texture2dRef &MovieGl::getTexture() const
 
 bool MovieGl::checkNewFrame() const
 {
-	if( !mAudioRenderer )
+	if( !mAudioFeeder )
 		return false;
 
-	if( !mMovieDecoder->isInitialized() )
+	if( !mMovieDecoder || !mMovieDecoder->isInitialized() )
 		return false;
 
 	//
-	return ( mMovieDecoder->getVideoClock() < mAudioRenderer->getCurrentPts() );
+	return ( mMovieDecoder->getVideoClock() < mAudioFeeder->getClock() );
+}
+
+bool MovieGl::hasAlpha() const
+{
+	if( !mMovieDecoder )
+		return false;
+
+	return mMovieDecoder->hasAlpha();
 }
 
 float MovieGl::getCurrentTime() const
 {
+	if( !mMovieDecoder )
+		return 0.0f;
+
 	return static_cast<float>( mMovieDecoder->getVideoClock() );
 }
 
 float MovieGl::getFramerate() const
 {
+	if( !mMovieDecoder )
+		return 0.0f;
+
 	return static_cast<float>( mMovieDecoder->getFramesPerSecond() );
 }
 
 uint64_t MovieGl::getNumFrames() const
 {
+	if( !mMovieDecoder )
+		return 0;
+
 	return mMovieDecoder->getNumberOfFrames();
 }
 
 bool MovieGl::isPlaying() const
 {
+	if( !mMovieDecoder )
+		return false;
+
 	return mMovieDecoder->isPlaying();
 }
 
 bool MovieGl::isDone() const
 {
+	if( !mMovieDecoder )
+		return false;
+
 	return mMovieDecoder->isDone();
 }
 
 void MovieGl::play()
 {
+	if( deferUntilOpen( [this] { play(); } ) )
+		return;
+
 	if( !mMovieDecoder->isInitialized() )
 		return;
 
-	mMovieDecoder->start();
+	const bool wasHibernating = mMovieDecoder->isHibernating();
+	if( wasHibernating ) {
+		wake();
+		if( mMovieDecoder->isHibernating() )
+			return;
+	}
+
+	// a movie that was started before hibernating continues from the hibernate position, start() would rewind it
+	const bool continuePlayback = wasHibernating && mMovieDecoder->isPlaying();
+	if( continuePlayback ) {
+		mMovieDecoder->resume();
+	}
+	else {
+		// the feeder must not decode from the queues while the decoder resets them
+		if( mAudioFeeder ) {
+			mAudioFeeder->suspend();
+		}
+		mMovieDecoder->start();
+
+		if( mAudioFeeder ) {
+			mAudioFeeder->resume();
+		}
+	}
+
+	if( mAudioFeeder ) {
+		mAudioFeeder->play();
+	}
 
 	mWidth = static_cast<int32_t>( mMovieDecoder->getFrameWidth() );
 	mHeight = static_cast<int32_t>( mMovieDecoder->getFrameHeight() );
 	mDuration = mMovieDecoder->getDuration();
 
-	mUpdateTimer.start();
+	// a seek while stopped sets where playback starts
+	mUpdateTimer.start( mMovieDecoder->getVideoClock() );
 }
 
 void MovieGl::stop()
 {
+	if( deferUntilOpen( [this] { stop(); } ) )
+		return;
+
 	if( !mMovieDecoder->isInitialized() )
 		return;
 
+	if( mAudioFeeder ) {
+		mAudioFeeder->suspend();
+	}
 	mMovieDecoder->stop();
-	
-	if( mAudioRenderer ) {
-		mAudioRenderer->stop();
+
+	if( mAudioFeeder ) {
+		mAudioFeeder->resume();
 	}
 
 	mUpdateTimer.stop();
@@ -234,13 +666,16 @@ void MovieGl::stop()
 
 void MovieGl::pause()
 {
+	if( deferUntilOpen( [this] { pause(); } ) )
+		return;
+
 	if( !mMovieDecoder->isInitialized() )
 		return;
 
 	mMovieDecoder->pause();
 
-	if( mAudioRenderer ) {
-		mAudioRenderer->pause();
+	if( mAudioFeeder ) {
+		mAudioFeeder->pause();
 	}
 
 	mUpdateTimer.stop();
@@ -248,31 +683,106 @@ void MovieGl::pause()
 
 void MovieGl::resume()
 {
+	if( deferUntilOpen( [this] { resume(); } ) )
+		return;
+
 	if( !mMovieDecoder->isInitialized() )
 		return;
 
+	if( mMovieDecoder->isHibernating() ) {
+		wake();
+		if( mMovieDecoder->isHibernating() )
+			return;
+	}
+
 	mMovieDecoder->resume();
 
-	if( mAudioRenderer ) {
-		mAudioRenderer->play();
+	if( mAudioFeeder ) {
+		mAudioFeeder->play();
 	}
 
 	mUpdateTimer.start( mMovieDecoder->getVideoClock() );
 }
 
+void MovieGl::hibernate()
+{
+	if( deferUntilOpen( [this] { hibernate(); } ) )
+		return;
+
+	if( !mMovieDecoder->isInitialized() || mMovieDecoder->isHibernating() )
+		return;
+
+	mAudioFeeder.reset();
+	mMovieDecoder->hibernate();
+	mAudioRenderer.reset();
+	mUpdateTimer.stop();
+
+	// keep mTexture around as the poster frame
+	mYPlane.reset();
+	mUPlane.reset();
+	mVPlane.reset();
+	mAPlane.reset();
+	mRGBAPlane.reset();
+	mFbo.reset();
+}
+
+void MovieGl::wake()
+{
+	if( deferUntilOpen( [this] { wake(); } ) )
+		return;
+
+	if( !mMovieDecoder->isHibernating() )
+		return;
+
+	// stays hibernated, with the poster frame on screen
+	if( !mMovieDecoder->wake() ) {
+		CI_LOG_E( "failed to wake " << mPath );
+		return;
+	}
+
+	if( mPlayAudio && mMovieDecoder->hasAudio() ) {
+		mAudioRenderer = createAudioRenderer();
+		mAudioFeeder = std::unique_ptr<AudioFeeder>( new AudioFeeder( *mMovieDecoder, *mAudioRenderer ) );
+	}
+
+	if( mMovieDecoder->isPlaying() && !mMovieDecoder->isPaused() )
+		mUpdateTimer.start( mMovieDecoder->getVideoClock() );
+}
+
+bool MovieGl::isHibernating() const
+{
+	if( !mMovieDecoder )
+		return false;
+
+	return mMovieDecoder->isHibernating();
+}
+
 void MovieGl::seekToTime( float seconds )
 {
+	if( deferUntilOpen( [this, seconds] { seekToTime( seconds ); } ) )
+		return;
+
 	if( !mMovieDecoder->isInitialized() )
 		return;
 
-	if( mAudioRenderer ) {
-		mAudioRenderer->clearBuffers();
+	if( mMovieDecoder->isHibernating() ) {
+		wake();
+		if( mMovieDecoder->isHibernating() )
+			return;
+	}
+
+	// the feeder must not decode stale packets while the decoder seeks
+	if( mAudioFeeder ) {
+		mAudioFeeder->suspend();
 	}
 	mMovieDecoder->seekToTime( double( seconds ) );
 	mUpdateTimer.start( double( seconds ) );
 
-	if( mAudioRenderer ) {
-		mAudioRenderer->play();
+	// the next frame is not the first one
+	mWritePoster = false;
+
+	if( mAudioFeeder ) {
+		mAudioFeeder->resume();
 	}
 
 	mTexture.reset();
@@ -280,12 +790,189 @@ void MovieGl::seekToTime( float seconds )
 
 void MovieGl::setLoop( bool loop )
 {
+	if( deferUntilOpen( [this, loop] { setLoop( loop ); } ) )
+		return;
+
 	if( !mMovieDecoder->isInitialized() )
 		return;
 
 	mMovieDecoder->loop(loop);
 }
 
+void MovieGl::setLoopCache( bool enabled, size_t maxBytes, bool compress )
+{
+	if( deferUntilOpen( [=] { setLoopCache( enabled, maxBytes, compress ); } ) )
+		return;
+
+	if( !mMovieDecoder->isInitialized() )
+		return;
+
+	mMovieDecoder->setLoopCache( enabled, maxBytes, compress );
+}
+
+void MovieGl::setPacketCache( bool enabled, size_t maxBytes )
+{
+	if( deferUntilOpen( [=] { setPacketCache( enabled, maxBytes ); } ) )
+		return;
+
+	if( !mMovieDecoder->isInitialized() )
+		return;
+
+	mMovieDecoder->setPacketCache( enabled, maxBytes );
+}
+
+void MovieGl::setDeinterlacing( Deinterlacer::Mode mode, bool fieldRate )
+{
+	if( deferUntilOpen( [=] { setDeinterlacing( mode, fieldRate ); } ) )
+		return;
+
+	if( !mMovieDecoder->isInitialized() )
+		return;
+
+	mMovieDecoder->setDeinterlacing( mode, fieldRate );
+}
+
+void MovieGl::setVideoFilter( const std::string &description )
+{
+	if( deferUntilOpen( [=] { setVideoFilter( description ); } ) )
+		return;
+
+	if( !mMovieDecoder->isInitialized() )
+		return;
+
+	mMovieDecoder->setVideoFilter( description );
+}
+
+void MovieGl::setAudioFilter( const std::string &description )
+{
+	if( deferUntilOpen( [=] { setAudioFilter( description ); } ) )
+		return;
+
+	if( !mMovieDecoder->isInitialized() )
+		return;
+
+	mMovieDecoder->setAudioFilter( description );
+}
+
+void MovieGl::setAudioChannels( int numChannels )
+{
+	if( deferUntilOpen( [this, numChannels] { setAudioChannels( numChannels ); } ) )
+		return;
+
+	if( !mMovieDecoder->isInitialized() || !mMovieDecoder->hasAudio() )
+		return;
+
+	// queued audio is in the previous format
+	if( mAudioFeeder ) {
+		mAudioFeeder->suspend();
+	}
+
+	mMovieDecoder->setAudioOutput( mAudioRenderer ? mAudioRenderer->getDeviceSampleRate() : 0, numChannels );
+
+	const auto audioFormat = mMovieDecoder->getAudioFormat();
+	if( mAudioRenderer ) {
+		mAudioRenderer->setFormat( audioFormat );
+	}
+
+	if( mAudioFeeder ) {
+		mAudioFeeder->resume();
+	}
+}
+
+void MovieGl::setAudioResampleQuality( AudioResampler::Quality quality )
+{
+	if( deferUntilOpen( [this, quality] { setAudioResampleQuality( quality ); } ) )
+		return;
+
+	if( !mMovieDecoder->isInitialized() )
+		return;
+
+	mMovieDecoder->setAudioResampleQuality( quality );
+}
+
+void MovieGl::setAudioLatency( AudioRenderer::LatencyMode mode, int milliseconds )
+{
+	// kept for the renderer created on wake()
+	mAudioLatencyMode = mode;
+	mAudioLatency = milliseconds;
+
+	if( mAudioFeeder )
+		mAudioFeeder->setLatency( mode, milliseconds );
+}
+
+void MovieGl::setAdaptiveDecoding( bool enabled )
+{
+	if( deferUntilOpen( [this, enabled] { setAdaptiveDecoding( enabled ); } ) )
+		return;
+
+	if( !mMovieDecoder->isInitialized() )
+		return;
+
+	mMovieDecoder->setAdaptiveDecoding( enabled );
+}
+
+void MovieGl::setTargetSize( const ivec2 &size )
+{
+	if( deferUntilOpen( [this, size] { setTargetSize( size ); } ) )
+		return;
+
+	if( !mMovieDecoder->isInitialized() )
+		return;
+
+	mMovieDecoder->setTargetSize( size.x, size.y );
+}
+
+void MovieGl::setVisible( bool visible )
+{
+	mVisible = visible;
+
+	if( deferUntilOpen( [this, visible] { setVisible( visible ); } ) )
+		return;
+
+	if( mMovieDecoder->isInitialized() )
+		mMovieDecoder->setVisible( visible );
+}
+
+void MovieGl::updateViews()
+{
+	bool  visible = false;
+	bool  fullSize = false;
+	ivec2 size( 0 );
+
+	// hidden views need no resolution at all, a visible view without a target size needs the full one
+	for( const MovieGlView *view : mViews ) {
+		if( !view->isVisible() )
+			continue;
+
+		visible = true;
+
+		const ivec2 target = view->getTargetSize();
+		if( target.x <= 0 || target.y <= 0 )
+			fullSize = true;
+		else
+			size = ivec2( std::max( size.x, target.x ), std::max( size.y, target.y ) );
+	}
+
+	setVisible( visible );
+	setTargetSize( fullSize ? ivec2( 0 ) : size );
+}
+
+void MovieGl::setCatchUpThreshold( float seconds )
+{
+	if( deferUntilOpen( [this, seconds] { setCatchUpThreshold( seconds ); } ) )
+		return;
+
+	mMovieDecoder->setCatchUpThreshold( double( seconds ) );
+}
+
+MovieDecoder::DegradationLevel MovieGl::getDegradationLevel() const
+{
+	if( !mMovieDecoder )
+		return MovieDecoder::DEGRADATION_NONE;
+
+	return mMovieDecoder->getDegradationLevel();
+}
+
 void MovieGl::initializeShader()
 {
 	// compile YUV-decoding shader
@@ -308,7 +995,8 @@ void MovieGl::initializeShader()
 	const char *fs =
 	    R"(#version 150
 
-		uniform sampler2D texUnit1, texUnit2, texUnit3;
+		uniform sampler2D texUnit1, texUnit2, texUnit3, texUnit4;
+		uniform bool  hasAlpha;
 		uniform float brightness;
 		uniform float contrast;
 		uniform vec3  gamma;
@@ -327,19 +1015,71 @@ void MovieGl::initializeShader()
 			fragColor.r = dot(yuv, vec3(1.164,  0.000,  1.596)) - 0.5;
 			fragColor.g = dot(yuv, vec3(1.164, -0.391, -0.813)) - 0.5;
 			fragColor.b = dot(yuv, vec3(1.164,  2.018,  0.000)) - 0.5;
-			fragColor.a = 1.0;
+			fragColor.a = hasAlpha ? texture(texUnit4, vertTexCoord0.st).x : 1.0;
 
 			fragColor.rgb = fragColor.rgb * contrast + vec3(0.5);
 			fragColor.rgb = pow(fragColor.rgb, gamma);
 		})";
 
+	// packed RGBA frames only need the color adjustments
+	const char *fsRgba =
+	    R"(#version 150
+
+		uniform sampler2D texUnit1;
+		uniform float brightness;
+		uniform float contrast;
+		uniform vec3  gamma;
+
+		in vec2 vertTexCoord0;
+
+		out vec4 fragColor;
+
+		void main(void)
+		{
+			fragColor = texture(texUnit1, vertTexCoord0.st);
+
+			fragColor.rgb = (fragColor.rgb + vec3(brightness) - vec3(0.5)) * contrast + vec3(0.5);
+			fragColor.rgb = pow(fragColor.rgb, gamma);
+		})";
+
 	try {
 		mShader = gl::GlslProg::create( vs, fs );
+		mRgbaShader = gl::GlslProg::create( vs, fsRgba );
 	}
 	catch( const std::exception &e ) {
 		app::console() << e.what() << std::endl;
 	}
 }
 
+MovieGlView::MovieGlView( const MovieGlRef &movie )
+    : mMovie( movie )
+    , mTargetSize( 0 )
+    , mVisible( true )
+{
+	mMovie->mViews.push_back( this );
+	mMovie->updateViews();
+}
+
+MovieGlView::~MovieGlView()
+{
+	auto &views = mMovie->mViews;
+	views.erase( std::remove( views.begin(), views.end(), this ), views.end() );
+
+	if( !views.empty() )
+		mMovie->updateViews();
+}
+
+void MovieGlView::setTargetSize( const ivec2 &size )
+{
+	mTargetSize = size;
+	mMovie->updateViews();
+}
+
+void MovieGlView::setVisible( bool visible )
+{
+	mVisible = visible;
+	mMovie->updateViews();
+}
+
 } // namespace ffmpeg
 } // namespace ph
@@ -0,0 +1,494 @@
+#include "audiorenderer/alsarenderer.h"
+
+#if defined( __linux__ )
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "audiorenderer/audioformat.h"
+#include "audiorenderer/audioframe.h"
+#include "common/numericoperations.h"
+#include "common/sampleconversion.h"
+
+using namespace std;
+
+// duration of a period and the default latency target per mode, in milliseconds
+#define LOW_LATENCY_PERIOD 5
+#define LOW_LATENCY_TARGET 20
+#define NORMAL_PERIOD 20
+#define NORMAL_TARGET 100
+#define POWER_SAVING_PERIOD 100
+#define POWER_SAVING_TARGET 1000
+
+string AlsaRenderer::mDeviceName = "default";
+
+void AlsaRenderer::setDeviceName( const string &name )
+{
+	mDeviceName = name;
+}
+
+AlsaRenderer::AlsaRenderer()
+    : AudioRenderer()
+    , mPcm( NULL )
+    , mCanPause( false )
+    , mPaused( false )
+    , mVolume( 1.f )
+    , mPcmFormat( SND_PCM_FORMAT_S16_LE )
+    , mConvertToS16( false )
+    , mNumChannels( 0 )
+    , mFrequency( 0 )
+    , mSourceBytesPerFrame( 0 )
+    , mDeviceBytesPerFrame( 0 )
+    , mLatencyMode( LATENCY_NORMAL )
+    , mLatency( NORMAL_TARGET )
+    , mPeriodSize( 0 )
+    , mBufferSize( 0 )
+    , mFramesWritten( 0 )
+    , mPendingSize( 0 )
+    , mPendingPts( 0 )
+{
+	// non-blocking, the feeding thread must never wait for the device
+	const int error = snd_pcm_open( &mPcm, mDeviceName.c_str(), SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK );
+	if( error < 0 ) {
+		mPcm = NULL;
+		throw logic_error( string( "AlsaRenderer: failed to open " ) + mDeviceName + ": " + snd_strerror( error ) );
+	}
+}
+
+AlsaRenderer::~AlsaRenderer()
+{
+	if( mPcm ) {
+		snd_pcm_drop( mPcm );
+		snd_pcm_close( mPcm );
+	}
+}
+
+void AlsaRenderer::setFormat( const AudioFormat &format )
+{
+	if( format.isFloat )
+		mPcmFormat = SND_PCM_FORMAT_FLOAT_LE;
+	else if( format.bits == 8 )
+		mPcmFormat = SND_PCM_FORMAT_U8;
+	else if( format.bits == 16 )
+		mPcmFormat = SND_PCM_FORMAT_S16_LE;
+	else
+		throw logic_error( "AlsaRenderer: unsupported format" );
+
+	mNumChannels = format.numChannels;
+	mFrequency = format.rate;
+	mSourceBytesPerFrame = format.numChannels * format.bits / 8;
+
+	configure();
+}
+
+void AlsaRenderer::setLatency( LatencyMode mode, int milliseconds )
+{
+	mLatencyMode = mode;
+
+	if( milliseconds <= 0 ) {
+		switch( mode ) {
+		case LATENCY_LOW:
+			milliseconds = LOW_LATENCY_TARGET;
+			break;
+		case LATENCY_POWER_SAVING:
+			milliseconds = POWER_SAVING_TARGET;
+			break;
+		default:
+			milliseconds = NORMAL_TARGET;
+			break;
+		}
+	}
+	mLatency = milliseconds;
+
+	// the device buffer is the latency, so changing it means starting over
+	if( mFrequency > 0 )
+		configure();
+}
+
+void AlsaRenderer::configure()
+{
+	snd_pcm_drop( mPcm );
+
+	snd_pcm_hw_params_t *hwParams;
+	snd_pcm_hw_params_alloca( &hwParams );
+	snd_pcm_hw_params_any( mPcm, hwParams );
+
+	if( snd_pcm_hw_params_set_access( mPcm, hwParams, SND_PCM_ACCESS_MMAP_INTERLEAVED ) < 0 )
+		throw logic_error( "AlsaRenderer: the device does not support mmap access" );
+
+	// float samples the device cannot take are converted to 16 bits
+	mConvertToS16 = false;
+	if( snd_pcm_hw_params_set_format( mPcm, hwParams, mPcmFormat ) < 0 ) {
+		if( mPcmFormat != SND_PCM_FORMAT_FLOAT_LE || snd_pcm_hw_params_set_format( mPcm, hwParams, SND_PCM_FORMAT_S16_LE ) < 0 )
+			throw logic_error( "AlsaRenderer: unsupported format" );
+
+		mConvertToS16 = true;
+	}
+	mDeviceBytesPerFrame = mConvertToS16 ? mNumChannels * sizeof( int16_t ) : mSourceBytesPerFrame;
+
+	if( snd_pcm_hw_params_set_channels( mPcm, hwParams, mNumChannels ) < 0 )
+		throw logic_error( "AlsaRenderer: unsupported channel count" );
+
+	snd_pcm_hw_params_set_rate_resample( mPcm, hwParams, 1 );
+	if( snd_pcm_hw_params_set_rate( mPcm, hwParams, mFrequency, 0 ) < 0 )
+		throw logic_error( "AlsaRenderer: unsupported sample rate" );
+
+	unsigned int periodDuration;
+	switch( mLatencyMode ) {
+	case LATENCY_LOW:
+		periodDuration = LOW_LATENCY_PERIOD;
+		break;
+	case LATENCY_POWER_SAVING:
+		periodDuration = POWER_SAVING_PERIOD;
+		break;
+	default:
+		periodDuration = NORMAL_PERIOD;
+		break;
+	}
+
+	// at least two periods, so that one can be refilled while the other plays
+	unsigned int periodTime = periodDuration * 1000;
+	unsigned int bufferTime = std::max( unsigned( mLatency ), 2 * periodDuration ) * 1000;
+	int          direction = 0;
+	snd_pcm_hw_params_set_period_time_near( mPcm, hwParams, &periodTime, &direction );
+	snd_pcm_hw_params_set_buffer_time_near( mPcm, hwParams, &bufferTime, &direction );
+
+	const int error = snd_pcm_hw_params( mPcm, hwParams );
+	if( error < 0 )
+		throw logic_error( string( "AlsaRenderer: failed to configure the device: " ) + snd_strerror( error ) );
+
+	snd_pcm_hw_params_get_period_size( hwParams, &mPeriodSize, &direction );
+	snd_pcm_hw_params_get_buffer_size( hwParams, &mBufferSize );
+	mCanPause = snd_pcm_hw_params_can_pause( hwParams ) != 0;
+	mHistory.assign( mCanPause ? 0 : mBufferSize * mSourceBytesPerFrame, 0 );
+
+	// started explicitly once the buffer is full, and woken up per period
+	snd_pcm_sw_params_t *swParams;
+	snd_pcm_sw_params_alloca( &swParams );
+	snd_pcm_sw_params_current( mPcm, swParams );
+	snd_pcm_sw_params_set_start_threshold( mPcm, swParams, mBufferSize );
+	snd_pcm_sw_params_set_avail_min( mPcm, swParams, mPeriodSize );
+	snd_pcm_sw_params( mPcm, swParams );
+
+	snd_pcm_prepare( mPcm );
+
+	mFramesWritten = 0;
+	mPtsQueue.clear();
+	mPendingSize = 0;
+}
+
+bool AlsaRenderer::recover( int error )
+{
+	// underruns and suspends leave the device prepared, written samples that were not played are gone
+	if( snd_pcm_recover( mPcm, error, 1 ) < 0 )
+		return false;
+
+	return true;
+}
+
+snd_pcm_sframes_t AlsaRenderer::getAvailable()
+{
+	snd_pcm_sframes_t available = snd_pcm_avail_update( mPcm );
+	if( available < 0 ) {
+		if( !recover( int( available ) ) )
+			return 0;
+
+		available = snd_pcm_avail_update( mPcm );
+	}
+
+	return std::max<snd_pcm_sframes_t>( available, 0 );
+}
+
+bool AlsaRenderer::hasQueuedFrames()
+{
+	return mPendingSize > 0 || snd_pcm_uframes_t( getAvailable() ) < mBufferSize;
+}
+
+bool AlsaRenderer::hasBufferSpace()
+{
+	if( mSourceBytesPerFrame == 0 )
+		return false;
+
+	return mPendingSize == 0 && getAvailable() > 0;
+}
+
+void AlsaRenderer::queueFrame( const AudioFrame &frame )
+{
+	assert( frame.getFrameData() );
+
+	writePending();
+
+	const uint8_t *data = frame.getFrameData();
+	const size_t   size = frame.getDataSize();
+	const size_t   written = mPendingSize == 0 ? write( data, size, frame.getPts() ) : 0;
+
+	// keep what did not fit for the next call, only grows so that steady state does not allocate
+	if( written < size ) {
+		const size_t remaining = size - written;
+		if( mPending.size() < mPendingSize + remaining )
+			mPending.resize( mPendingSize + remaining );
+
+		if( mPendingSize == 0 )
+			mPendingPts = frame.getPts() + double( written / mSourceBytesPerFrame ) / mFrequency;
+
+		memcpy( mPending.data() + mPendingSize, data + written, remaining );
+		mPendingSize += remaining;
+	}
+}
+
+void AlsaRenderer::writePending()
+{
+	if( mPendingSize == 0 )
+		return;
+
+	const size_t written = write( mPending.data(), mPendingSize, mPendingPts );
+
+	mPendingSize -= written;
+	mPendingPts += double( written / mSourceBytesPerFrame ) / mFrequency;
+	memmove( mPending.data(), mPending.data() + written, mPendingSize );
+}
+
+size_t AlsaRenderer::write( const uint8_t *data, size_t size, double pts )
+{
+	const snd_pcm_uframes_t numFrames = size / mSourceBytesPerFrame;
+
+	snd_pcm_uframes_t done = 0;
+	snd_pcm_sframes_t available = getAvailable();
+
+	while( done < numFrames && available > 0 ) {
+		const snd_pcm_channel_area_t *areas;
+		snd_pcm_uframes_t             offset;
+		snd_pcm_uframes_t             frames = std::min( numFrames - done, snd_pcm_uframes_t( available ) );
+
+		int error = snd_pcm_mmap_begin( mPcm, &areas, &offset, &frames );
+		if( error < 0 ) {
+			if( !recover( error ) )
+				break;
+
+			available = getAvailable();
+			continue;
+		}
+
+		if( frames == 0 )
+			break;
+
+		// interleaved, so the first area covers all channels
+		uint8_t *      dst = static_cast<uint8_t *>( areas[0].addr ) + ( areas[0].first + offset * areas[0].step ) / 8;
+		const uint8_t *src = data + done * mSourceBytesPerFrame;
+		const size_t   numSamples = frames * mNumChannels;
+
+		if( mConvertToS16 )
+			SampleConversion::floatToS16( reinterpret_cast<const float *>( src ), reinterpret_cast<int16_t *>( dst ), numSamples );
+		else
+			memcpy( dst, src, frames * mDeviceBytesPerFrame );
+
+		// ALSA has no gain of its own
+		if( mVolume < 1.f )
+			applyVolume( dst, numSamples );
+
+		const snd_pcm_sframes_t committed = snd_pcm_mmap_commit( mPcm, offset, frames );
+		if( committed < 0 ) {
+			if( !recover( int( committed ) ) )
+				break;
+
+			available = getAvailable();
+			continue;
+		}
+
+		if( committed > 0 ) {
+			PtsMarker marker;
+			marker.position = mFramesWritten;
+			marker.pts = pts + double( done ) / mFrequency;
+			mPtsQueue.push_back( marker );
+
+			if( !mHistory.empty() )
+				remember( src, snd_pcm_uframes_t( committed ) );
+
+			mFramesWritten += committed;
+			done += committed;
+			available -= committed;
+		}
+
+		// a short commit counts what made it, the rest is written again once the device has recovered
+		if( snd_pcm_uframes_t( committed ) != frames ) {
+			const snd_pcm_state_t state = snd_pcm_state( mPcm );
+			if( state == SND_PCM_STATE_XRUN ) {
+				if( !recover( -EPIPE ) )
+					break;
+			}
+			else if( state == SND_PCM_STATE_SUSPENDED ) {
+				if( !recover( -ESTRPIPE ) )
+					break;
+			}
+			else if( committed == 0 ) {
+				break;
+			}
+
+			available = getAvailable();
+		}
+	}
+
+	return done * mSourceBytesPerFrame;
+}
+
+void AlsaRenderer::remember( const uint8_t *data, snd_pcm_uframes_t numFrames )
+{
+	snd_pcm_uframes_t position = snd_pcm_uframes_t( mFramesWritten % int64_t( mBufferSize ) );
+	while( numFrames > 0 ) {
+		const snd_pcm_uframes_t count = std::min( numFrames, mBufferSize - position );
+		memcpy( mHistory.data() + position * mSourceBytesPerFrame, data, count * mSourceBytesPerFrame );
+
+		data += count * mSourceBytesPerFrame;
+		numFrames -= count;
+		position = 0;
+	}
+}
+
+void AlsaRenderer::requeueUnplayed( snd_pcm_sframes_t delay, double pts )
+{
+	const snd_pcm_uframes_t numFrames = snd_pcm_uframes_t( std::min<int64_t>( delay, std::min<int64_t>( mFramesWritten, mBufferSize ) ) );
+	if( numFrames == 0 || mHistory.empty() )
+		return;
+
+	const size_t size = numFrames * mSourceBytesPerFrame;
+	if( mPending.size() < mPendingSize + size )
+		mPending.resize( mPendingSize + size );
+
+	memmove( mPending.data() + size, mPending.data(), mPendingSize );
+	mPendingSize += size;
+	mPendingPts = pts;
+
+	uint8_t *         dst = mPending.data();
+	snd_pcm_uframes_t remaining = numFrames;
+	snd_pcm_uframes_t position = snd_pcm_uframes_t( ( mFramesWritten - int64_t( numFrames ) ) % int64_t( mBufferSize ) );
+	while( remaining > 0 ) {
+		const snd_pcm_uframes_t count = std::min( remaining, mBufferSize - position );
+		memcpy( dst, mHistory.data() + position * mSourceBytesPerFrame, count * mSourceBytesPerFrame );
+
+		dst += count * mSourceBytesPerFrame;
+		remaining -= count;
+		position = 0;
+	}
+}
+
+void AlsaRenderer::applyVolume( uint8_t *samples, size_t numSamples )
+{
+	if( mConvertToS16 || mPcmFormat == SND_PCM_FORMAT_S16_LE ) {
+		int16_t *data = reinterpret_cast<int16_t *>( samples );
+		for( size_t i = 0; i < numSamples; ++i )
+			data[i] = int16_t( data[i] * mVolume );
+	}
+	else if( mPcmFormat == SND_PCM_FORMAT_FLOAT_LE ) {
+		float *data = reinterpret_cast<float *>( samples );
+		for( size_t i = 0; i < numSamples; ++i )
+			data[i] *= mVolume;
+	}
+	else {
+		for( size_t i = 0; i < numSamples; ++i )
+			samples[i] = uint8_t( 128 + ( int( samples[i] ) - 128 ) * mVolume );
+	}
+}
+
+void AlsaRenderer::clearBuffers()
+{
+	stop();
+	mPendingSize = 0;
+}
+
+void AlsaRenderer::flushBuffers()
+{
+	writePending();
+	start();
+}
+
+double AlsaRenderer::getCurrentPts()
+{
+	if( mPtsQueue.empty() )
+		return 0;
+
+	// the sample being heard is the one written snd_pcm_delay() frames ago
+	snd_pcm_sframes_t delay = 0;
+	if( snd_pcm_delay( mPcm, &delay ) < 0 )
+		delay = 0;
+
+	delay = std::min<snd_pcm_sframes_t>( std::max<snd_pcm_sframes_t>( delay, 0 ), mFramesWritten );
+	return getPtsAt( mFramesWritten - delay );
+}
+
+double AlsaRenderer::getPtsAt( int64_t position )
+{
+	if( mPtsQueue.empty() )
+		return 0;
+
+	while( mPtsQueue.size() > 1 && mPtsQueue[1].position <= position )
+		mPtsQueue.pop_front();
+
+	const PtsMarker &marker = mPtsQueue.front();
+	return marker.pts + double( std::max<int64_t>( position - marker.position, 0 ) ) / mFrequency;
+}
+
+void AlsaRenderer::play()
+{
+	mPaused = false;
+
+	if( snd_pcm_state( mPcm ) == SND_PCM_STATE_PAUSED )
+		snd_pcm_pause( mPcm, 0 );
+	else
+		start();
+}
+
+void AlsaRenderer::start()
+{
+	// the start threshold is the whole buffer, a short stream or a slow decoder is started here
+	if( !mPaused && snd_pcm_state( mPcm ) == SND_PCM_STATE_PREPARED && snd_pcm_uframes_t( getAvailable() ) < mBufferSize )
+		snd_pcm_start( mPcm );
+}
+
+void AlsaRenderer::pause()
+{
+	mPaused = true;
+
+	if( snd_pcm_state( mPcm ) != SND_PCM_STATE_RUNNING )
+		return;
+
+	if( mCanPause ) {
+		snd_pcm_pause( mPcm, 1 );
+		return;
+	}
+
+	// without hardware pause the device is reset, and what it has not played yet is written again on resume
+	snd_pcm_sframes_t delay = 0;
+	if( snd_pcm_delay( mPcm, &delay ) < 0 )
+		delay = 0;
+
+	delay = std::min<snd_pcm_sframes_t>( std::max<snd_pcm_sframes_t>( delay, 0 ), mFramesWritten );
+	const double pts = getPtsAt( mFramesWritten - delay );
+
+	requeueUnplayed( delay, pts );
+	stop();
+
+	// the clock holds at the paused sample until it is written again
+	PtsMarker marker;
+	marker.position = 0;
+	marker.pts = pts;
+	mPtsQueue.push_back( marker );
+}
+
+void AlsaRenderer::stop()
+{
+	snd_pcm_drop( mPcm );
+	snd_pcm_prepare( mPcm );
+
+	mFramesWritten = 0;
+	mPtsQueue.clear();
+}
+
+void AlsaRenderer::adjustVolume( float offset )
+{
+	mVolume += offset;
+	NumericOperations::clip( mVolume, 0.f, 1.f );
+}
+
+#endif
@@ -1,24 +1,54 @@
 #include "audiorenderer/audioframe.h"
+#include "audiorenderer/audioframepool.h"
 
-#include <memory>
-
-#define USE_MEMCPY 1
+#include <cstring>
 
 AudioFrame::AudioFrame()
 : mFrameData(nullptr)
 , mDataSize(0)
+, mCapacity(0)
+, mPooled(false)
 , mPts(0.0)
 {
 }
 
-AudioFrame::~AudioFrame()
+AudioFrame::AudioFrame(AudioFrame&& other)
+: mFrameData(other.mFrameData)
+, mDataSize(other.mDataSize)
+, mCapacity(other.mCapacity)
+, mPooled(other.mPooled)
+, mPts(other.mPts)
 {
-#if USE_MEMCPY
-	if(mFrameData)
-		delete[] mFrameData;
-#endif
+	other.mFrameData = nullptr;
+	other.mDataSize = 0;
+	other.mCapacity = 0;
+	other.mPooled = false;
+}
 
-	mFrameData = nullptr;
+AudioFrame& AudioFrame::operator=(AudioFrame&& other)
+{
+	if(this != &other)
+	{
+		releaseBuffer();
+
+		mFrameData = other.mFrameData;
+		mDataSize = other.mDataSize;
+		mCapacity = other.mCapacity;
+		mPooled = other.mPooled;
+		mPts = other.mPts;
+
+		other.mFrameData = nullptr;
+		other.mDataSize = 0;
+		other.mCapacity = 0;
+		other.mPooled = false;
+	}
+
+	return *this;
+}
+
+AudioFrame::~AudioFrame()
+{
+	releaseBuffer();
 }
 
 byte* AudioFrame::getFrameData() const
@@ -36,31 +66,53 @@ double AudioFrame::getPts() const
     return mPts;
 }
 
-void AudioFrame::setFrameData(byte* data)
+void AudioFrame::setFrameData(const byte* data)
 {
-#if USE_MEMCPY
-	if(!mFrameData)
-		mFrameData = new byte[mDataSize];
-
-	memcpy(mFrameData, data, mDataSize);
-#else
-	m_FrameData = data;
-#endif
+	if(mFrameData)
+		memcpy(mFrameData, data, mDataSize);
 }
 
 void AudioFrame::setDataSize(uint32 size)
 {
-#if USE_MEMCPY
-	if(size > mDataSize && mFrameData)
+	mDataSize = size;
+
+	// a frame reused for every packet keeps its buffer
+	if(size <= mCapacity)
+		return;
+
+	releaseBuffer();
+
+	if(size <= AudioFramePool::BUFFER_SIZE)
+	{
+		mFrameData = AudioFramePool::instance().acquire();
+		mPooled = mFrameData != nullptr;
+		mCapacity = mPooled ? AudioFramePool::BUFFER_SIZE : 0;
+	}
+
+	// oversized frames, or an exhausted pool
+	if(!mFrameData)
 	{
-		delete[] mFrameData;
-		mFrameData = nullptr;
+		mFrameData = new byte[size];
+		mCapacity = size;
 	}
-#endif
-    mDataSize = size;
 }
 
 void AudioFrame::setPts(double pts)
 {
     mPts = pts;
 }
+
+void AudioFrame::releaseBuffer()
+{
+	if(mFrameData)
+	{
+		if(mPooled)
+			AudioFramePool::instance().release(mFrameData);
+		else
+			delete[] mFrameData;
+	}
+
+	mFrameData = nullptr;
+	mCapacity = 0;
+	mPooled = false;
+}
@@ -0,0 +1,35 @@
+#include "audiorenderer/audioframepool.h"
+
+AudioFramePool &AudioFramePool::instance()
+{
+	static AudioFramePool pool;
+	return pool;
+}
+
+AudioFramePool::AudioFramePool()
+    : mStorage( size_t( NUM_BUFFERS ) * BUFFER_SIZE )
+{
+	mFreeBuffers.reserve( NUM_BUFFERS );
+	for( int i = NUM_BUFFERS - 1; i >= 0; --i )
+		mFreeBuffers.push_back( mStorage.data() + size_t( i ) * BUFFER_SIZE );
+}
+
+byte *AudioFramePool::acquire()
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+
+	if( mFreeBuffers.empty() )
+		return nullptr;
+
+	byte *buffer = mFreeBuffers.back();
+	mFreeBuffers.pop_back();
+	return buffer;
+}
+
+void AudioFramePool::release( byte *buffer )
+{
+	std::lock_guard<std::mutex> lock( mMutex );
+
+	// never reallocates, the capacity covers every buffer
+	mFreeBuffers.push_back( buffer );
+}
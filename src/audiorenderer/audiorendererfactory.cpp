@@ -1,5 +1,8 @@
+#include "audiorenderer/alsarenderer.h"
 #include "audiorenderer/audiorendererfactory.h"
+#include "audiorenderer/nullrenderer.h"
 #include "audiorenderer/openalrenderer.h"
+#include "audiorenderer/openalsoftrenderer.h"
 
 #include <stdexcept>
 
@@ -9,6 +12,17 @@ AudioRenderer *AudioRendererFactory::create( AudioOutputType type )
 	case OPENAL_OUTPUT:
 		return new OpenAlRenderer();
 		break;
+#if defined( __linux__ )
+	case ALSA_OUTPUT:
+		return new AlsaRenderer();
+		break;
+#endif
+	case OPENAL_SOFT_OUTPUT:
+		return new OpenAlSoftRenderer();
+		break;
+	case NULL_OUTPUT:
+		return new NullRenderer();
+		break;
 	default:
 		throw std::logic_error( "AudioRendererFactory: Unsupported audio output type provided" );
 	}
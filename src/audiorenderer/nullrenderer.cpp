@@ -0,0 +1,172 @@
+#include "audiorenderer/nullrenderer.h"
+#include "audiorenderer/audioformat.h"
+#include "audiorenderer/audioframe.h"
+#include "common/numericoperations.h"
+
+using namespace std;
+
+// default latency target per mode, in milliseconds, as for OpenAlRenderer
+#define LOW_LATENCY_TARGET 40
+#define NORMAL_TARGET 200
+#define POWER_SAVING_TARGET 2000
+
+double NullRenderer::mDefaultSpeed = 1.0;
+
+void NullRenderer::setDefaultSpeed( double speed )
+{
+	mDefaultSpeed = speed;
+}
+
+NullRenderer::NullRenderer()
+    : AudioRenderer()
+    , mSpeed( mDefaultSpeed )
+    , mPlaying( false )
+    , mVolume( 1.f )
+    , mBytesPerSecond( 0 )
+    , mLatency( NORMAL_TARGET / 1000.0 )
+    , mLastUpdate( Clock::now() )
+    , mQueuedDuration( 0 )
+    , mOffset( 0 )
+    , mLastPts( 0 )
+{
+}
+
+NullRenderer::~NullRenderer()
+{
+}
+
+void NullRenderer::setSpeed( double speed )
+{
+	// time passed so far counts at the previous speed
+	advance();
+	mSpeed = speed;
+}
+
+void NullRenderer::setFormat( const AudioFormat &format )
+{
+	mBytesPerSecond = int( format.rate * format.numChannels * format.bits / 8 );
+}
+
+void NullRenderer::setLatency( LatencyMode mode, int milliseconds )
+{
+	if( milliseconds <= 0 ) {
+		switch( mode ) {
+		case LATENCY_LOW:
+			milliseconds = LOW_LATENCY_TARGET;
+			break;
+		case LATENCY_POWER_SAVING:
+			milliseconds = POWER_SAVING_TARGET;
+			break;
+		default:
+			milliseconds = NORMAL_TARGET;
+			break;
+		}
+	}
+	mLatency = milliseconds / 1000.0;
+}
+
+bool NullRenderer::hasQueuedFrames()
+{
+	return !mBuffers.empty();
+}
+
+bool NullRenderer::hasBufferSpace()
+{
+	return mBytesPerSecond > 0 && mQueuedDuration < mLatency;
+}
+
+void NullRenderer::queueFrame( const AudioFrame &frame )
+{
+	// time spent waiting for this frame is not played out of it
+	advance();
+
+	Buffer buffer;
+	buffer.pts = frame.getPts();
+	buffer.duration = double( frame.getDataSize() ) / mBytesPerSecond;
+
+	mBuffers.push_back( buffer );
+	mQueuedDuration += buffer.duration;
+
+	play();
+}
+
+void NullRenderer::clearBuffers()
+{
+	stop();
+}
+
+void NullRenderer::flushBuffers()
+{
+	advance();
+}
+
+void NullRenderer::advance()
+{
+	const Clock::time_point now = Clock::now();
+	double                  elapsed = chrono::duration<double>( now - mLastUpdate ).count() * mSpeed;
+	mLastUpdate = now;
+
+	if( !mPlaying )
+		return;
+
+	// as fast as possible: whatever is queued has been played
+	if( mSpeed <= 0.0 )
+		elapsed = mQueuedDuration;
+
+	while( !mBuffers.empty() && elapsed > 0.0 ) {
+		const Buffer &buffer = mBuffers.front();
+
+		const double remaining = buffer.duration - mOffset;
+		if( elapsed < remaining ) {
+			mOffset += elapsed;
+			break;
+		}
+
+		elapsed -= remaining;
+		mQueuedDuration -= buffer.duration;
+		mLastPts = buffer.pts + buffer.duration;
+		mOffset = 0;
+		mBuffers.pop_front();
+	}
+
+	// an underrun holds the clock, it does not catch up once audio arrives
+	if( mBuffers.empty() )
+		mQueuedDuration = 0;
+}
+
+double NullRenderer::getCurrentPts()
+{
+	advance();
+
+	return mBuffers.empty() ? mLastPts : mBuffers.front().pts + mOffset;
+}
+
+void NullRenderer::play()
+{
+	if( !mPlaying && !mBuffers.empty() ) {
+		mPlaying = true;
+		mLastUpdate = Clock::now();
+	}
+}
+
+void NullRenderer::pause()
+{
+	advance();
+	mPlaying = false;
+}
+
+void NullRenderer::stop()
+{
+	mPlaying = false;
+
+	mBuffers.clear();
+	mQueuedDuration = 0;
+	mOffset = 0;
+	mLastPts = 0;
+}
+
+void NullRenderer::adjustVolume( float offset )
+{
+	mVolume += offset;
+	NumericOperations::clip( mVolume, 0.f, 1.f );
+}
@@ -4,9 +4,18 @@
 #include "audiorenderer/audioframe.h"
 #include "audiorenderer/openalrenderer.h"
 #include "common/numericoperations.h"
+#include "common/sampleconversion.h"
 
 using namespace std;
 
+// duration of a single OpenAL buffer and the default latency target per mode, in milliseconds
+#define LOW_LATENCY_BUFFER 10
+#define LOW_LATENCY_TARGET 40
+#define NORMAL_BUFFER 25
+#define NORMAL_TARGET 200
+#define POWER_SAVING_BUFFER 250
+#define POWER_SAVING_TARGET 2000
+
 ALCdevice * OpenAlRenderer::mPAudioDevice = nullptr;
 ALCcontext *OpenAlRenderer::mPAlcContext = nullptr;
 int         OpenAlRenderer::mRefCount = 0;
@@ -14,15 +23,25 @@ int         OpenAlRenderer::mRefCount = 0;
 OpenAlRenderer::OpenAlRenderer()
     : AudioRenderer()
     , mAudioSource( 0 )
-    , mCurrentBuffer( 0 )
+    , mNumBuffers( NORMAL_TARGET / NORMAL_BUFFER )
     , mVolume( 1.f )
     , mAudioFormat( AL_FORMAT_STEREO16 )
     , mNumChannels( 0 )
     , mFrequency( 0 )
+    , mConvertToS16( false )
+    , mLatencyMode( LATENCY_NORMAL )
+    , mLatency( NORMAL_TARGET )
+    , mBytesPerSecond( 0 )
+    , mBufferBytes( 0 )
+    , mStagingSize( 0 )
+    , mStagingPts( 0 )
 {
 	if( !mPAudioDevice )
 		mPAudioDevice = alcOpenDevice( NULL );
 
+	if( !mPAudioDevice )
+		throw logic_error( "OpenAlRenderer: failed to open the audio device" );
+
 	if( mPAudioDevice && !mPAlcContext ) {
 		mPAlcContext = alcCreateContext( mPAudioDevice, NULL );
 		alcMakeContextCurrent( mPAlcContext );
@@ -31,15 +50,17 @@ OpenAlRenderer::OpenAlRenderer()
 	mRefCount++;
 
 	assert( alGetError() == AL_NO_ERROR );
-	alGenBuffers( NUM_BUFFERS, mAudioBuffers );
+	alGenBuffers( MAX_BUFFERS, mAudioBuffers );
 	alGenSources( 1, &mAudioSource );
+
+	mFreeBuffers.assign( mAudioBuffers, mAudioBuffers + MAX_BUFFERS );
 }
 
 OpenAlRenderer::~OpenAlRenderer()
 {
 	alSourceStop( mAudioSource );
 	alDeleteSources( 1, &mAudioSource );
-	alDeleteBuffers( NUM_BUFFERS, mAudioBuffers );
+	alDeleteBuffers( MAX_BUFFERS, mAudioBuffers );
 
 	if( --mRefCount <= 0 ) {
 		if( mPAlcContext ) {
@@ -57,63 +78,128 @@ OpenAlRenderer::~OpenAlRenderer()
 
 void OpenAlRenderer::setFormat( const AudioFormat &format )
 {
-	switch( format.bits ) {
-	case 8:
-		switch( format.numChannels ) {
-		case 1:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_MONO8" );
-			break;
-		case 2:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_STEREO8" );
-			break;
-		case 4:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_QUAD8" );
-			break;
-		case 6:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_51CHN8" );
-			break;
-		case 7:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_61CHN8" );
-			break;
-		case 8:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_71CHN8" );
-			break;
+	mConvertToS16 = false;
+
+	if( format.isFloat ) {
+		// float samples go to OpenAL as they are where the extensions allow it, otherwise they are converted when queued
+		mAudioFormat = findFormat( 32, format.numChannels, true );
+		if( !mAudioFormat ) {
+			mAudioFormat = findFormat( 16, format.numChannels, false );
+			mConvertToS16 = true;
 		}
+	}
+	else {
+		mAudioFormat = findFormat( format.bits, format.numChannels, false );
+	}
 
-		if( alGetError() != AL_NO_ERROR )
-			throw logic_error( "OpenAlRenderer: unsupported format" );
-		break;
-	case 16:
-		switch( format.numChannels ) {
-		case 1:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_MONO16" );
-			break;
-		case 2:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_STEREO16" );
-			break;
-		case 4:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_QUAD16" );
-			break;
-		case 6:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_51CHN16" );
+	if( !mAudioFormat )
+		throw logic_error( "OpenAlRenderer: unsupported format" );
+
+	mNumChannels = format.numChannels;
+	mFrequency = format.rate;
+
+	int bytesPerSample = int( format.bits / 8 );
+	if( mConvertToS16 )
+		bytesPerSample = sizeof( int16_t );
+	mBytesPerSecond = mFrequency * mNumChannels * bytesPerSample;
+
+	// staged samples are in the previous format
+	mStagingSize = 0;
+	updateBufferLayout();
+}
+
+void OpenAlRenderer::setLatency( LatencyMode mode, int milliseconds )
+{
+	mLatencyMode = mode;
+
+	if( milliseconds <= 0 ) {
+		switch( mode ) {
+		case LATENCY_LOW:
+			milliseconds = LOW_LATENCY_TARGET;
 			break;
-		case 7:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_61CHN16" );
+		case LATENCY_POWER_SAVING:
+			milliseconds = POWER_SAVING_TARGET;
 			break;
-		case 8:
-			mAudioFormat = alGetEnumValue( "AL_FORMAT_71CHN16" );
+		default:
+			milliseconds = NORMAL_TARGET;
 			break;
 		}
+	}
+	mLatency = milliseconds;
+
+	updateBufferLayout();
+}
 
-		if( alGetError() != AL_NO_ERROR )
-			throw logic_error( "OpenAlRenderer: unsupported format" );
+void OpenAlRenderer::updateBufferLayout()
+{
+	int bufferDuration;
+	switch( mLatencyMode ) {
+	case LATENCY_LOW:
+		bufferDuration = LOW_LATENCY_BUFFER;
+		break;
+	case LATENCY_POWER_SAVING:
+		bufferDuration = POWER_SAVING_BUFFER;
 		break;
 	default:
-		throw logic_error( "OpenAlRenderer: unsupported format" );
+		bufferDuration = NORMAL_BUFFER;
+		break;
 	}
 
-	mNumChannels = format.numChannels;
-	mFrequency = format.rate;
+	// at least two buffers, so that one can be refilled while the other plays
+	mNumBuffers = ( mLatency + bufferDuration - 1 ) / bufferDuration;
+	NumericOperations::clip( mNumBuffers, 2, MAX_BUFFERS );
+
+	// whole sample frames only
+	const int bytesPerFrame = mFrequency > 0 ? mBytesPerSecond / mFrequency : 0;
+	mBufferBytes = size_t( int64_t( mFrequency ) * bufferDuration / 1000 ) * bytesPerFrame;
+}
+
+ALenum OpenAlRenderer::findFormat( unsigned int bits, unsigned int numChannels, bool isFloat )
+{
+	if( isFloat ? !alIsExtensionPresent( "AL_EXT_FLOAT32" ) : ( bits != 8 && bits != 16 ) )
+		return 0;
+
+	const bool  is8Bit = !isFloat && bits == 8;
+	const char *name = NULL;
+
+	// multichannel formats need AL_EXT_MCFORMATS, alGetEnumValue() fails without it
+	switch( numChannels ) {
+	case 1:
+		name = isFloat ? "AL_FORMAT_MONO_FLOAT32" : is8Bit ? "AL_FORMAT_MONO8" : "AL_FORMAT_MONO16";
+		break;
+	case 2:
+		name = isFloat ? "AL_FORMAT_STEREO_FLOAT32" : is8Bit ? "AL_FORMAT_STEREO8" : "AL_FORMAT_STEREO16";
+		break;
+	case 4:
+		name = isFloat ? "AL_FORMAT_QUAD32" : is8Bit ? "AL_FORMAT_QUAD8" : "AL_FORMAT_QUAD16";
+		break;
+	case 6:
+		name = isFloat ? "AL_FORMAT_51CHN32" : is8Bit ? "AL_FORMAT_51CHN8" : "AL_FORMAT_51CHN16";
+		break;
+	case 7:
+		name = isFloat ? "AL_FORMAT_61CHN32" : is8Bit ? "AL_FORMAT_61CHN8" : "AL_FORMAT_61CHN16";
+		break;
+	case 8:
+		name = isFloat ? "AL_FORMAT_71CHN32" : is8Bit ? "AL_FORMAT_71CHN8" : "AL_FORMAT_71CHN16";
+		break;
+	default:
+		return 0;
+	}
+
+	const ALenum format = alGetEnumValue( name );
+	if( alGetError() != AL_NO_ERROR )
+		return 0;
+
+	return format;
+}
+
+int OpenAlRenderer::getDeviceSampleRate()
+{
+	ALCint frequency = 0;
+	if( mPAudioDevice )
+		alcGetIntegerv( mPAudioDevice, ALC_FREQUENCY, 1, &frequency );
+
+	return frequency;
 }
 
 bool OpenAlRenderer::hasQueuedFrames()
@@ -127,20 +213,75 @@ bool OpenAlRenderer::hasBufferSpace()
 {
 	int queued = 0;
 	alGetSourcei( mAudioSource, AL_BUFFERS_QUEUED, &queued );
-	return queued < NUM_BUFFERS;
+	return queued < mNumBuffers && mStagingSize < mBufferBytes;
 }
 
 void OpenAlRenderer::queueFrame( const AudioFrame &frame )
 {
 	assert( frame.getFrameData() );
-	alBufferData( mAudioBuffers[mCurrentBuffer], mAudioFormat, frame.getFrameData(), frame.getDataSize(), mFrequency );
-	alSourceQueueBuffers( mAudioSource, 1, &mAudioBuffers[mCurrentBuffer] );
-	mPtsQueue.push_back( frame.getPts() );
 
-	play();
+	const uint8_t *data = frame.getFrameData();
+	size_t         size = frame.getDataSize();
+
+	if( mConvertToS16 ) {
+		const size_t numSamples = size / sizeof( float );
+
+		// only grows, so that steady state does not allocate
+		if( mConversionBuffer.size() < numSamples )
+			mConversionBuffer.resize( numSamples );
+
+		SampleConversion::floatToS16( reinterpret_cast<const float *>( data ), mConversionBuffer.data(), numSamples );
+		data = reinterpret_cast<const uint8_t *>( mConversionBuffer.data() );
+		size = numSamples * sizeof( int16_t );
+	}
+
+	// the buffer being filled takes the timestamp of its first sample
+	if( mStagingSize == 0 )
+		mStagingPts = frame.getPts();
+
+	if( mStaging.size() < mStagingSize + size )
+		mStaging.resize( mStagingSize + size );
 
-	++mCurrentBuffer;
-	mCurrentBuffer %= NUM_BUFFERS;
+	memcpy( mStaging.data() + mStagingSize, data, size );
+	mStagingSize += size;
+
+	submitBuffers( false );
+}
+
+void OpenAlRenderer::submitBuffers( bool allowPartial )
+{
+	if( mBufferBytes == 0 || mStagingSize == 0 )
+		return;
+
+	int queued = 0;
+	alGetSourcei( mAudioSource, AL_BUFFERS_QUEUED, &queued );
+
+	size_t offset = 0;
+	while( queued < mNumBuffers && !mFreeBuffers.empty() ) {
+		const size_t size = std::min( mStagingSize - offset, mBufferBytes );
+
+		// a partial buffer is only worth its AL call when nothing else is left to play
+		if( size == 0 || ( size < mBufferBytes && !( allowPartial && queued == 0 ) ) )
+			break;
+
+		const ALuint buffer = mFreeBuffers.back();
+		mFreeBuffers.pop_back();
+
+		alBufferData( buffer, mAudioFormat, mStaging.data() + offset, ALsizei( size ), mFrequency );
+		alSourceQueueBuffers( mAudioSource, 1, &buffer );
+		mPtsQueue.push_back( mStagingPts );
+
+		mStagingPts += double( size ) / mBytesPerSecond;
+		offset += size;
+		++queued;
+	}
+
+	if( offset > 0 ) {
+		mStagingSize -= offset;
+		memmove( mStaging.data(), mStaging.data() + offset, mStagingSize );
+
+		play();
+	}
 
 	assert( alGetError() == AL_NO_ERROR );
 }
@@ -153,14 +294,23 @@ void OpenAlRenderer::clearBuffers()
 	alGetSourcei( mAudioSource, AL_BUFFERS_QUEUED, &queued );
 
 	if( queued > 0 ) {
-		ALuint *buffers = new ALuint[queued];
+		ALuint buffers[MAX_BUFFERS];
 		alSourceUnqueueBuffers( mAudioSource, queued, buffers );
-		delete[] buffers;
+		mFreeBuffers.insert( mFreeBuffers.end(), buffers, buffers + queued );
 	}
 	mPtsQueue.clear();
+	mStagingSize = 0;
 }
 
 void OpenAlRenderer::flushBuffers()
+{
+	unqueueProcessed();
+
+	// staged samples that did not fit while the queue was full, and a short tail rather than an underrun
+	submitBuffers( true );
+}
+
+void OpenAlRenderer::unqueueProcessed()
 {
 	int processed = 0;
 	alGetSourcei( mAudioSource, AL_BUFFERS_PROCESSED, &processed );
@@ -169,6 +319,7 @@ void OpenAlRenderer::flushBuffers()
 		ALuint buffer;
 		alSourceUnqueueBuffers( mAudioSource, 1, &buffer );
 		assert( alGetError() == AL_NO_ERROR );
+		mFreeBuffers.push_back( buffer );
 		mPtsQueue.pop_front();
 	}
 }
@@ -198,12 +349,12 @@ void OpenAlRenderer::pause()
 void OpenAlRenderer::stop()
 {
 	alSourceStop( mAudioSource );
-	flushBuffers();
+	unqueueProcessed();
 }
 
 int OpenAlRenderer::getBufferSize()
 {
-	return NUM_BUFFERS;
+	return mNumBuffers;
 }
 
 void OpenAlRenderer::adjustVolume( float offset )
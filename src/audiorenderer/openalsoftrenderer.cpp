@@ -0,0 +1,377 @@
+#include "cinder/app/App.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "audiorenderer/audioformat.h"
+#include "audiorenderer/openalrenderer.h"
+#include "audiorenderer/openalsoftrenderer.h"
+#include "common/numericoperations.h"
+#include "common/sampleconversion.h"
+
+using namespace std;
+
+// decoded frames the ring holds at most, the latency target usually limits it first
+#define RING_CAPACITY 64
+// default latency target per mode, in milliseconds
+#define LOW_LATENCY_TARGET 20
+#define NORMAL_TARGET 100
+#define POWER_SAVING_TARGET 1000
+
+// from alext.h, which not every OpenAL SDK ships
+#ifndef ALC_SOFT_loopback
+#define ALC_FORMAT_CHANNELS_SOFT 0x1990
+#define ALC_FORMAT_TYPE_SOFT 0x1991
+#define ALC_FLOAT_SOFT 0x1406
+#define ALC_STEREO_SOFT 0x1501
+typedef ALCdevice *( ALC_APIENTRY *LPALCLOOPBACKOPENDEVICESOFT )( const ALCchar *deviceName );
+typedef ALCboolean( ALC_APIENTRY *LPALCISRENDERFORMATSUPPORTEDSOFT )( ALCdevice *device, ALCsizei freq, ALCenum channels, ALCenum type );
+typedef void( ALC_APIENTRY *LPALCRENDERSAMPLESSOFT )( ALCdevice *device, ALCvoid *buffer, ALCsizei samples );
+#endif
+
+#ifndef AL_SOFT_callback_buffer
+typedef ALsizei( AL_APIENTRY *ALBUFFERCALLBACKTYPESOFT )( ALvoid *userptr, ALvoid *sampledata, ALsizei numbytes );
+typedef void( AL_APIENTRY *LPALBUFFERCALLBACKSOFT )( ALuint buffer, ALenum format, ALsizei freq, ALBUFFERCALLBACKTYPESOFT callback, ALvoid *userptr );
+#endif
+
+namespace {
+
+LPALCLOOPBACKOPENDEVICESOFT      sAlcLoopbackOpenDevice = NULL;
+LPALCISRENDERFORMATSUPPORTEDSOFT sAlcIsRenderFormatSupported = NULL;
+LPALCRENDERSAMPLESSOFT           sAlcRenderSamples = NULL;
+LPALBUFFERCALLBACKSOFT           sAlBufferCallback = NULL;
+
+} // namespace
+
+ALCdevice * OpenAlSoftRenderer::mPAudioDevice = nullptr;
+ALCcontext *OpenAlSoftRenderer::mPAlcContext = nullptr;
+int         OpenAlSoftRenderer::mRefCount = 0;
+bool        OpenAlSoftRenderer::mUseLoopback = false;
+int         OpenAlSoftRenderer::mLoopbackSampleRate = 48000;
+
+void OpenAlSoftRenderer::setLoopback( bool enabled, int sampleRate )
+{
+	if( mPAudioDevice )
+		return;
+
+	mUseLoopback = enabled;
+	mLoopbackSampleRate = sampleRate;
+}
+
+bool OpenAlSoftRenderer::renderLoopback( float *buffer, int numSamples )
+{
+	if( !mUseLoopback || !mPAudioDevice )
+		return false;
+
+	// the buffer callbacks of all playing sources run on this thread, from within this call
+	sAlcRenderSamples( mPAudioDevice, buffer, numSamples );
+	return true;
+}
+
+void OpenAlSoftRenderer::openDevice()
+{
+	if( mUseLoopback ) {
+		if( !alcIsExtensionPresent( NULL, "ALC_SOFT_loopback" ) )
+			throw logic_error( "OpenAlSoftRenderer: ALC_SOFT_loopback is not available" );
+
+		sAlcLoopbackOpenDevice = reinterpret_cast<LPALCLOOPBACKOPENDEVICESOFT>( alcGetProcAddress( NULL, "alcLoopbackOpenDeviceSOFT" ) );
+		sAlcIsRenderFormatSupported = reinterpret_cast<LPALCISRENDERFORMATSUPPORTEDSOFT>( alcGetProcAddress( NULL, "alcIsRenderFormatSupportedSOFT" ) );
+		sAlcRenderSamples = reinterpret_cast<LPALCRENDERSAMPLESSOFT>( alcGetProcAddress( NULL, "alcRenderSamplesSOFT" ) );
+		if( !sAlcLoopbackOpenDevice || !sAlcIsRenderFormatSupported || !sAlcRenderSamples )
+			throw logic_error( "OpenAlSoftRenderer: ALC_SOFT_loopback functions are not available" );
+
+		mPAudioDevice = sAlcLoopbackOpenDevice( NULL );
+		if( !mPAudioDevice )
+			throw logic_error( "OpenAlSoftRenderer: failed to open the loopback device" );
+
+		if( !sAlcIsRenderFormatSupported( mPAudioDevice, mLoopbackSampleRate, ALC_STEREO_SOFT, ALC_FLOAT_SOFT ) ) {
+			closeDevice();
+			throw logic_error( "OpenAlSoftRenderer: unsupported loopback format" );
+		}
+
+		const ALCint attributes[] = { ALC_FORMAT_CHANNELS_SOFT, ALC_STEREO_SOFT, ALC_FORMAT_TYPE_SOFT, ALC_FLOAT_SOFT, ALC_FREQUENCY, mLoopbackSampleRate, 0 };
+		mPAlcContext = alcCreateContext( mPAudioDevice, attributes );
+	}
+	else {
+		mPAudioDevice = alcOpenDevice( NULL );
+		if( !mPAudioDevice )
+			throw logic_error( "OpenAlSoftRenderer: failed to open the audio device" );
+
+		mPAlcContext = alcCreateContext( mPAudioDevice, NULL );
+	}
+
+	if( !mPAlcContext ) {
+		closeDevice();
+		throw logic_error( "OpenAlSoftRenderer: failed to create a context" );
+	}
+	alcMakeContextCurrent( mPAlcContext );
+
+	// alGetProcAddress() needs a current context
+	if( !alIsExtensionPresent( "AL_SOFT_callback_buffer" ) ) {
+		closeDevice();
+		throw logic_error( "OpenAlSoftRenderer: AL_SOFT_callback_buffer is not available" );
+	}
+	sAlBufferCallback = reinterpret_cast<LPALBUFFERCALLBACKSOFT>( alGetProcAddress( "alBufferCallbackSOFT" ) );
+	if( !sAlBufferCallback ) {
+		closeDevice();
+		throw logic_error( "OpenAlSoftRenderer: alBufferCallbackSOFT is not available" );
+	}
+}
+
+void OpenAlSoftRenderer::closeDevice()
+{
+	if( mPAlcContext ) {
+		alcMakeContextCurrent( NULL );
+		alcDestroyContext( mPAlcContext );
+		mPAlcContext = nullptr;
+	}
+
+	if( mPAudioDevice ) {
+		alcCloseDevice( mPAudioDevice );
+		mPAudioDevice = nullptr;
+	}
+}
+
+OpenAlSoftRenderer::OpenAlSoftRenderer()
+    : AudioRenderer()
+    , mAudioSource( 0 )
+    , mAudioBuffer( 0 )
+    , mVolume( 1.f )
+    , mAudioFormat( 0 )
+    , mFrequency( 0 )
+    , mBytesPerSecond( 0 )
+    , mSilence( 0 )
+    , mConvertToS16( false )
+    , mRing( RING_CAPACITY )
+    , mRenderOffset( 0 )
+    , mQueuedBytes( 0 )
+    , mRenderedPts( 0.0 )
+    , mLatencyMode( LATENCY_NORMAL )
+    , mLatency( NORMAL_TARGET )
+    , mLatencyBytes( 0 )
+{
+	if( !mPAudioDevice )
+		openDevice();
+
+	mRefCount++;
+
+	alGenBuffers( 1, &mAudioBuffer );
+	alGenSources( 1, &mAudioSource );
+	assert( alGetError() == AL_NO_ERROR );
+}
+
+OpenAlSoftRenderer::~OpenAlSoftRenderer()
+{
+	// the mixer no longer calls back once the source is stopped
+	alSourceStop( mAudioSource );
+	alDeleteSources( 1, &mAudioSource );
+	alDeleteBuffers( 1, &mAudioBuffer );
+
+	if( --mRefCount <= 0 )
+		closeDevice();
+}
+
+void OpenAlSoftRenderer::setFormat( const AudioFormat &format )
+{
+	mConvertToS16 = false;
+
+	if( format.isFloat ) {
+		mAudioFormat = OpenAlRenderer::findFormat( 32, format.numChannels, true );
+		if( !mAudioFormat ) {
+			mAudioFormat = OpenAlRenderer::findFormat( 16, format.numChannels, false );
+			mConvertToS16 = true;
+		}
+	}
+	else {
+		mAudioFormat = OpenAlRenderer::findFormat( format.bits, format.numChannels, false );
+	}
+
+	if( !mAudioFormat )
+		throw logic_error( "OpenAlSoftRenderer: unsupported format" );
+
+	int bytesPerSample = int( format.bits / 8 );
+	if( mConvertToS16 )
+		bytesPerSample = sizeof( int16_t );
+
+	// queued frames are in the previous format
+	clearBuffers();
+
+	mFrequency = format.rate;
+	mBytesPerSecond = mFrequency * int( format.numChannels ) * bytesPerSample;
+	mSilence = ( bytesPerSample == 1 ) ? 0x80 : 0;
+	setLatency( mLatencyMode, mLatency );
+
+	// a callback buffer can't be changed while a source uses it
+	alSourcei( mAudioSource, AL_BUFFER, 0 );
+	sAlBufferCallback( mAudioBuffer, mAudioFormat, mFrequency, &OpenAlSoftRenderer::bufferCallback, this );
+	alSourcei( mAudioSource, AL_BUFFER, ALint( mAudioBuffer ) );
+
+	assert( alGetError() == AL_NO_ERROR );
+}
+
+int OpenAlSoftRenderer::getDeviceSampleRate()
+{
+	ALCint frequency = 0;
+	if( mPAudioDevice )
+		alcGetIntegerv( mPAudioDevice, ALC_FREQUENCY, 1, &frequency );
+
+	return frequency;
+}
+
+void OpenAlSoftRenderer::setLatency( LatencyMode mode, int milliseconds )
+{
+	mLatencyMode = mode;
+
+	if( milliseconds <= 0 ) {
+		switch( mode ) {
+		case LATENCY_LOW:
+			milliseconds = LOW_LATENCY_TARGET;
+			break;
+		case LATENCY_POWER_SAVING:
+			milliseconds = POWER_SAVING_TARGET;
+			break;
+		default:
+			milliseconds = NORMAL_TARGET;
+			break;
+		}
+	}
+	mLatency = milliseconds;
+	mLatencyBytes = int( int64_t( mBytesPerSecond ) * mLatency / 1000 );
+}
+
+bool OpenAlSoftRenderer::hasQueuedFrames()
+{
+	return mQueuedBytes > 0;
+}
+
+bool OpenAlSoftRenderer::hasBufferSpace()
+{
+	return !mRing.full() && mQueuedBytes < mLatencyBytes;
+}
+
+void OpenAlSoftRenderer::queueFrame( const AudioFrame &frame )
+{
+	assert( frame.getFrameData() );
+
+	const uint8_t *data = frame.getFrameData();
+	uint32      size = frame.getDataSize();
+
+	if( mConvertToS16 ) {
+		const size_t numSamples = size / sizeof( float );
+
+		// only grows, so that steady state does not allocate
+		if( mConversionBuffer.size() < numSamples )
+			mConversionBuffer.resize( numSamples );
+
+		SampleConversion::floatToS16( reinterpret_cast<const float *>( data ), mConversionBuffer.data(), numSamples );
+		data = reinterpret_cast<const uint8_t *>( mConversionBuffer.data() );
+		size = uint32( numSamples * sizeof( int16_t ) );
+	}
+
+	mStagingFrame.setDataSize( size );
+	mStagingFrame.setFrameData( data );
+	mStagingFrame.setPts( frame.getPts() );
+
+	// the staging frame gets the buffer of a frame the mixer is done with
+	if( !mRing.push( mStagingFrame ) )
+		return;
+
+	mQueuedBytes += int( size );
+
+	play();
+}
+
+ALsizei AL_APIENTRY OpenAlSoftRenderer::bufferCallback( ALvoid *userData, ALvoid *data, ALsizei numBytes )
+{
+	return static_cast<OpenAlSoftRenderer *>( userData )->render( static_cast<uint8_t *>( data ), numBytes );
+}
+
+ALsizei OpenAlSoftRenderer::render( uint8_t *data, ALsizei numBytes )
+{
+	// alSourceStop() does not wait for the mixer, so the ring may be being cleared
+	std::unique_lock<std::mutex> lock( mRenderMutex, std::try_to_lock );
+	if( !lock.owns_lock() ) {
+		memset( data, mSilence, size_t( numBytes ) );
+		return numBytes;
+	}
+
+	ALsizei written = 0;
+	while( written < numBytes ) {
+		if( mRenderOffset >= mRenderFrame.getDataSize() ) {
+			if( !mRing.pop( mRenderFrame ) )
+				break;
+			mRenderOffset = 0;
+		}
+
+		const uint32 size = std::min( uint32( numBytes - written ), mRenderFrame.getDataSize() - mRenderOffset );
+		memcpy( data + written, mRenderFrame.getFrameData() + mRenderOffset, size );
+		written += ALsizei( size );
+		mRenderOffset += size;
+	}
+
+	if( written > 0 ) {
+		mQueuedBytes -= written;
+		mRenderedPts = mRenderFrame.getPts() + double( mRenderOffset ) / mBytesPerSecond;
+	}
+
+	// returning less would end the stream, so an underrun plays silence and the clock holds still
+	memset( data + written, mSilence, size_t( numBytes - written ) );
+	return numBytes;
+}
+
+void OpenAlSoftRenderer::clearBuffers()
+{
+	stop();
+
+	// the mixer may still be in a callback after alSourceStop(), the lock waits for it to leave and keeps it out
+	std::lock_guard<std::mutex> lock( mRenderMutex );
+
+	mRing.clear();
+	mRenderOffset = mRenderFrame.getDataSize();
+	mQueuedBytes = 0;
+	// the clock holds the last rendered position until the mixer renders the next frame, a jump to 0 would throw off the sync
+}
+
+void OpenAlSoftRenderer::flushBuffers()
+{
+	// nothing to unqueue, the mixer takes the samples itself
+}
+
+bool OpenAlSoftRenderer::isPlaying()
+{
+	ALenum state;
+	alGetSourcei( mAudioSource, AL_SOURCE_STATE, &state );
+
+	return ( state == AL_PLAYING );
+}
+
+void OpenAlSoftRenderer::play()
+{
+	if( !isPlaying() && mQueuedBytes > 0 ) {
+		alSourcePlay( mAudioSource );
+	}
+}
+
+void OpenAlSoftRenderer::pause()
+{
+	if( isPlaying() ) {
+		alSourcePause( mAudioSource );
+	}
+}
+
+void OpenAlSoftRenderer::stop()
+{
+	alSourceStop( mAudioSource );
+}
+
+void OpenAlSoftRenderer::adjustVolume( float offset )
+{
+	mVolume += offset;
+	NumericOperations::clip( mVolume, 0.f, 1.f );
+	alSourcef( mAudioSource, AL_GAIN, mVolume );
+}
+
+double OpenAlSoftRenderer::getCurrentPts()
+{
+	return mRenderedPts;
+}
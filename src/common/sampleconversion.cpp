@@ -0,0 +1,38 @@
+#include "common/sampleconversion.h"
+
+#include <cmath>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define USE_SSE2 0
+#endif
+
+void SampleConversion::floatToS16( const float *src, int16_t *dst, size_t count )
+{
+	size_t i = 0;
+#if USE_SSE2
+	const __m128 scale = _mm_set1_ps( 32767.0f );
+	const __m128 lower = _mm_set1_ps( -1.0f );
+	const __m128 upper = _mm_set1_ps( 1.0f );
+
+	for( ; i + 8 <= count; i += 8 ) {
+		// clip before converting, out of range values would turn into INT_MIN
+		const __m128 a = _mm_min_ps( _mm_max_ps( _mm_loadu_ps( src + i ), lower ), upper );
+		const __m128 b = _mm_min_ps( _mm_max_ps( _mm_loadu_ps( src + i + 4 ), lower ), upper );
+		const __m128i packed = _mm_packs_epi32( _mm_cvtps_epi32( _mm_mul_ps( a, scale ) ), _mm_cvtps_epi32( _mm_mul_ps( b, scale ) ) );
+
+		_mm_storeu_si128( (__m128i *)( dst + i ), packed );
+	}
+#endif
+	for( ; i < count; ++i ) {
+		float sample = src[i];
+		if( sample < -1.0f )
+			sample = -1.0f;
+		else if( sample > 1.0f )
+			sample = 1.0f;
+
+		dst[i] = int16_t( lrintf( sample * 32767.0f ) );
+	}
+}
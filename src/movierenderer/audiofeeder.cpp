@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "movierenderer/audiofeeder.h"
+#include "movierenderer/moviedecoder.h"
+
+using namespace std;
+
+// decoded frames held per movie, on top of what the renderer has queued
+#define RING_CAPACITY 16
+// how often the output thread services the renderers, in milliseconds
+#define OUTPUT_INTERVAL 5
+
+namespace {
+
+mutex                 sOutputMutex;
+condition_variable    sOutputCondition;
+vector<AudioFeeder *> sFeeders;
+thread                sOutputThread;
+// bumped whenever the output thread is told to exit, so that a thread started later is not mistaken for it
+unsigned int sOutputGeneration = 0;
+
+} // namespace
+
+AudioFeeder::AudioFeeder( MovieDecoder &decoder, AudioRenderer &renderer )
+    : m_Decoder( decoder )
+    , m_Renderer( renderer )
+    , m_Ring( RING_CAPACITY )
+    , m_bWakeDecoder( false )
+    , m_bStop( false )
+    , m_bPaused( false )
+    , m_Clock( 0.0 )
+{
+	m_DecodeThread = thread( &AudioFeeder::runDecoder, this );
+	m_Decoder.setAudioPacketCallback( [this] { wakeDecoder(); } );
+	addFeeder( this );
+}
+
+AudioFeeder::~AudioFeeder()
+{
+	// once removed, the output thread no longer touches this feeder
+	removeFeeder( this );
+	m_Decoder.setAudioPacketCallback( std::function<void()>() );
+
+	m_bStop = true;
+	wakeDecoder();
+	m_DecodeThread.join();
+}
+
+void AudioFeeder::play()
+{
+	m_bPaused = false;
+	{
+		lock_guard<mutex> lock( m_RendererMutex );
+		m_Renderer.play();
+	}
+	wakeDecoder();
+	sOutputCondition.notify_all();
+}
+
+void AudioFeeder::pause()
+{
+	m_bPaused = true;
+
+	lock_guard<mutex> lock( m_RendererMutex );
+	m_Renderer.pause();
+}
+
+void AudioFeeder::stop()
+{
+	suspend();
+	resume();
+}
+
+void AudioFeeder::setLatency( AudioRenderer::LatencyMode mode, int milliseconds )
+{
+	lock_guard<mutex> lock( m_RendererMutex );
+	m_Renderer.setLatency( mode, milliseconds );
+}
+
+void AudioFeeder::suspend()
+{
+	// the decoder thread only lets go of its mutex while it waits, so both threads are idle once the locks are held
+	m_DecodeMutex.lock();
+	m_RendererMutex.lock();
+
+	m_Ring.clear();
+	m_Renderer.clearBuffers();
+}
+
+void AudioFeeder::resume()
+{
+	m_RendererMutex.unlock();
+	m_DecodeMutex.unlock();
+
+	wakeDecoder();
+	sOutputCondition.notify_all();
+}
+
+void AudioFeeder::runDecoder()
+{
+	unique_lock<mutex> lock( m_DecodeMutex );
+
+	while( !m_bStop ) {
+		while( !m_bStop && !m_Ring.full() ) {
+			if( !m_Decoder.decodeAudioFrame( m_DecodedFrame ) ) {
+				// a packet may decode to nothing, e.g. a flush packet or the samples before an accurate seek target
+				if( !m_Decoder.hasAudioPackets() )
+					break;
+				continue;
+			}
+
+			const bool starving = m_Ring.empty();
+			m_Ring.push( m_DecodedFrame );
+
+			if( starving )
+				sOutputCondition.notify_all();
+		}
+
+		// the reader signals new packets and the output thread signals when it takes frames out of a full ring
+		lock.unlock();
+		{
+			unique_lock<mutex> wakeLock( m_WakeMutex );
+			m_WakeCondition.wait( wakeLock, [this] { return m_bWakeDecoder || m_bStop; } );
+			m_bWakeDecoder = false;
+		}
+		lock.lock();
+	}
+}
+
+void AudioFeeder::wakeDecoder()
+{
+	{
+		lock_guard<mutex> lock( m_WakeMutex );
+		m_bWakeDecoder = true;
+	}
+	m_WakeCondition.notify_one();
+}
+
+void AudioFeeder::service()
+{
+	// suspended, the owner has the renderer
+	unique_lock<mutex> lock( m_RendererMutex, try_to_lock );
+	if( !lock.owns_lock() )
+		return;
+
+	if( !m_bPaused ) {
+		bool consumed = false;
+		while( m_Renderer.hasBufferSpace() && m_Ring.pop( m_OutputFrame ) ) {
+			m_Renderer.queueFrame( m_OutputFrame );
+			consumed = true;
+		}
+
+		m_Renderer.flushBuffers();
+
+		if( consumed )
+			wakeDecoder();
+	}
+
+	m_Clock = m_Renderer.getCurrentPts();
+}
+
+void AudioFeeder::runOutput( unsigned int generation )
+{
+	unique_lock<mutex> lock( sOutputMutex );
+
+	while( generation == sOutputGeneration ) {
+		for( AudioFeeder *feeder : sFeeders )
+			feeder->service();
+
+		// devices drain at their own pace and have nothing to wait on, so this is woken early only for new audio
+		sOutputCondition.wait_for( lock, chrono::milliseconds( OUTPUT_INTERVAL ) );
+	}
+}
+
+void AudioFeeder::addFeeder( AudioFeeder *feeder )
+{
+	lock_guard<mutex> lock( sOutputMutex );
+	sFeeders.push_back( feeder );
+
+	if( !sOutputThread.joinable() )
+		sOutputThread = thread( &AudioFeeder::runOutput, sOutputGeneration );
+}
+
+void AudioFeeder::removeFeeder( AudioFeeder *feeder )
+{
+	thread outputThread;
+	{
+		lock_guard<mutex> lock( sOutputMutex );
+		sFeeders.erase( remove( sFeeders.begin(), sFeeders.end(), feeder ), sFeeders.end() );
+
+		// the last feeder takes the output thread down with it
+		if( sFeeders.empty() ) {
+			++sOutputGeneration;
+			outputThread = std::move( sOutputThread );
+		}
+	}
+
+	if( outputThread.joinable() ) {
+		sOutputCondition.notify_all();
+		outputThread.join();
+	}
+}
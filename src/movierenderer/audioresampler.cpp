@@ -0,0 +1,426 @@
+#include "movierenderer/audioresampler.h"
+#include "common/sampleconversion.h"
+
+#include <algorithm>
+#include <cmath>
+
+extern "C" {
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+}
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define USE_SSE2 0
+#endif
+
+// gain of the centre and surround channels in a stereo downmix (-3 dB), as in ITU-R BS.775
+#define DOWNMIX_SIDE_GAIN 0.70710678f
+
+using namespace std;
+
+namespace {
+
+//! dst[i] = sum of src[k][i] * gains[k]
+void mixPlanes( float *dst, const float *const *src, const float *gains, int numSources, int numSamples )
+{
+	int i = 0;
+#if USE_SSE2
+	__m128 gain[4];
+	for( int k = 0; k < numSources; ++k )
+		gain[k] = _mm_set1_ps( gains[k] );
+
+	for( ; i + 4 <= numSamples; i += 4 ) {
+		__m128 sum = _mm_mul_ps( _mm_loadu_ps( src[0] + i ), gain[0] );
+		for( int k = 1; k < numSources; ++k )
+			sum = _mm_add_ps( sum, _mm_mul_ps( _mm_loadu_ps( src[k] + i ), gain[k] ) );
+
+		_mm_storeu_ps( dst + i, sum );
+	}
+#endif
+	for( ; i < numSamples; ++i ) {
+		float sum = src[0][i] * gains[0];
+		for( int k = 1; k < numSources; ++k )
+			sum += src[k][i] * gains[k];
+
+		dst[i] = sum;
+	}
+}
+
+//! Converts one sample, float and double go through float.
+template <typename Out>
+Out fromFloat( float sample );
+
+template <>
+inline float fromFloat<float>( float sample )
+{
+	return sample;
+}
+
+template <>
+inline int16_t fromFloat<int16_t>( float sample )
+{
+	sample = sample < -1.0f ? -1.0f : ( sample > 1.0f ? 1.0f : sample );
+	return int16_t( lrintf( sample * 32767.0f ) );
+}
+
+template <typename In, typename Out>
+struct Sample {
+	static Out convert( In sample ) { return fromFloat<Out>( float( sample ) ); }
+};
+
+template <>
+struct Sample<int16_t, int16_t> {
+	static int16_t convert( int16_t sample ) { return sample; }
+};
+
+template <>
+struct Sample<int16_t, float> {
+	static float convert( int16_t sample ) { return sample * ( 1.0f / 32768.0f ); }
+};
+
+template <>
+struct Sample<int32_t, int16_t> {
+	static int16_t convert( int32_t sample ) { return int16_t( sample >> 16 ); }
+};
+
+template <>
+struct Sample<int32_t, float> {
+	static float convert( int32_t sample ) { return float( sample ) * ( 1.0f / 2147483648.0f ); }
+};
+
+//! Converts \a numSamples samples per channel to interleaved output. With the channel count and formats known at
+//! compile time, the loops unroll and vectorise.
+template <typename In, typename Out, bool Planar, int Channels>
+struct ConversionKernel {
+	static void run( const uint8_t *const *src, uint8_t *dst, int numSamples )
+	{
+		Out *out = reinterpret_cast<Out *>( dst );
+
+		if( Planar ) {
+			const In *in[Channels];
+			for( int c = 0; c < Channels; ++c )
+				in[c] = reinterpret_cast<const In *>( src[c] );
+
+			for( int i = 0; i < numSamples; ++i ) {
+				for( int c = 0; c < Channels; ++c )
+					out[i * Channels + c] = Sample<In, Out>::convert( in[c][i] );
+			}
+		}
+		else {
+			const In *in = reinterpret_cast<const In *>( src[0] );
+			const int count = numSamples * Channels;
+
+			for( int i = 0; i < count; ++i )
+				out[i] = Sample<In, Out>::convert( in[i] );
+		}
+	}
+};
+
+template <int Channels>
+struct ConversionKernel<float, int16_t, false, Channels> {
+	static void run( const uint8_t *const *src, uint8_t *dst, int numSamples )
+	{
+		SampleConversion::floatToS16( reinterpret_cast<const float *>( src[0] ), reinterpret_cast<int16_t *>( dst ), size_t( numSamples ) * Channels );
+	}
+};
+
+#if USE_SSE2
+//! Planar float stereo, the output of most AAC decoders
+template <>
+struct ConversionKernel<float, float, true, 2> {
+	static void run( const uint8_t *const *src, uint8_t *dst, int numSamples )
+	{
+		const float *left = reinterpret_cast<const float *>( src[0] );
+		const float *right = reinterpret_cast<const float *>( src[1] );
+		float *      out = reinterpret_cast<float *>( dst );
+
+		int i = 0;
+		for( ; i + 4 <= numSamples; i += 4 ) {
+			const __m128 l = _mm_loadu_ps( left + i );
+			const __m128 r = _mm_loadu_ps( right + i );
+			_mm_storeu_ps( out + 2 * i, _mm_unpacklo_ps( l, r ) );
+			_mm_storeu_ps( out + 2 * i + 4, _mm_unpackhi_ps( l, r ) );
+		}
+
+		for( ; i < numSamples; ++i ) {
+			out[2 * i] = left[i];
+			out[2 * i + 1] = right[i];
+		}
+	}
+};
+
+template <>
+struct ConversionKernel<float, int16_t, true, 2> {
+	static void run( const uint8_t *const *src, uint8_t *dst, int numSamples )
+	{
+		const float *left = reinterpret_cast<const float *>( src[0] );
+		const float *right = reinterpret_cast<const float *>( src[1] );
+		int16_t *    out = reinterpret_cast<int16_t *>( dst );
+
+		const __m128 scale = _mm_set1_ps( 32767.0f );
+		const __m128 lower = _mm_set1_ps( -1.0f );
+		const __m128 upper = _mm_set1_ps( 1.0f );
+
+		int i = 0;
+		for( ; i + 4 <= numSamples; i += 4 ) {
+			const __m128i l = _mm_cvtps_epi32( _mm_mul_ps( _mm_min_ps( _mm_max_ps( _mm_loadu_ps( left + i ), lower ), upper ), scale ) );
+			const __m128i r = _mm_cvtps_epi32( _mm_mul_ps( _mm_min_ps( _mm_max_ps( _mm_loadu_ps( right + i ), lower ), upper ), scale ) );
+			_mm_storeu_si128( (__m128i *)( out + 2 * i ), _mm_packs_epi32( _mm_unpacklo_epi32( l, r ), _mm_unpackhi_epi32( l, r ) ) );
+		}
+
+		for( ; i < numSamples; ++i ) {
+			out[2 * i] = fromFloat<int16_t>( left[i] );
+			out[2 * i + 1] = fromFloat<int16_t>( right[i] );
+		}
+	}
+};
+#endif
+
+struct KernelEntry {
+	AVSampleFormat         input;
+	AVSampleFormat         output;
+	int                    numChannels;
+	AudioResampler::Kernel kernel;
+};
+
+#define KERNELS( inputFormat, InputType, planar, outputFormat, OutputType )                       \
+	{ inputFormat, outputFormat, 1, &ConversionKernel<InputType, OutputType, planar, 1>::run },   \
+	    { inputFormat, outputFormat, 2, &ConversionKernel<InputType, OutputType, planar, 2>::run }, \
+	    { inputFormat, outputFormat, 6, &ConversionKernel<InputType, OutputType, planar, 6>::run }, \
+	    { inputFormat, outputFormat, 8, &ConversionKernel<InputType, OutputType, planar, 8>::run }
+
+const KernelEntry sKernels[] = {
+	KERNELS( AV_SAMPLE_FMT_S16, int16_t, false, AV_SAMPLE_FMT_S16, int16_t ),
+	KERNELS( AV_SAMPLE_FMT_S16P, int16_t, true, AV_SAMPLE_FMT_S16, int16_t ),
+	KERNELS( AV_SAMPLE_FMT_S32, int32_t, false, AV_SAMPLE_FMT_S16, int16_t ),
+	KERNELS( AV_SAMPLE_FMT_S32P, int32_t, true, AV_SAMPLE_FMT_S16, int16_t ),
+	KERNELS( AV_SAMPLE_FMT_FLT, float, false, AV_SAMPLE_FMT_S16, int16_t ),
+	KERNELS( AV_SAMPLE_FMT_FLTP, float, true, AV_SAMPLE_FMT_S16, int16_t ),
+	KERNELS( AV_SAMPLE_FMT_DBL, double, false, AV_SAMPLE_FMT_S16, int16_t ),
+	KERNELS( AV_SAMPLE_FMT_DBLP, double, true, AV_SAMPLE_FMT_S16, int16_t ),
+	KERNELS( AV_SAMPLE_FMT_S16, int16_t, false, AV_SAMPLE_FMT_FLT, float ),
+	KERNELS( AV_SAMPLE_FMT_S16P, int16_t, true, AV_SAMPLE_FMT_FLT, float ),
+	KERNELS( AV_SAMPLE_FMT_S32, int32_t, false, AV_SAMPLE_FMT_FLT, float ),
+	KERNELS( AV_SAMPLE_FMT_S32P, int32_t, true, AV_SAMPLE_FMT_FLT, float ),
+	KERNELS( AV_SAMPLE_FMT_FLT, float, false, AV_SAMPLE_FMT_FLT, float ),
+	KERNELS( AV_SAMPLE_FMT_FLTP, float, true, AV_SAMPLE_FMT_FLT, float ),
+	KERNELS( AV_SAMPLE_FMT_DBL, double, false, AV_SAMPLE_FMT_FLT, float ),
+	KERNELS( AV_SAMPLE_FMT_DBLP, double, true, AV_SAMPLE_FMT_FLT, float ),
+};
+
+#undef KERNELS
+
+} // namespace
+
+AudioResampler::Kernel AudioResampler::findKernel( int inputFormat, AVSampleFormat outputFormat, int numChannels )
+{
+	for( const KernelEntry &entry : sKernels ) {
+		if( entry.input == inputFormat && entry.output == outputFormat && entry.numChannels == numChannels )
+			return entry.kernel;
+	}
+
+	return NULL;
+}
+
+AudioResampler::AudioResampler()
+    : m_bConfigured( false )
+    , m_pKernel( NULL )
+    , m_pContext( NULL )
+    , m_OutputFormat( AV_SAMPLE_FMT_S16 )
+    , m_OutputSampleRate( 0 )
+    , m_OutputChannels( 0 )
+    , m_Quality( QUALITY_NORMAL )
+    , m_bOutputChanged( false )
+    , m_InputFormat( -1 )
+    , m_InputSampleRate( 0 )
+    , m_InputLayout( 0 )
+    , m_NumOutputChannels( 0 )
+    , m_bDownmix( false )
+{
+}
+
+AudioResampler::~AudioResampler()
+{
+	reset();
+}
+
+void AudioResampler::setOutput( AVSampleFormat format, int sampleRate, int numChannels )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	m_bOutputChanged |= format != m_OutputFormat || sampleRate != m_OutputSampleRate || numChannels != m_OutputChannels;
+	m_OutputFormat = format;
+	m_OutputSampleRate = sampleRate;
+	m_OutputChannels = numChannels;
+}
+
+void AudioResampler::setQuality( Quality quality )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	m_bOutputChanged |= quality != m_Quality;
+	m_Quality = quality;
+}
+
+int AudioResampler::convert( const AVFrame *frame, uint8_t *buffer, int bufferSize )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	const uint64_t inputLayout = frame->channel_layout ? frame->channel_layout : av_get_default_channel_layout( frame->channels );
+
+	if( !m_bConfigured || m_bOutputChanged || frame->format != m_InputFormat || frame->sample_rate != m_InputSampleRate || inputLayout != m_InputLayout ) {
+		if( !configure( frame, inputLayout ) )
+			return -1;
+	}
+
+	const int bytesPerSample = m_NumOutputChannels * av_get_bytes_per_sample( m_OutputFormat );
+	if( bytesPerSample == 0 )
+		return 0;
+
+	if( m_pKernel ) {
+		const int numSamples = std::min( frame->nb_samples, bufferSize / bytesPerSample );
+		m_pKernel( frame->extended_data, buffer, numSamples );
+		return numSamples * bytesPerSample;
+	}
+
+	const uint8_t *const *in = frame->extended_data;
+	const uint8_t *       downmixed[2];
+	if( m_bDownmix ) {
+		downmix( frame );
+		downmixed[0] = reinterpret_cast<const uint8_t *>( m_DownmixBuffer.data() );
+		downmixed[1] = reinterpret_cast<const uint8_t *>( m_DownmixBuffer.data() + frame->nb_samples );
+		in = downmixed;
+	}
+
+	uint8_t * out = buffer;
+	const int samplesOut = swr_convert( m_pContext, &out, bufferSize / bytesPerSample, const_cast<const uint8_t **>( in ), frame->nb_samples );
+
+	return samplesOut > 0 ? samplesOut * bytesPerSample : 0;
+}
+
+void AudioResampler::reset()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	if( m_pContext )
+		swr_free( &m_pContext );
+
+	m_bConfigured = false;
+	m_pKernel = NULL;
+}
+
+bool AudioResampler::configure( const AVFrame *frame, uint64_t inputLayout )
+{
+	if( m_pContext )
+		swr_free( &m_pContext );
+
+	m_bConfigured = false;
+	m_bOutputChanged = false;
+	m_InputFormat = frame->format;
+	m_InputSampleRate = frame->sample_rate;
+	m_InputLayout = inputLayout;
+
+	const int      outputSampleRate = m_OutputSampleRate > 0 ? m_OutputSampleRate : frame->sample_rate;
+	const uint64_t outputLayout = av_get_default_channel_layout( m_OutputChannels > 0 ? m_OutputChannels : frame->channels );
+	m_NumOutputChannels = av_get_channel_layout_nb_channels( outputLayout );
+
+	// a plain format conversion needs no libswresample
+	m_pKernel = outputSampleRate == frame->sample_rate && outputLayout == inputLayout ? findKernel( frame->format, m_OutputFormat, m_NumOutputChannels ) : NULL;
+	if( m_pKernel ) {
+		m_bDownmix = false;
+		m_bConfigured = true;
+		return true;
+	}
+
+	// swresample takes over from the downmix with a plain stereo input
+	m_bDownmix = frame->format == AV_SAMPLE_FMT_FLTP && m_NumOutputChannels == 2 && frame->channels > 2 && setupDownmix( inputLayout );
+
+	m_pContext = swr_alloc_set_opts( NULL,
+	    outputLayout,
+	    m_OutputFormat,
+	    outputSampleRate,
+	    m_bDownmix ? AV_CH_LAYOUT_STEREO : inputLayout,
+	    AVSampleFormat( frame->format ),
+	    frame->sample_rate,
+	    0,
+	    NULL );
+
+	if( !m_pContext )
+		return false;
+
+	switch( m_Quality ) {
+	case QUALITY_FAST:
+		av_opt_set_int( m_pContext, "filter_size", 8, 0 );
+		av_opt_set_int( m_pContext, "phase_shift", 6, 0 );
+		break;
+	case QUALITY_HIGH:
+		av_opt_set_int( m_pContext, "filter_size", 64, 0 );
+		av_opt_set_int( m_pContext, "phase_shift", 12, 0 );
+		av_opt_set_int( m_pContext, "linear_interp", 1, 0 );
+		break;
+	default:
+		break;
+	}
+
+	if( swr_init( m_pContext ) < 0 ) {
+		swr_free( &m_pContext );
+		return false;
+	}
+
+	m_bConfigured = true;
+	return true;
+}
+
+bool AudioResampler::setupDownmix( uint64_t inputLayout )
+{
+	const uint64_t sides[2][MAX_DOWNMIX_SOURCES] = {
+		{ AV_CH_FRONT_LEFT, AV_CH_FRONT_CENTER, AV_CH_BACK_LEFT, AV_CH_SIDE_LEFT },
+		{ AV_CH_FRONT_RIGHT, AV_CH_FRONT_CENTER, AV_CH_BACK_RIGHT, AV_CH_SIDE_RIGHT }
+	};
+
+	// without both front channels, leave it to libswresample
+	if( av_get_channel_layout_channel_index( inputLayout, AV_CH_FRONT_LEFT ) < 0 || av_get_channel_layout_channel_index( inputLayout, AV_CH_FRONT_RIGHT ) < 0 )
+		return false;
+
+	// the low-frequency channel is dropped, as libswresample does by default
+	for( int side = 0; side < 2; ++side ) {
+		float total = 0.0f;
+
+		m_NumDownmixSources[side] = 0;
+		for( int k = 0; k < MAX_DOWNMIX_SOURCES; ++k ) {
+			const int index = av_get_channel_layout_channel_index( inputLayout, sides[side][k] );
+			if( index < 0 )
+				continue;
+
+			const float gain = k == 0 ? 1.0f : DOWNMIX_SIDE_GAIN;
+			m_DownmixSources[side][m_NumDownmixSources[side]] = index;
+			m_DownmixGains[side][m_NumDownmixSources[side]] = gain;
+			++m_NumDownmixSources[side];
+			total += gain;
+		}
+
+		// normalise, so that full scale on every channel does not clip
+		for( int k = 0; k < m_NumDownmixSources[side]; ++k )
+			m_DownmixGains[side][k] /= total;
+	}
+
+	return true;
+}
+
+void AudioResampler::downmix( const AVFrame *frame )
+{
+	// only grows, so that steady state does not allocate
+	if( m_DownmixBuffer.size() < size_t( 2 * frame->nb_samples ) )
+		m_DownmixBuffer.resize( 2 * frame->nb_samples );
+
+	for( int side = 0; side < 2; ++side ) {
+		const float *sources[MAX_DOWNMIX_SOURCES];
+		for( int k = 0; k < m_NumDownmixSources[side]; ++k )
+			sources[k] = reinterpret_cast<const float *>( frame->extended_data[m_DownmixSources[side][k]] );
+
+		mixPlanes( m_DownmixBuffer.data() + side * frame->nb_samples, sources, m_DownmixGains[side], m_NumDownmixSources[side], frame->nb_samples );
+	}
+}
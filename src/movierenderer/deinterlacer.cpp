@@ -0,0 +1,462 @@
+#include "movierenderer/deinterlacer.h"
+#include "movierenderer/framepool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define USE_SSE2 1
+#include <emmintrin.h>
+#else
+#define USE_SSE2 0
+#endif
+
+// upper bound for the default number of slice threads, beyond this memory bandwidth is the limit
+#define MAX_SLICE_THREADS 8
+
+using namespace std;
+
+namespace {
+
+bool isSupportedFormat( int format )
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get( AVPixelFormat( format ) );
+	if( !desc || !( desc->flags & AV_PIX_FMT_FLAG_PLANAR ) || ( desc->flags & ( AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_HWACCEL ) ) )
+		return false;
+
+	for( int i = 0; i < desc->nb_components; ++i ) {
+		if( desc->comp[i].depth != 8 || desc->comp[i].step != 1 )
+			return false;
+	}
+
+	return true;
+}
+
+bool haveSameGeometry( const AVFrame *a, const AVFrame *b )
+{
+	return a->format == b->format && a->width == b->width && a->height == b->height;
+}
+
+//! Lines around a missing line y that the yadif kernel looks at.
+struct YadifLines {
+	const uint8_t *curUp;     // y - 1 in the current frame
+	const uint8_t *curDown;   // y + 1 in the current frame
+	const uint8_t *prevUp;    // y - 1 in the previous frame
+	const uint8_t *prevDown;  // y + 1 in the previous frame
+	const uint8_t *nextUp;    // y - 1 in the next frame
+	const uint8_t *nextDown;  // y + 1 in the next frame
+	const uint8_t *prev2;     // y in the frame before the field
+	const uint8_t *next2;     // y in the frame after the field
+	const uint8_t *prev2Up;   // y - 2 in the frame before the field
+	const uint8_t *prev2Down; // y + 2 in the frame before the field
+	const uint8_t *next2Up;   // y - 2 in the frame after the field
+	const uint8_t *next2Down; // y + 2 in the frame after the field
+};
+
+void copyLine( uint8_t *dst, const uint8_t *src, int width )
+{
+	memcpy( dst, src, width );
+}
+
+void bobLine( uint8_t *dst, const uint8_t *above, const uint8_t *below, int width )
+{
+	int x = 0;
+#if USE_SSE2
+	for( ; x + 16 <= width; x += 16 ) {
+		const __m128i a = _mm_loadu_si128( (const __m128i *)( above + x ) );
+		const __m128i b = _mm_loadu_si128( (const __m128i *)( below + x ) );
+		_mm_storeu_si128( (__m128i *)( dst + x ), _mm_avg_epu8( a, b ) );
+	}
+#endif
+	for( ; x < width; ++x )
+		dst[x] = uint8_t( ( above[x] + below[x] + 1 ) >> 1 );
+}
+
+void blendLine( uint8_t *dst, const uint8_t *above, const uint8_t *line, const uint8_t *below, int width )
+{
+	// ( above + 2 * line + below ) / 4, rounded the same way as the vector path
+	int x = 0;
+#if USE_SSE2
+	for( ; x + 16 <= width; x += 16 ) {
+		const __m128i a = _mm_loadu_si128( (const __m128i *)( above + x ) );
+		const __m128i b = _mm_loadu_si128( (const __m128i *)( below + x ) );
+		const __m128i c = _mm_loadu_si128( (const __m128i *)( line + x ) );
+		_mm_storeu_si128( (__m128i *)( dst + x ), _mm_avg_epu8( _mm_avg_epu8( a, b ), c ) );
+	}
+#endif
+	for( ; x < width; ++x )
+		dst[x] = uint8_t( ( ( ( above[x] + below[x] + 1 ) >> 1 ) + line[x] + 1 ) >> 1 );
+}
+
+void yadifPixel( uint8_t *dst, const YadifLines &l, int x, int width )
+{
+	auto at = [width]( const uint8_t *line, int x ) { return int( line[std::min( std::max( x, 0 ), width - 1 )] ); };
+
+	const int c = l.curUp[x];
+	const int e = l.curDown[x];
+	const int d = ( l.prev2[x] + l.next2[x] ) >> 1;
+
+	const int temporalDiff0 = abs( l.prev2[x] - l.next2[x] );
+	const int temporalDiff1 = ( abs( l.prevUp[x] - c ) + abs( l.prevDown[x] - e ) ) >> 1;
+	const int temporalDiff2 = ( abs( l.nextUp[x] - c ) + abs( l.nextDown[x] - e ) ) >> 1;
+	int       diff = std::max( std::max( temporalDiff0 >> 1, temporalDiff1 ), temporalDiff2 );
+
+	int spatialPred = ( c + e ) >> 1;
+	int spatialScore = abs( at( l.curUp, x - 1 ) - at( l.curDown, x - 1 ) ) + abs( c - e ) + abs( at( l.curUp, x + 1 ) - at( l.curDown, x + 1 ) ) - 1;
+
+	// follow edges up to two pixels to either side, the wider check only if the narrower one matched
+	auto check = [&]( int j ) {
+		const int score = abs( at( l.curUp, x + j - 1 ) - at( l.curDown, x - j - 1 ) ) + abs( at( l.curUp, x + j ) - at( l.curDown, x - j ) ) + abs( at( l.curUp, x + j + 1 ) - at( l.curDown, x - j + 1 ) );
+		if( score >= spatialScore )
+			return false;
+
+		spatialScore = score;
+		spatialPred = ( at( l.curUp, x + j ) + at( l.curDown, x - j ) ) >> 1;
+		return true;
+	};
+	if( check( -1 ) )
+		check( -2 );
+	if( check( 1 ) )
+		check( 2 );
+
+	// spatial interlacing check
+	const int b = ( l.prev2Up[x] + l.next2Up[x] ) >> 1;
+	const int f = ( l.prev2Down[x] + l.next2Down[x] ) >> 1;
+	const int maxDiff = std::max( std::max( d - e, d - c ), std::min( b - c, f - e ) );
+	const int minDiff = std::min( std::min( d - e, d - c ), std::max( b - c, f - e ) );
+	diff = std::max( std::max( diff, minDiff ), -maxDiff );
+
+	dst[x] = uint8_t( std::min( std::max( spatialPred, d - diff ), d + diff ) );
+}
+
+#if USE_SSE2
+inline __m128i load8( const uint8_t *p )
+{
+	return _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)p ), _mm_setzero_si128() );
+}
+
+inline __m128i absDiff( __m128i a, __m128i b )
+{
+	return _mm_sub_epi16( _mm_max_epi16( a, b ), _mm_min_epi16( a, b ) );
+}
+
+inline __m128i average( __m128i a, __m128i b )
+{
+	return _mm_srai_epi16( _mm_add_epi16( a, b ), 1 );
+}
+
+inline __m128i select( __m128i mask, __m128i a, __m128i b )
+{
+	return _mm_or_si128( _mm_and_si128( mask, a ), _mm_andnot_si128( mask, b ) );
+}
+
+//! Edge-directed candidate at offset \a j for 8 pixels at \a x, mirrors the check in yadifPixel().
+inline __m128i checkEdge( const YadifLines &l, int x, int j, __m128i &spatialScore, __m128i &spatialPred, __m128i enabled )
+{
+	const __m128i score = _mm_add_epi16( _mm_add_epi16( absDiff( load8( l.curUp + x + j - 1 ), load8( l.curDown + x - j - 1 ) ),
+	                                                    absDiff( load8( l.curUp + x + j ), load8( l.curDown + x - j ) ) ),
+	                                     absDiff( load8( l.curUp + x + j + 1 ), load8( l.curDown + x - j + 1 ) ) );
+	const __m128i better = _mm_and_si128( enabled, _mm_cmplt_epi16( score, spatialScore ) );
+
+	spatialScore = select( better, score, spatialScore );
+	spatialPred = select( better, average( load8( l.curUp + x + j ), load8( l.curDown + x - j ) ), spatialPred );
+	return better;
+}
+#endif
+
+void yadifLine( uint8_t *dst, const YadifLines &l, int width )
+{
+	// the vector path reads up to three pixels to either side, the borders take the clamped scalar path
+	const int border = std::min( 3, width );
+	int       x = 0;
+	for( ; x < border; ++x )
+		yadifPixel( dst, l, x, width );
+
+#if USE_SSE2
+	const __m128i all = _mm_set1_epi16( -1 );
+	const __m128i one = _mm_set1_epi16( 1 );
+	for( ; x + 8 + 3 <= width; x += 8 ) {
+		const __m128i c = load8( l.curUp + x );
+		const __m128i e = load8( l.curDown + x );
+		const __m128i prev2 = load8( l.prev2 + x );
+		const __m128i next2 = load8( l.next2 + x );
+		const __m128i d = average( prev2, next2 );
+
+		const __m128i temporalDiff0 = _mm_srai_epi16( absDiff( prev2, next2 ), 1 );
+		const __m128i temporalDiff1 = average( absDiff( load8( l.prevUp + x ), c ), absDiff( load8( l.prevDown + x ), e ) );
+		const __m128i temporalDiff2 = average( absDiff( load8( l.nextUp + x ), c ), absDiff( load8( l.nextDown + x ), e ) );
+		__m128i       diff = _mm_max_epi16( _mm_max_epi16( temporalDiff0, temporalDiff1 ), temporalDiff2 );
+
+		__m128i spatialPred = average( c, e );
+		__m128i spatialScore = _mm_sub_epi16( _mm_add_epi16( _mm_add_epi16( absDiff( load8( l.curUp + x - 1 ), load8( l.curDown + x - 1 ) ), absDiff( c, e ) ),
+		                                                     absDiff( load8( l.curUp + x + 1 ), load8( l.curDown + x + 1 ) ) ),
+		                                      one );
+
+		checkEdge( l, x, -2, spatialScore, spatialPred, checkEdge( l, x, -1, spatialScore, spatialPred, all ) );
+		checkEdge( l, x, 2, spatialScore, spatialPred, checkEdge( l, x, 1, spatialScore, spatialPred, all ) );
+
+		const __m128i b = average( load8( l.prev2Up + x ), load8( l.next2Up + x ) );
+		const __m128i f = average( load8( l.prev2Down + x ), load8( l.next2Down + x ) );
+		const __m128i de = _mm_sub_epi16( d, e );
+		const __m128i dc = _mm_sub_epi16( d, c );
+		const __m128i bc = _mm_sub_epi16( b, c );
+		const __m128i fe = _mm_sub_epi16( f, e );
+		const __m128i maxDiff = _mm_max_epi16( _mm_max_epi16( de, dc ), _mm_min_epi16( bc, fe ) );
+		const __m128i minDiff = _mm_min_epi16( _mm_min_epi16( de, dc ), _mm_max_epi16( bc, fe ) );
+		diff = _mm_max_epi16( _mm_max_epi16( diff, minDiff ), _mm_sub_epi16( _mm_setzero_si128(), maxDiff ) );
+
+		const __m128i result = _mm_min_epi16( _mm_max_epi16( spatialPred, _mm_sub_epi16( d, diff ) ), _mm_add_epi16( d, diff ) );
+		_mm_storel_epi64( (__m128i *)( dst + x ), _mm_packus_epi16( result, result ) );
+	}
+#endif
+
+	for( ; x < width; ++x )
+		yadifPixel( dst, l, x, width );
+}
+
+} // namespace
+
+Deinterlacer::Deinterlacer( FramePool &pool, int numThreads )
+    : m_FramePool( pool )
+    , m_Mode( DEINTERLACE_YADIF )
+    , m_bFieldRate( false )
+    , m_pPrevious( NULL )
+    , m_pCurrent( NULL )
+    , m_CurrentPts( 0.0 )
+    , m_CurrentDuration( 0.0 )
+    , m_pJob( NULL )
+    , m_NumSlices( 0 )
+    , m_NextSlice( 0 )
+    , m_PendingSlices( 0 )
+    , m_bDone( false )
+{
+	if( numThreads <= 0 )
+		numThreads = std::min( std::max( 1, int( std::thread::hardware_concurrency() ) ), MAX_SLICE_THREADS );
+
+	// the calling thread filters a slice as well
+	for( int i = 1; i < numThreads; ++i )
+		m_Threads.emplace_back( &Deinterlacer::runWorker, this );
+}
+
+Deinterlacer::~Deinterlacer()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_bDone = true;
+	}
+	m_StartCondition.notify_all();
+
+	for( auto &thread : m_Threads )
+		thread.join();
+
+	flush();
+}
+
+void Deinterlacer::setMode( Mode mode )
+{
+	if( mode == m_Mode )
+		return;
+
+	flush();
+	m_Mode = mode;
+}
+
+bool Deinterlacer::accepts( const AVFrame *frame ) const
+{
+	return m_Mode != DEINTERLACE_WEAVE && frame->interlaced_frame && isSupportedFormat( frame->format );
+}
+
+void Deinterlacer::push( const AVFrame *frame, double pts, double duration )
+{
+	AVFrame *ref = av_frame_clone( frame );
+	if( !ref )
+		return;
+
+	if( m_Mode != DEINTERLACE_YADIF ) {
+		output( ref, ref, ref, pts, duration );
+		av_frame_free( &ref );
+		return;
+	}
+
+	// yadif looks one frame ahead, so the current frame is output once its successor arrives
+	if( m_pCurrent ) {
+		output( m_pPrevious ? m_pPrevious : m_pCurrent, m_pCurrent, ref, m_CurrentPts, m_CurrentDuration );
+		av_frame_free( &m_pPrevious );
+		m_pPrevious = m_pCurrent;
+	}
+
+	m_pCurrent = ref;
+	m_CurrentPts = pts;
+	m_CurrentDuration = duration;
+}
+
+bool Deinterlacer::pop( AVFrame *frame, double &pts )
+{
+	if( m_Output.empty() )
+		return false;
+
+	Output output = m_Output.front();
+	m_Output.pop_front();
+
+	av_frame_unref( frame );
+	av_frame_move_ref( frame, output.frame );
+	av_frame_free( &output.frame );
+
+	pts = output.pts;
+	return true;
+}
+
+void Deinterlacer::drain()
+{
+	// the last frame has no successor, so it looks ahead at itself
+	if( m_pCurrent )
+		output( m_pPrevious ? m_pPrevious : m_pCurrent, m_pCurrent, m_pCurrent, m_CurrentPts, m_CurrentDuration );
+
+	av_frame_free( &m_pPrevious );
+	av_frame_free( &m_pCurrent );
+}
+
+void Deinterlacer::flush()
+{
+	av_frame_free( &m_pPrevious );
+	av_frame_free( &m_pCurrent );
+
+	for( auto &output : m_Output )
+		av_frame_free( &output.frame );
+	m_Output.clear();
+}
+
+void Deinterlacer::output( const AVFrame *prev, const AVFrame *cur, const AVFrame *next, double pts, double duration )
+{
+	// neighbours from before a resolution change are of no use
+	if( !haveSameGeometry( prev, cur ) )
+		prev = cur;
+	if( !haveSameGeometry( next, cur ) )
+		next = cur;
+
+	const int numFields = m_bFieldRate && m_Mode != DEINTERLACE_BLEND ? 2 : 1;
+	const int firstField = cur->top_field_first ? 0 : 1;
+
+	for( int i = 0; i < numFields; ++i ) {
+		AVFrame *dst = av_frame_alloc();
+		dst->format = cur->format;
+		dst->width = cur->width;
+		dst->height = cur->height;
+
+		if( !m_FramePool.allocate( dst ) ) {
+			av_frame_free( &dst );
+			return;
+		}
+
+		av_frame_copy_props( dst, cur );
+		dst->interlaced_frame = 0;
+
+		const int  field = i == 0 ? firstField : 1 - firstField;
+		const bool secondField = i == 1;
+		runSlices( [&]( int slice, int numSlices ) { filter( dst, prev, cur, next, field, secondField, slice, numSlices ); } );
+
+		m_Output.push_back( Output{ dst, pts + i * 0.5 * duration } );
+	}
+}
+
+void Deinterlacer::filter( AVFrame *dst, const AVFrame *prev, const AVFrame *cur, const AVFrame *next, int field, bool secondField, int slice, int numSlices ) const
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get( AVPixelFormat( cur->format ) );
+	const int                 numPlanes = av_pix_fmt_count_planes( AVPixelFormat( cur->format ) );
+
+	// the temporal neighbours of the field, yadif interpolates between these
+	const AVFrame *prev2 = secondField ? cur : prev;
+	const AVFrame *next2 = secondField ? next : cur;
+
+	for( int plane = 0; plane < numPlanes; ++plane ) {
+		const bool isChroma = ( plane == 1 || plane == 2 ) && !( desc->flags & AV_PIX_FMT_FLAG_RGB );
+		const int  width = isChroma ? AV_CEIL_RSHIFT( cur->width, desc->log2_chroma_w ) : cur->width;
+		const int  height = isChroma ? AV_CEIL_RSHIFT( cur->height, desc->log2_chroma_h ) : cur->height;
+		const int  firstLine = height * slice / numSlices;
+		const int  lastLine = height * ( slice + 1 ) / numSlices;
+
+		auto line = [plane]( const AVFrame *frame, int y ) { return frame->data[plane] + y * frame->linesize[plane]; };
+
+		for( int y = firstLine; y < lastLine; ++y ) {
+			uint8_t *out = dst->data[plane] + y * dst->linesize[plane];
+			const int up = y > 0 ? y - 1 : y + 1;
+			const int down = y + 1 < height ? y + 1 : y - 1;
+
+			if( m_Mode == DEINTERLACE_BLEND ) {
+				blendLine( out, line( cur, std::max( y - 1, 0 ) ), line( cur, y ), line( cur, std::min( y + 1, height - 1 ) ), width );
+				continue;
+			}
+
+			if( ( y & 1 ) == field || up >= height || down < 0 ) {
+				copyLine( out, line( cur, y ), width );
+				continue;
+			}
+
+			if( m_Mode == DEINTERLACE_BOB ) {
+				bobLine( out, line( cur, up ), line( cur, down ), width );
+				continue;
+			}
+
+			const int  up2 = y >= 2 ? y - 2 : y;
+			const int  down2 = y + 2 < height ? y + 2 : y;
+			YadifLines lines = { line( cur, up ), line( cur, down ), line( prev, up ), line( prev, down ), line( next, up ), line( next, down ),
+				                 line( prev2, y ), line( next2, y ), line( prev2, up2 ), line( prev2, down2 ), line( next2, up2 ), line( next2, down2 ) };
+			yadifLine( out, lines, width );
+		}
+	}
+}
+
+void Deinterlacer::runSlices( const std::function<void( int slice, int numSlices )> &job )
+{
+	if( m_Threads.empty() ) {
+		job( 0, 1 );
+		return;
+	}
+
+	const int numSlices = int( m_Threads.size() ) + 1;
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_pJob = &job;
+		m_NumSlices = numSlices;
+		m_NextSlice = 0;
+		m_PendingSlices = numSlices;
+	}
+	m_StartCondition.notify_all();
+
+	std::unique_lock<std::mutex> lock( m_Mutex );
+	while( m_NextSlice < m_NumSlices ) {
+		const int slice = m_NextSlice++;
+		lock.unlock();
+		job( slice, numSlices );
+		lock.lock();
+		--m_PendingSlices;
+	}
+
+	m_DoneCondition.wait( lock, [this] { return m_PendingSlices == 0; } );
+	m_pJob = NULL;
+}
+
+void Deinterlacer::runWorker()
+{
+	std::unique_lock<std::mutex> lock( m_Mutex );
+	for( ;; ) {
+		m_StartCondition.wait( lock, [this] { return m_bDone || ( m_pJob && m_NextSlice < m_NumSlices ); } );
+		if( m_bDone )
+			return;
+
+		const int                                              slice = m_NextSlice++;
+		const int                                              numSlices = m_NumSlices;
+		const std::function<void( int slice, int numSlices )> *job = m_pJob;
+		lock.unlock();
+		( *job )( slice, numSlices );
+		lock.lock();
+
+		if( --m_PendingSlices == 0 )
+			m_DoneCondition.notify_all();
+	}
+}
@@ -0,0 +1,156 @@
+#include "cinder/App/App.h"
+
+#include "movierenderer/filtergraph.h"
+
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+
+extern "C" {
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/channel_layout.h>
+}
+
+using namespace std;
+
+FilterGraph::FilterGraph( const string &description, AVMediaType type, int numThreads )
+    : m_Description( description )
+    , m_Type( type )
+    , m_NumThreads( numThreads )
+    , m_pGraph( NULL )
+    , m_pSource( NULL )
+    , m_pSink( NULL )
+    , m_bConfigured( false )
+    , m_Format( -1 )
+    , m_Width( 0 )
+    , m_Height( 0 )
+    , m_SampleRate( 0 )
+    , m_ChannelLayout( 0 )
+{
+	if( m_Type != AVMEDIA_TYPE_VIDEO && m_Type != AVMEDIA_TYPE_AUDIO )
+		throw logic_error( "FilterGraph: Only video and audio graphs are supported" );
+}
+
+FilterGraph::~FilterGraph()
+{
+	reset();
+}
+
+bool FilterGraph::push( AVFrame *frame, double pts )
+{
+	// some decoders only set the channel count, the audio source wants a layout
+	if( m_Type == AVMEDIA_TYPE_AUDIO && !frame->channel_layout )
+		frame->channel_layout = av_get_default_channel_layout( frame->channels );
+
+	if( !m_bConfigured || !matches( frame ) ) {
+		if( !configure( frame ) )
+			return false;
+	}
+
+	if( !m_pGraph )
+		return false;
+
+	// the source runs in microseconds, which also keeps the half-frame steps of field-rate video
+	frame->pts = llrint( pts * AV_TIME_BASE );
+
+	return av_buffersrc_add_frame_flags( m_pSource, frame, AV_BUFFERSRC_FLAG_KEEP_REF ) >= 0;
+}
+
+bool FilterGraph::pull( AVFrame *frame, double &pts )
+{
+	if( !m_pGraph )
+		return false;
+
+	av_frame_unref( frame );
+	if( av_buffersink_get_frame( m_pSink, frame ) < 0 )
+		return false;
+
+	pts = frame->pts != AV_NOPTS_VALUE ? frame->pts * av_q2d( av_buffersink_get_time_base( m_pSink ) ) : 0.0;
+	return true;
+}
+
+void FilterGraph::reset()
+{
+	avfilter_graph_free( &m_pGraph );
+	m_pSource = NULL;
+	m_pSink = NULL;
+	m_bConfigured = false;
+}
+
+bool FilterGraph::matches( const AVFrame *frame ) const
+{
+	if( frame->format != m_Format )
+		return false;
+
+	if( m_Type == AVMEDIA_TYPE_VIDEO )
+		return frame->width == m_Width && frame->height == m_Height;
+
+	return frame->sample_rate == m_SampleRate && frame->channel_layout == m_ChannelLayout;
+}
+
+bool FilterGraph::configure( const AVFrame *frame )
+{
+	reset();
+
+	// remember the input format even if building fails, so that it is not retried for every frame
+	m_bConfigured = true;
+	m_Format = frame->format;
+	m_Width = frame->width;
+	m_Height = frame->height;
+	m_SampleRate = frame->sample_rate;
+	m_ChannelLayout = frame->channel_layout;
+
+	m_pGraph = avfilter_graph_alloc();
+	if( !m_pGraph )
+		return false;
+
+	m_pGraph->nb_threads = m_NumThreads;
+
+	char args[256];
+	if( m_Type == AVMEDIA_TYPE_VIDEO ) {
+		const AVRational aspect = frame->sample_aspect_ratio.num > 0 ? frame->sample_aspect_ratio : AVRational{ 1, 1 };
+		snprintf( args, sizeof( args ), "video_size=%dx%d:pix_fmt=%d:time_base=1/%d:pixel_aspect=%d/%d", frame->width, frame->height, frame->format, AV_TIME_BASE, aspect.num, aspect.den );
+	}
+	else {
+		snprintf( args, sizeof( args ), "time_base=1/%d:sample_rate=%d:sample_fmt=%s:channel_layout=0x%" PRIx64, AV_TIME_BASE, frame->sample_rate, av_get_sample_fmt_name( AVSampleFormat( frame->format ) ), frame->channel_layout );
+	}
+
+	const bool isVideo = m_Type == AVMEDIA_TYPE_VIDEO;
+
+	AVFilterInOut *outputs = avfilter_inout_alloc();
+	AVFilterInOut *inputs = avfilter_inout_alloc();
+
+	bool success = outputs && inputs
+	               && avfilter_graph_create_filter( &m_pSource, avfilter_get_by_name( isVideo ? "buffer" : "abuffer" ), "in", args, NULL, m_pGraph ) >= 0
+	               && avfilter_graph_create_filter( &m_pSink, avfilter_get_by_name( isVideo ? "buffersink" : "abuffersink" ), "out", NULL, NULL, m_pGraph ) >= 0;
+
+	if( success ) {
+		// the open ends of the description connect to our source and sink
+		outputs->name = av_strdup( "in" );
+		outputs->filter_ctx = m_pSource;
+		outputs->pad_idx = 0;
+		outputs->next = NULL;
+
+		inputs->name = av_strdup( "out" );
+		inputs->filter_ctx = m_pSink;
+		inputs->pad_idx = 0;
+		inputs->next = NULL;
+
+		success = avfilter_graph_parse_ptr( m_pGraph, m_Description.c_str(), &inputs, &outputs, NULL ) >= 0 && avfilter_graph_config( m_pGraph, NULL ) >= 0;
+	}
+
+	avfilter_inout_free( &inputs );
+	avfilter_inout_free( &outputs );
+
+	if( !success ) {
+		ci::app::console() << "FilterGraph: Could not build filter graph \"" << m_Description << "\"" << endl;
+
+		avfilter_graph_free( &m_pGraph );
+		m_pSource = NULL;
+		m_pSink = NULL;
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,191 @@
+#include "movierenderer/framepool.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#if defined( _WIN32 )
+#include <malloc.h>
+#elif defined( __linux__ )
+#include <sys/mman.h>
+#endif
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+#define MAX_POOLS 4
+#define HUGE_PAGE_SIZE ( 2 * 1024 * 1024 )
+
+FramePool::FramePool()
+    : m_UseCount( 0 )
+    , m_bUseHugePages( false )
+{
+}
+
+FramePool::~FramePool()
+{
+	clear();
+}
+
+void FramePool::clear()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	for( auto &entry : m_Pools )
+		av_buffer_pool_uninit( &entry.second.pool );
+
+	m_Pools.clear();
+}
+
+int FramePool::getBuffer( AVCodecContext *context, AVFrame *frame, int flags )
+{
+	FramePool *pool = static_cast<FramePool *>( context->opaque );
+
+	if( !pool || !( context->codec->capabilities & AV_CODEC_CAP_DR1 ) || !av_pix_fmt_desc_get( AVPixelFormat( frame->format ) ) )
+		return avcodec_default_get_buffer2( context, frame, flags );
+
+	int width = frame->width;
+	int height = frame->height;
+	int strideAlign[AV_NUM_DATA_POINTERS];
+	avcodec_align_dimensions2( context, &width, &height, strideAlign );
+
+	if( !pool->allocate( frame, width, height, strideAlign ) )
+		return avcodec_default_get_buffer2( context, frame, flags );
+
+	return 0;
+}
+
+bool FramePool::allocate( AVFrame *frame )
+{
+	return allocate( frame, frame->width, frame->height, nullptr );
+}
+
+bool FramePool::allocate( AVFrame *frame, int alignedWidth, int alignedHeight, const int *strideAlign )
+{
+	const AVPixelFormat format = AVPixelFormat( frame->format );
+
+	AVBufferRef *buffer = nullptr;
+	int          lineSize[4] = {};
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+
+		const Key key = { format, alignedWidth, alignedHeight };
+
+		auto itr = m_Pools.find( key );
+		if( itr == m_Pools.end() ) {
+			Pool entry;
+			entry.lastUsed = ++m_UseCount;
+
+			if( av_image_fill_linesizes( entry.lineSize, format, alignedWidth ) < 0 )
+				return false;
+
+			for( int i = 0; i < 4; ++i ) {
+				const int align = strideAlign ? std::max( ALIGNMENT, strideAlign[i] ) : ALIGNMENT;
+				entry.lineSize[i] = FFALIGN( entry.lineSize[i], align );
+			}
+
+			// because every stride is a multiple of the alignment, so is the offset of every plane
+			uint8_t *data[4] = {};
+			const int size = av_image_fill_pointers( data, format, alignedHeight, nullptr, entry.lineSize );
+			if( size < 0 )
+				return false;
+
+			// decoders may read (but not write) a few bytes past the end of the last plane
+			entry.size = size + 16 + ALIGNMENT - 1;
+			entry.pool = av_buffer_pool_init2( entry.size, this, &FramePool::allocBuffer, nullptr );
+			if( !entry.pool )
+				return false;
+
+			itr = m_Pools.insert( std::make_pair( key, entry ) ).first;
+			evictUnusedPools();
+		}
+
+		Pool &pool = itr->second;
+		pool.lastUsed = ++m_UseCount;
+
+		buffer = av_buffer_pool_get( pool.pool );
+		std::copy( pool.lineSize, pool.lineSize + 4, lineSize );
+	}
+
+	if( !buffer )
+		return false;
+
+	uint8_t *data[4] = {};
+	av_image_fill_pointers( data, format, alignedHeight, buffer->data, lineSize );
+
+	for( int i = 0; i < 4; ++i ) {
+		frame->data[i] = data[i];
+		frame->linesize[i] = lineSize[i];
+	}
+
+	frame->buf[0] = buffer;
+	frame->extended_data = frame->data;
+
+	return true;
+}
+
+void FramePool::evictUnusedPools()
+{
+	// only keep the most recently used resolutions around
+	while( m_Pools.size() > MAX_POOLS ) {
+		auto oldest = m_Pools.begin();
+		for( auto itr = m_Pools.begin(); itr != m_Pools.end(); ++itr ) {
+			if( itr->second.lastUsed < oldest->second.lastUsed )
+				oldest = itr;
+		}
+
+		av_buffer_pool_uninit( &oldest->second.pool );
+		m_Pools.erase( oldest );
+	}
+}
+
+AVBufferRef *FramePool::allocBuffer( void *opaque, int size )
+{
+	const FramePool *pool = static_cast<const FramePool *>( opaque );
+
+	size_t alignment = ALIGNMENT;
+	size_t allocated = size_t( size );
+
+#if defined( __linux__ )
+	// transparent huge pages require the allocation to be aligned to (and a multiple of) the huge page size
+	if( pool->m_bUseHugePages && allocated >= HUGE_PAGE_SIZE ) {
+		alignment = HUGE_PAGE_SIZE;
+		allocated = FFALIGN( allocated, HUGE_PAGE_SIZE );
+	}
+#else
+	(void)pool;
+#endif
+
+#if defined( _WIN32 )
+	uint8_t *data = static_cast<uint8_t *>( _aligned_malloc( allocated, alignment ) );
+#else
+	void *memory = nullptr;
+	if( posix_memalign( &memory, alignment, allocated ) != 0 )
+		memory = nullptr;
+	uint8_t *data = static_cast<uint8_t *>( memory );
+#endif
+
+	if( !data )
+		return nullptr;
+
+#if defined( __linux__ ) && defined( MADV_HUGEPAGE )
+	if( alignment == HUGE_PAGE_SIZE )
+		madvise( data, allocated, MADV_HUGEPAGE );
+#endif
+
+	AVBufferRef *buffer = av_buffer_create( data, size, &FramePool::freeBuffer, nullptr, 0 );
+	if( !buffer )
+		freeBuffer( nullptr, data );
+
+	return buffer;
+}
+
+void FramePool::freeBuffer( void *, uint8_t *data )
+{
+#if defined( _WIN32 )
+	_aligned_free( data );
+#else
+	free( data );
+#endif
+}
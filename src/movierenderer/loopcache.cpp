@@ -0,0 +1,245 @@
+#include "movierenderer/loopcache.h"
+#include "audiorenderer/audioframe.h"
+
+#include <cstring>
+
+LoopCache::LoopCache( size_t maxBytes, bool compress )
+    : m_NextVideoFrame( 0 )
+    , m_NextAudioFrame( 0 )
+    , m_Size( 0 )
+    , m_MaxSize( maxBytes )
+    , m_bCompress( compress )
+    , m_bVideoComplete( false )
+    , m_bAudioComplete( false )
+    , m_pEncoderContext( nullptr )
+    , m_pDecoderContext( nullptr )
+    , m_pDecodedFrame( nullptr )
+{
+}
+
+LoopCache::~LoopCache()
+{
+	clear();
+}
+
+void LoopCache::clear()
+{
+	for( auto &cached : m_VideoFrames ) {
+		if( cached.packet )
+			av_packet_free( &cached.packet );
+	}
+
+	// swap to actually give the memory back
+	std::vector<CachedVideoFrame>().swap( m_VideoFrames );
+	std::vector<CachedAudioFrame>().swap( m_AudioFrames );
+
+	closeCodecs();
+
+	m_NextVideoFrame = 0;
+	m_NextAudioFrame = 0;
+	m_Size = 0;
+	m_bVideoComplete = false;
+	m_bAudioComplete = false;
+}
+
+bool LoopCache::addVideoFrame( const VideoFrame &frame )
+{
+	if( m_bVideoComplete || !frame.isValid() )
+		return false;
+
+	CachedVideoFrame cached;
+	cached.format = frame.getPixelFormat();
+	cached.pts = frame.getPts();
+
+	size_t size = 0;
+	if( m_bCompress && frame.getPixelFormat() != VideoFrame::PIXEL_FORMAT_RGBA ) {
+		if( !encode( frame, cached ) ) {
+			clear();
+			return false;
+		}
+
+		size = cached.packet->size;
+	}
+	else {
+		// just keep a reference to the decoded buffers
+		cached.frame = frame;
+		for( int i = 0; i < frame.getNumPlanes(); ++i )
+			size += size_t( frame.getPlane( i ).lineSize ) * frame.getPlane( i ).height;
+	}
+
+	if( m_Size + size > m_MaxSize ) {
+		if( cached.packet )
+			av_packet_free( &cached.packet );
+
+		clear();
+		return false;
+	}
+
+	m_Size += size;
+	m_VideoFrames.push_back( std::move( cached ) );
+
+	return true;
+}
+
+bool LoopCache::addAudioFrame( const AudioFrame &frame )
+{
+	if( m_bAudioComplete || !frame.getFrameData() )
+		return false;
+
+	if( m_Size + frame.getDataSize() > m_MaxSize ) {
+		clear();
+		return false;
+	}
+
+	CachedAudioFrame cached;
+	cached.data.assign( frame.getFrameData(), frame.getFrameData() + frame.getDataSize() );
+	cached.pts = frame.getPts();
+
+	m_Size += cached.data.size();
+	m_AudioFrames.push_back( std::move( cached ) );
+
+	return true;
+}
+
+bool LoopCache::nextVideoFrame( VideoFrame &frame )
+{
+	if( !m_bVideoComplete )
+		return false;
+
+	if( m_NextVideoFrame >= m_VideoFrames.size() )
+		m_NextVideoFrame = 0;
+
+	const CachedVideoFrame &cached = m_VideoFrames[m_NextVideoFrame++];
+	if( cached.packet )
+		return decode( cached, frame );
+
+	frame = cached.frame;
+	return true;
+}
+
+bool LoopCache::nextAudioFrame( AudioFrame &frame )
+{
+	if( !m_bAudioComplete )
+		return false;
+
+	if( m_NextAudioFrame >= m_AudioFrames.size() )
+		m_NextAudioFrame = 0;
+
+	const CachedAudioFrame &cached = m_AudioFrames[m_NextAudioFrame++];
+	frame.setDataSize( uint32( cached.data.size() ) );
+	frame.setFrameData( const_cast<byte *>( cached.data.data() ) );
+	frame.setPts( cached.pts );
+
+	return true;
+}
+
+void LoopCache::seek( double seconds )
+{
+	m_NextVideoFrame = 0;
+	while( m_NextVideoFrame < m_VideoFrames.size() && m_VideoFrames[m_NextVideoFrame].pts < seconds )
+		++m_NextVideoFrame;
+
+	m_NextAudioFrame = 0;
+	while( m_NextAudioFrame < m_AudioFrames.size() && m_AudioFrames[m_NextAudioFrame].pts < seconds )
+		++m_NextAudioFrame;
+}
+
+bool LoopCache::openCodecs( const AVFrame *frame )
+{
+	AVCodec *encoder = avcodec_find_encoder( AV_CODEC_ID_FFVHUFF );
+	AVCodec *decoder = avcodec_find_decoder( AV_CODEC_ID_FFVHUFF );
+	if( !encoder || !decoder )
+		return false;
+
+	m_pEncoderContext = avcodec_alloc_context3( encoder );
+	if( !m_pEncoderContext )
+		return false;
+
+	m_pEncoderContext->width = frame->width;
+	m_pEncoderContext->height = frame->height;
+	m_pEncoderContext->pix_fmt = AVPixelFormat( frame->format );
+	m_pEncoderContext->time_base = av_make_q( 1, 1000 );
+	m_pEncoderContext->thread_count = 0;
+
+	if( avcodec_open2( m_pEncoderContext, encoder, NULL ) < 0 )
+		return false;
+
+	m_pDecoderContext = avcodec_alloc_context3( decoder );
+	if( !m_pDecoderContext )
+		return false;
+
+	m_pDecoderContext->width = frame->width;
+	m_pDecoderContext->height = frame->height;
+	m_pDecoderContext->pix_fmt = AVPixelFormat( frame->format );
+	m_pDecoderContext->thread_count = 0;
+
+	// the Huffman tables are stored in the extradata
+	if( m_pEncoderContext->extradata_size > 0 ) {
+		m_pDecoderContext->extradata = static_cast<uint8_t *>( av_mallocz( m_pEncoderContext->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE ) );
+		if( !m_pDecoderContext->extradata )
+			return false;
+
+		memcpy( m_pDecoderContext->extradata, m_pEncoderContext->extradata, m_pEncoderContext->extradata_size );
+		m_pDecoderContext->extradata_size = m_pEncoderContext->extradata_size;
+	}
+
+	if( avcodec_open2( m_pDecoderContext, decoder, NULL ) < 0 )
+		return false;
+
+	m_pDecodedFrame = av_frame_alloc();
+	return m_pDecodedFrame != nullptr;
+}
+
+void LoopCache::closeCodecs()
+{
+	if( m_pEncoderContext )
+		avcodec_free_context( &m_pEncoderContext );
+
+	if( m_pDecoderContext )
+		avcodec_free_context( &m_pDecoderContext );
+
+	if( m_pDecodedFrame )
+		av_frame_free( &m_pDecodedFrame );
+}
+
+bool LoopCache::encode( const VideoFrame &frame, CachedVideoFrame &cached )
+{
+	const AVFrame *source = frame.getAVFrame();
+
+	if( !m_pEncoderContext && !openCodecs( source ) ) {
+		closeCodecs();
+		return false;
+	}
+
+	// every frame of a pass must have the same layout
+	if( source->width != m_pEncoderContext->width || source->height != m_pEncoderContext->height || source->format != m_pEncoderContext->pix_fmt )
+		return false;
+
+	cached.packet = av_packet_alloc();
+	if( !cached.packet )
+		return false;
+
+	// Huffyuv is intra-only, so every frame produces exactly one packet
+	if( avcodec_send_frame( m_pEncoderContext, source ) < 0 || avcodec_receive_packet( m_pEncoderContext, cached.packet ) < 0 ) {
+		av_packet_free( &cached.packet );
+		return false;
+	}
+
+	return true;
+}
+
+bool LoopCache::decode( const CachedVideoFrame &cached, VideoFrame &frame )
+{
+	if( !m_pDecoderContext )
+		return false;
+
+	if( avcodec_send_packet( m_pDecoderContext, cached.packet ) < 0 || avcodec_receive_frame( m_pDecoderContext, m_pDecodedFrame ) < 0 )
+		return false;
+
+	const bool result = frame.reference( m_pDecodedFrame, cached.format );
+	av_frame_unref( m_pDecodedFrame );
+
+	frame.setPts( cached.pts );
+
+	return result;
+}
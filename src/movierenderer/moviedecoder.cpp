@@ -4,10 +4,13 @@
 #include "movierenderer/moviedecoder.h"
 #include "movierenderer/videoframe.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 
 extern "C" {
 #include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
 #include <libswscale/swscale.h>
 }
 
@@ -15,6 +18,16 @@ extern "C" {
 #define AUDIO_QUEUESIZE 50
 #define VIDEO_FRAMES_BUFFERSIZE 5
 
+// number of consecutive updates before the adaptive decoding policy escalates or steps back down
+#define DEGRADATION_ESCALATE_UPDATES 3
+#define DEGRADATION_RECOVER_UPDATES 120
+
+// frames are only downscaled after decoding if they are at least this much larger than shown
+#define DOWNSCALE_THRESHOLD 1.5
+
+// number of frames kept by getFrameAt()
+#define RANDOM_ACCESS_CACHE_SIZE 32
+
 using namespace std;
 //using namespace boost;
 
@@ -25,6 +38,7 @@ void MovieDecoder::startFFmpeg()
 		libavcodec_initialized = true;
 		av_register_all();
 		avcodec_register_all();
+		avfilter_register_all();
 	}
 }
 
@@ -40,7 +54,8 @@ MovieDecoder::MovieDecoder( const string &filename )
     , m_pAudioStream( NULL )
     , m_pFrame( NULL )
     , m_pConvertedFrame( NULL )
-    , m_pSwrContext( NULL )
+    , m_pAudioFrame( NULL )
+    , m_pSwsContext( NULL )
     , m_MaxVideoQueueSize( VIDEO_QUEUESIZE )
     , m_MaxAudioQueueSize( AUDIO_QUEUESIZE )
     , m_pPacketReaderThread( NULL )
@@ -51,8 +66,40 @@ MovieDecoder::MovieDecoder( const string &filename )
     , m_bLoop( false )
     , m_bDone( false )
     , m_bSeeking( false )
+    , m_bEndOfStream( false )
     , m_AudioClock( 0.0 )
     , m_VideoClock( 0.0 )
+    , m_bAdaptiveDecoding( false )
+    , m_DegradationLevel( DEGRADATION_NONE )
+    , m_LaggingUpdates( 0 )
+    , m_HeadroomUpdates( 0 )
+    , m_CatchUpThreshold( 1.0 )
+    , m_bCatchingUp( false )
+    , m_bWaitForKeyFrame( false )
+    , m_bPaletteHasAlpha( false )
+    , m_bVisible( true )
+    , m_TargetWidth( 0 )
+    , m_TargetHeight( 0 )
+    , m_VideoSeekTarget( -1.0 )
+    , m_AudioSeekTarget( -1.0 )
+    , m_bHibernating( false )
+    , m_bWasStarted( false )
+    , m_bWasPaused( false )
+    , m_HibernatePosition( 0.0 )
+    , m_bRecordingVideo( false )
+    , m_bRecordingAudio( false )
+    , m_bVideoFromCache( false )
+    , m_bAudioFromCache( false )
+    , m_LastCachedVideoPts( -1.0 )
+    , m_LastCachedAudioPts( -1.0 )
+    , m_bRecordingPackets( false )
+    , m_FrameCache( RANDOM_ACCESS_CACHE_SIZE )
+    , m_RandomAccessFrame( -1 )
+    , m_bRandomAccessed( false )
+    , m_DeinterlaceMode( Deinterlacer::DEINTERLACE_YADIF )
+    , m_bDeinterlaceFieldRate( false )
+    , m_AudioOutputSampleRate( 0 )
+    , m_AudioOutputChannels( 0 )
 {
 	m_bInitialized = false;
 
@@ -62,6 +109,10 @@ MovieDecoder::MovieDecoder( const string &filename )
 	m_FlushPacket.data = (uint8_t *)"FLUSH";
 	m_FlushPacket.size = strlen( reinterpret_cast<const char *>( m_FlushPacket.data ) );
 
+	av_init_packet( &m_EndOfStreamPacket );
+	m_EndOfStreamPacket.data = (uint8_t *)"EOS";
+	m_EndOfStreamPacket.size = strlen( reinterpret_cast<const char *>( m_EndOfStreamPacket.data ) );
+
 #if LIBAVCODEC_VERSION_MAJOR < 53
 	if( av_open_input_file( &m_pFormatContext, filename.c_str(), NULL, 0, NULL ) != 0 )
 #else
@@ -109,15 +160,11 @@ MovieDecoder::~MovieDecoder()
 		m_pFrame = NULL;
 	}
 
-	if( m_pVideoCodecContext ) {
-		avcodec_close( m_pVideoCodecContext );
-		m_pVideoCodecContext = NULL;
-	}
+	if( m_pAudioFrame )
+		av_frame_free( &m_pAudioFrame );
 
-	if( m_pAudioCodecContext ) {
-		avcodec_close( m_pAudioCodecContext );
-		m_pAudioCodecContext = NULL;
-	}
+	freeCodecContext( m_pVideoCodecContext, m_pVideoStream );
+	freeCodecContext( m_pAudioCodecContext, m_pAudioStream );
 
 	if( m_pFormatContext ) {
 #if LIBAVCODEC_VERSION_MAJOR < 53
@@ -128,8 +175,12 @@ MovieDecoder::~MovieDecoder()
 #endif
 	}
 
-	if( m_pSwrContext )
-		swr_free( &m_pSwrContext );
+	m_AudioResampler.reset();
+
+	if( m_pSwsContext ) {
+		sws_freeContext( m_pSwsContext );
+		m_pSwsContext = NULL;
+	}
 }
 
 bool MovieDecoder::initializeVideo()
@@ -164,6 +215,10 @@ bool MovieDecoder::initializeVideo()
 	}
 
 	m_pVideoCodecContext->workaround_bugs = 1;
+	m_pVideoCodecContext->refcounted_frames = 1; // decoded frames are shared with VideoFrame
+	m_pVideoCodecContext->opaque = &m_FramePool;
+	m_pVideoCodecContext->get_buffer2 = &FramePool::getBuffer;
+	m_pVideoCodecContext->thread_safe_callbacks = 1;
 	m_pFormatContext->flags |= AVFMT_FLAG_GENPTS;
 
 #if LIBAVCODEC_VERSION_MAJOR < 53
@@ -213,6 +268,8 @@ bool MovieDecoder::initializeAudio()
 	}
 
 	m_pAudioCodecContext->workaround_bugs = 1;
+	m_AudioBuffer.resize( MAX_AUDIO_FRAME_SIZE * 4 );
+	m_pAudioFrame = av_frame_alloc();
 
 #if LIBAVCODEC_VERSION_MAJOR < 53
 	if( avcodec_open( m_pAudioCodecContext, m_pAudioCodec ) < 0 )
@@ -229,12 +286,73 @@ bool MovieDecoder::initializeAudio()
 
 int MovieDecoder::getFrameHeight() const
 {
-	return m_pVideoCodecContext ? m_pVideoCodecContext->height : -1;
+	// the codec context reports the reduced size while decoding at lowres
+	return m_pVideoStream ? m_pVideoStream->codecpar->height : -1;
 }
 
 int MovieDecoder::getFrameWidth() const
 {
-	return m_pVideoCodecContext ? m_pVideoCodecContext->width : -1;
+	return m_pVideoStream ? m_pVideoStream->codecpar->width : -1;
+}
+
+bool MovieDecoder::hasAlpha() const
+{
+	if( !m_pVideoCodecContext )
+		return false;
+
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get( m_pVideoCodecContext->pix_fmt );
+	if( !desc )
+		return false;
+
+	// whether a palette is transparent is only known once a frame has been decoded
+	if( desc->flags & AV_PIX_FMT_FLAG_PAL )
+		return m_bPaletteHasAlpha;
+
+	return ( desc->flags & AV_PIX_FMT_FLAG_ALPHA ) != 0;
+}
+
+bool MovieDecoder::hasAlpha( const AVFrame *frame, PaletteAlpha &cache )
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get( AVPixelFormat( frame->format ) );
+	if( !desc )
+		return false;
+
+	if( desc->flags & AV_PIX_FMT_FLAG_ALPHA )
+		return true;
+
+	if( !( desc->flags & AV_PIX_FMT_FLAG_PAL ) || !frame->data[1] )
+		return false;
+
+	// most movies keep one palette throughout, so the entries are only looked at again when it changes
+	if( cache.palette.size() == AVPALETTE_SIZE && memcmp( cache.palette.data(), frame->data[1], AVPALETTE_SIZE ) == 0 )
+		return cache.hasAlpha;
+
+	cache.palette.assign( frame->data[1], frame->data[1] + AVPALETTE_SIZE );
+	cache.hasAlpha = false;
+
+	// palettes are stored as native endian ARGB
+	const uint32_t *palette = reinterpret_cast<const uint32_t *>( frame->data[1] );
+	for( int i = 0; i < AVPALETTE_COUNT && !cache.hasAlpha; ++i )
+		cache.hasAlpha = ( palette[i] >> 24 ) != 0xff;
+
+	return cache.hasAlpha;
+}
+
+AVPixelFormat MovieDecoder::getTargetPixelFormat( AVPixelFormat source )
+{
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get( source );
+	if( !desc )
+		return AV_PIX_FMT_YUV420P;
+
+	// RGB and paletted sources are uploaded as packed RGBA, there is no point in converting them to YUV and back.
+	// Opaque ones are converted with an opaque alpha channel, see hasAlpha().
+	if( desc->flags & ( AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL ) )
+		return AV_PIX_FMT_RGBA;
+
+	if( desc->flags & AV_PIX_FMT_FLAG_ALPHA )
+		return AV_PIX_FMT_YUVA420P;
+
+	return AV_PIX_FMT_YUV420P;
 }
 
 double MovieDecoder::getVideoClock() const
@@ -267,10 +385,10 @@ uint64_t MovieDecoder::getNumberOfFrames() const
 	return m_pVideoStream ? m_pVideoStream->nb_frames : 0;
 }
 
-void MovieDecoder::seekToTime( double seconds )
+void MovieDecoder::seekToTime( double seconds, bool accurate )
 {
 	m_SeekTimestamp = ::int64_t( AV_TIME_BASE * seconds );
-	m_SeekFlags = ( seconds < m_AudioClock ) ? AVSEEK_FLAG_BACKWARD : 0;
+	m_SeekFlags = ( accurate || seconds < m_AudioClock ) ? AVSEEK_FLAG_BACKWARD : 0;
 
 	if( m_SeekTimestamp < 0 )
 		m_SeekTimestamp = 0;
@@ -280,8 +398,17 @@ void MovieDecoder::seekToTime( double seconds )
 	m_AudioClock = double( m_SeekTimestamp ) / AV_TIME_BASE;
 	m_VideoClock = m_AudioClock;
 
+	// frames before the requested position are decoded, but not returned
+	m_VideoSeekTarget = accurate ? m_VideoClock : -1.0;
+	m_AudioSeekTarget = accurate ? m_AudioClock : -1.0;
+
 	m_bSingleFrame = !m_bPlaying;
 	m_bSeeking = true;
+
+	// nothing decoded before the seek may be shown after it
+	resetVideoFilters();
+
+	resetLoopCache( m_AudioClock );
 }
 
 void MovieDecoder::seekToFrame( uint32_t frame )
@@ -294,88 +421,309 @@ void MovieDecoder::seekToFrame( uint32_t frame )
 	seekToTime( seconds );
 }
 
+bool MovieDecoder::getFrameAtTime( double seconds, VideoFrame &frame )
+{
+	if( seconds < 0.0 )
+		return false;
+
+	return getFrameAt( uint32_t( seconds * getFramesPerSecond() + 0.001 ), frame );
+}
+
+bool MovieDecoder::getFrameAt( uint32_t frameNumber, VideoFrame &frame )
+{
+	// the reader thread owns the demuxer during playback
+	if( !m_bHasVideo || m_bHibernating || m_pPacketReaderThread )
+		return false;
+
+	if( const VideoFrame *cached = m_FrameCache.get( frameNumber ) ) {
+		frame = *cached;
+		return true;
+	}
+
+	const double fps = getFramesPerSecond();
+	if( fps <= 0.0 )
+		return false;
+
+	const double  timeBase = av_q2d( m_pVideoStream->time_base );
+	const int64_t startTime = ( m_pVideoStream->start_time != AV_NOPTS_VALUE ) ? m_pVideoStream->start_time : 0;
+	const int64_t target = startTime + llrint( frameNumber / ( fps * timeBase ) );
+
+	m_bRandomAccessed = true;
+
+	// decoding forward is cheaper than seeking as long as there is no keyframe between the decoder's position and the target
+	bool seek = true;
+	if( m_RandomAccessFrame >= 0 && m_RandomAccessFrame < int64_t( frameNumber ) ) {
+		const int     entry = av_index_search_timestamp( m_pVideoStream, target, AVSEEK_FLAG_BACKWARD );
+		const int64_t keyFrame = ( entry >= 0 ) ? m_pVideoStream->index_entries[entry].timestamp : startTime;
+
+		seek = llrint( ( keyFrame - startTime ) * timeBase * fps ) > m_RandomAccessFrame;
+	}
+
+	if( seek ) {
+		if( av_seek_frame( m_pFormatContext, m_VideoStream, target, AVSEEK_FLAG_BACKWARD ) < 0 )
+			return false;
+
+		std::lock_guard<std::mutex> lock( m_DecodeVideoMutex );
+		avcodec_flush_buffers( m_pVideoCodecContext );
+	}
+
+	m_RandomAccessFrame = -1;
+
+	AVPacket packet;
+	bool     endOfFile = false;
+	while( true ) {
+		if( !endOfFile && av_read_frame( m_pFormatContext, &packet ) < 0 )
+			endOfFile = true;
+
+		if( endOfFile ) {
+			// drain the frames still buffered by the codec
+			av_init_packet( &packet );
+			packet.data = NULL;
+			packet.size = 0;
+		}
+		else if( packet.stream_index != m_VideoStream ) {
+			av_free_packet( &packet );
+			continue;
+		}
+
+		if( !decodeVideoPacket( packet ) ) {
+			if( endOfFile )
+				break;
+
+			continue;
+		}
+
+		const int64_t pts = ( m_pFrame->best_effort_timestamp != AV_NOPTS_VALUE ) ? m_pFrame->best_effort_timestamp : target;
+		const int64_t index = llrint( ( pts - startTime ) * timeBase * fps );
+
+		VideoFrame decoded;
+		if( !outputVideoFrame( decoded ) )
+			break;
+
+		decoded.setPts( pts * timeBase );
+		m_FrameCache.put( index, decoded );
+
+		if( index >= int64_t( frameNumber ) ) {
+			// a drained codec has to be flushed before it can be used again
+			m_RandomAccessFrame = endOfFile ? -1 : index;
+
+			frame = decoded;
+			return true;
+		}
+
+		if( !endOfFile )
+			m_RandomAccessFrame = index;
+	}
+
+	m_RandomAccessFrame = -1;
+	return false;
+}
+
 bool MovieDecoder::decodeVideoFrame( VideoFrame &frame )
 {
-	if( !m_bHasVideo )
+	if( !m_bHasVideo || m_bHibernating )
 		return false;
 
+	if( m_bVideoFromCache ) {
+		if( !m_bPlaying && !m_bSingleFrame )
+			return false;
+
+		std::lock_guard<std::mutex> lock( m_LoopCacheMutex );
+		if( !m_pLoopCache || !m_pLoopCache->nextVideoFrame( frame ) )
+			return false;
+
+		m_bSingleFrame = false;
+		m_VideoClock = frame.getPts();
+		return true;
+	}
+
 	AVPacket packet;
 	bool     frameDecoded = false;
+	double   pts = 0.0;
+
+	while( !frameDecoded ) {
+		// a seek invalidates the frames held by the filter graph and the deinterlacer, so it goes first
+		if( popVideoFlushPacket() ) {
+			avcodec_flush_buffers( m_pVideoCodecContext );
+			resetVideoFilters();
+			continue;
+		}
+
+		// the filter graph may output several frames per input frame
+		if( pullFilteredFrame( m_pVideoFilter, m_VideoFilterMutex, m_pFrame, pts ) ) {
+			frameDecoded = true;
+			break;
+		}
+
+		// at field rate, the deinterlacer holds on to the second field of the last frame
+		if( m_pDeinterlacer && m_pDeinterlacer->pop( m_pFrame, pts ) ) {
+			frameDecoded = filterFrame( m_pVideoFilter, m_VideoFilterMutex, m_pFrame, pts );
+			continue;
+		}
 
-	do {
 		if( !popVideoPacket( &packet ) )
 			return false;
 
 		// handle flush packets
 		if( packet.data == m_FlushPacket.data ) {
-			avcodec_flush_buffers( m_pFormatContext->streams[m_VideoStream]->codec );
+			avcodec_flush_buffers( m_pVideoCodecContext );
+			resetVideoFilters();
+			continue;
+		}
+
+		// the last frame of the stream is still held back by yadif
+		if( packet.data == m_EndOfStreamPacket.data ) {
+			if( m_pDeinterlacer )
+				m_pDeinterlacer->drain();
 			continue;
 		}
 
+		if( m_bWaitForKeyFrame ) {
+			if( !( packet.flags & AV_PKT_FLAG_KEY ) ) {
+				freePacket( packet );
+				continue;
+			}
+
+			m_bWaitForKeyFrame = false;
+		}
+
 		frameDecoded = decodeVideoPacket( packet );
-	} while( !frameDecoded );
+		pts = packet.dts * av_q2d( m_pVideoStream->time_base );
+
+		// after an accurate seek, skip frames up to the requested position
+		if( frameDecoded && m_VideoSeekTarget >= 0.0 ) {
+			const double fps = getFramesPerSecond();
+			const double halfFrame = fps > 0.0 ? 0.5 / fps : 0.0;
+
+			if( pts < m_VideoSeekTarget - halfFrame )
+				frameDecoded = false;
+			else
+				m_VideoSeekTarget = -1.0;
+		}
+
+		if( frameDecoded && m_pFrame->interlaced_frame && m_DeinterlaceMode != Deinterlacer::DEINTERLACE_WEAVE ) {
+			if( !m_pDeinterlacer ) {
+				m_pDeinterlacer.reset( new Deinterlacer( m_FramePool ) );
+				m_pDeinterlacer->setMode( m_DeinterlaceMode );
+				m_pDeinterlacer->setFieldRate( m_bDeinterlaceFieldRate );
+			}
+
+			// formats the deinterlacer cannot handle are shown woven
+			if( m_pDeinterlacer->accepts( m_pFrame ) ) {
+				const double fps = getFramesPerSecond();
+
+				m_pDeinterlacer->push( m_pFrame, pts, fps > 0.0 ? 1.0 / fps : 0.0 );
+				frameDecoded = m_pDeinterlacer->pop( m_pFrame, pts );
+			}
+		}
+
+		if( frameDecoded )
+			frameDecoded = filterFrame( m_pVideoFilter, m_VideoFilterMutex, m_pFrame, pts );
+	}
 
 	if( m_bSingleFrame ) {
 		m_bSingleFrame = false;
 		m_bPlaying = false;
 	}
 
-	if( m_pFrame->interlaced_frame ) {
-		// See: https://stackoverflow.com/a/40018558/858219
-		throw logic_error( "MovieDecoder: Interlaced video is not supported yet." );
-	}
+	m_VideoClock = pts;
 
-	m_VideoClock = packet.dts * av_q2d( m_pVideoStream->time_base );
+	if( !outputVideoFrame( frame ) )
+		return false;
 
 	frame.setPts( m_VideoClock );
-	frame.setWidth( getFrameWidth() );
-	frame.setHeight( getFrameHeight() );
 
-	try {
-		if( m_pVideoCodecContext->pix_fmt != AV_PIX_FMT_YUV420P && m_pVideoCodecContext->pix_fmt != AV_PIX_FMT_YUV420P ) {
-			if( !m_pConvertedFrame )
-				createAVFrame( &m_pConvertedFrame, frame.getWidth(), frame.getHeight(), AV_PIX_FMT_YUV420P );
+	if( cacheVideoFrame( frame ) )
+		m_VideoClock = frame.getPts();
 
-			convertVideoFrame( AV_PIX_FMT_YUV420P );
+	return frameDecoded;
+}
 
-			frame.storeYPlane( m_pConvertedFrame->data[0], m_pConvertedFrame->linesize[0] );
-			frame.storeUPlane( m_pConvertedFrame->data[1], m_pConvertedFrame->linesize[1] );
-			frame.storeVPlane( m_pConvertedFrame->data[2], m_pConvertedFrame->linesize[2] );
+bool MovieDecoder::outputVideoFrame( VideoFrame &frame )
+{
+	try {
+		const AVPixelFormat source = AVPixelFormat( m_pFrame->format );
+		const AVPixelFormat target = getTargetPixelFormat( source );
+
+		int outputWidth = m_pFrame->width;
+		int outputHeight = m_pFrame->height;
+		getOutputSize( outputWidth, outputHeight );
+
+		AVFrame *outputFrame = m_pFrame;
+		if( source != target || outputWidth != m_pFrame->width || outputHeight != m_pFrame->height ) {
+			// take new buffers from the pool for every frame, the previous ones may still be referenced by a VideoFrame
+			createAVFrame( &m_pConvertedFrame, outputWidth, outputHeight, target );
+			convertVideoFrame( target );
+			outputFrame = m_pConvertedFrame;
 		}
-		else {
-			frame.storeYPlane( m_pFrame->data[0], m_pFrame->linesize[0] );
-			frame.storeUPlane( m_pFrame->data[1], m_pFrame->linesize[1] );
-			frame.storeVPlane( m_pFrame->data[2], m_pFrame->linesize[2] );
+
+		VideoFrame::PixelFormat format;
+		switch( target ) {
+		case AV_PIX_FMT_RGBA:
+			format = VideoFrame::PIXEL_FORMAT_RGBA;
+			break;
+		case AV_PIX_FMT_YUVA420P:
+			format = VideoFrame::PIXEL_FORMAT_YUVA420P;
+			break;
+		default:
+			format = VideoFrame::PIXEL_FORMAT_YUV420P;
+			break;
+		}
+
+		if( !frame.reference( outputFrame, format ) )
+			return false;
+
+		if( format == VideoFrame::PIXEL_FORMAT_RGBA ) {
+			const bool alpha = hasAlpha( m_pFrame, m_PaletteAlpha );
+			m_bPaletteHasAlpha = alpha;
+			frame.setHasAlpha( alpha );
 		}
 	}
 	catch( const std::exception & ) {
 		return false;
 	}
 
-	return frameDecoded;
+	return true;
 }
 
 void MovieDecoder::convertVideoFrame( AVPixelFormat format )
 {
-	SwsContext *scaleContext = sws_getContext( m_pVideoCodecContext->width, m_pVideoCodecContext->height, m_pVideoCodecContext->pix_fmt, m_pVideoCodecContext->width, m_pVideoCodecContext->height, format, 0, NULL, NULL, NULL );
-	if( NULL == scaleContext )
+	const bool downscale = m_pConvertedFrame->width < m_pFrame->width;
+
+	// the context is only recreated when the source or destination changes
+	m_pSwsContext = sws_getCachedContext( m_pSwsContext, m_pFrame->width, m_pFrame->height, AVPixelFormat( m_pFrame->format ), m_pConvertedFrame->width, m_pConvertedFrame->height, format, downscale ? SWS_FAST_BILINEAR : 0, NULL, NULL, NULL );
+	if( NULL == m_pSwsContext )
 		throw logic_error( "MovieDecoder: Failed to create resize context" );
 
-	sws_scale( scaleContext, m_pFrame->data, m_pFrame->linesize, 0, m_pVideoCodecContext->height, m_pConvertedFrame->data, m_pConvertedFrame->linesize );
-	sws_freeContext( scaleContext );
+	sws_scale( m_pSwsContext, m_pFrame->data, m_pFrame->linesize, 0, m_pFrame->height, m_pConvertedFrame->data, m_pConvertedFrame->linesize );
 }
 
-void MovieDecoder::createAVFrame( AVFrame **avFrame, int width, int height, AVPixelFormat format ) const
+void MovieDecoder::createAVFrame( AVFrame **avFrame, int width, int height, AVPixelFormat format )
 {
-	*avFrame = av_frame_alloc();
+	if( !*avFrame )
+		*avFrame = av_frame_alloc();
+	else
+		av_frame_unref( *avFrame );
+
+	if( !*avFrame )
+		throw logic_error( "MovieDecoder: Failed to allocate frame" );
+
+	( *avFrame )->format = format;
+	( *avFrame )->width = width;
+	( *avFrame )->height = height;
+
+	if( !m_FramePool.allocate( *avFrame ) )
+		throw logic_error( "MovieDecoder: Failed to allocate frame buffer" );
+}
 
-	const int numBytes = avpicture_get_size( format, width, height );
-	uint8_t * pBuffer = new uint8_t[numBytes];
-	avpicture_fill( reinterpret_cast<AVPicture *>( *avFrame ), pBuffer, format, width, height );
+void MovieDecoder::resetVideoFilters()
+{
+	if( m_pDeinterlacer )
+		m_pDeinterlacer->flush();
 
-	//const int numBytes = av_image_get_buffer_size( format, width, height, 1 );
-	//uint8_t * pBuffer = static_cast<uint8_t *>( av_malloc( numBytes ) );
-	//av_image_fill_arrays( ( *avFrame )->data, ( *avFrame )->linesize, pBuffer, format, ( *avFrame )->width, ( *avFrame )->height, 1 );
+	std::lock_guard<std::mutex> lock( m_VideoFilterMutex );
+	if( m_pVideoFilter )
+		m_pVideoFilter->reset();
 }
 
 bool MovieDecoder::decodeVideoPacket( AVPacket &packet )
@@ -393,183 +741,643 @@ bool MovieDecoder::decodeVideoPacket( AVPacket &packet )
 	return frameFinished > 0;
 }
 
-bool MovieDecoder::decodeAudioFrame( AudioFrame &frame )
+void MovieDecoder::setAdaptiveDecoding( bool enabled )
 {
-	if( !m_bHasAudio )
-		return false;
+	m_bAdaptiveDecoding = enabled;
 
-	bool frameDecoded = false;
-
-	AVPacket packet;
-	if( !popAudioPacket( &packet ) )
-		return false;
-
-	// handle flush packets
-	if( packet.data == m_FlushPacket.data ) {
-		avcodec_flush_buffers( m_pFormatContext->streams[m_AudioStream]->codec );
-		return false;
-	}
+	if( !enabled )
+		setDegradationLevel( DEGRADATION_NONE );
+}
 
-	AVFrame *decodedFrame = nullptr;
+void MovieDecoder::updateLag( double lag )
+{
+	if( !m_bAdaptiveDecoding || !m_bHasVideo )
+		return;
 
-	int gotFrame = 0;
-	int bytesRemaining = packet.size;
-	while( bytesRemaining > 0 ) {
-		int bytesDecoded;
-		{
-			if( !decodedFrame ) {
-				if( decodedFrame = av_frame_alloc() ) {
-					av_frame_unref( decodedFrame );
-				}
-				else {
-					// out of memory
-					break;
-				}
-			}
+	const double fps = getFramesPerSecond();
+	const double frameDuration = fps > 0.0 ? 1.0 / fps : 1.0 / 30.0;
 
-			std::lock_guard<std::mutex> lock( m_DecodeAudioMutex );
-			bytesDecoded = avcodec_decode_audio4( m_pAudioStream->codec, decodedFrame, &gotFrame, &packet );
+	if( lag > 2.0 * frameDuration ) {
+		m_HeadroomUpdates = 0;
+		if( ++m_LaggingUpdates >= DEGRADATION_ESCALATE_UPDATES && m_DegradationLevel < DEGRADATION_MAX ) {
+			setDegradationLevel( DegradationLevel( m_DegradationLevel + 1 ) );
+			ci::app::console() << "MovieDecoder: decoding falls behind, degradation level raised to " << m_DegradationLevel << endl;
 		}
-
-		if( bytesDecoded < 0 ) {
-			// error while decoding
-			break;
+	}
+	else if( lag < 0.5 * frameDuration ) {
+		m_LaggingUpdates = 0;
+		if( ++m_HeadroomUpdates >= DEGRADATION_RECOVER_UPDATES && m_DegradationLevel > DEGRADATION_NONE ) {
+			setDegradationLevel( DegradationLevel( m_DegradationLevel - 1 ) );
 		}
+	}
+}
 
-		bytesRemaining -= bytesDecoded;
-
-		int dataSize = 0;
-		if( gotFrame ) {
-			dataSize = av_samples_get_buffer_size( nullptr, m_pAudioCodecContext->channels, decodedFrame->nb_samples, m_pAudioCodecContext->sample_fmt, 1 );
-
-			//
-			if( m_pAudioCodecContext->sample_fmt != m_TargetFormat || !m_pSwrContext ) {
-				if( m_pSwrContext ) {
-					swr_free( &m_pSwrContext );
-					m_pSwrContext = nullptr;
-				}
+void MovieDecoder::setDegradationLevel( DegradationLevel level )
+{
+	m_LaggingUpdates = 0;
+	m_HeadroomUpdates = 0;
 
-				m_pSwrContext = swr_alloc_set_opts( m_pSwrContext,
-				    m_pAudioCodecContext->channel_layout,
-				    m_TargetFormat,
-				    m_pAudioCodecContext->sample_rate,
-				    m_pAudioCodecContext->channel_layout,
-				    m_pAudioCodecContext->sample_fmt,
-				    m_pAudioCodecContext->sample_rate,
-				    0,
-				    NULL );
-
-				if( !m_pSwrContext ) {
-					break;
-				}
-				else if( swr_init( m_pSwrContext ) < 0 ) {
-					break;
-				}
+	if( level == m_DegradationLevel )
+		return;
 
-				m_SourceFormat = m_pAudioCodecContext->sample_fmt;
-			}
+	m_DegradationLevel = level;
+	applyDiscardSettings();
+}
 
-			if( m_pSwrContext ) {
-				const uint8_t **in = const_cast<const uint8_t **>( decodedFrame->extended_data );
-				uint8_t *       out = &m_AudioBuffer[0];
+void MovieDecoder::applyDiscardSettings()
+{
+	if( !m_pVideoCodecContext )
+		return;
 
-				const int bytesPerSample = m_pAudioCodecContext->channels * av_get_bytes_per_sample( m_TargetFormat );
-				const int samplesOut = bytesPerSample == 0 ? 0 : swr_convert( m_pSwrContext, &out, sizeof( m_AudioBuffer ) / bytesPerSample, in, decodedFrame->nb_samples );
+	std::lock_guard<std::mutex> lock( m_DecodeVideoMutex );
 
-				dataSize = samplesOut * bytesPerSample;
-			}
-		}
+	AVDiscard skipFrame = AVDISCARD_DEFAULT;
+	if( !m_bVisible )
+		skipFrame = AVDISCARD_NONKEY;
+	else if( m_DegradationLevel >= DEGRADATION_SKIP_NONREF_FRAMES )
+		skipFrame = AVDISCARD_NONREF;
+	else if( m_TargetWidth > 0 && m_TargetHeight > 0 && m_TargetWidth * 4 <= getFrameWidth() && m_TargetHeight * 4 <= getFrameHeight() )
+		skipFrame = AVDISCARD_NONREF; // tiny movies play at a reduced frame rate
+
+	m_pVideoCodecContext->skip_loop_filter = ( m_DegradationLevel >= DEGRADATION_SKIP_LOOP_FILTER ) ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+	m_pVideoCodecContext->skip_frame = skipFrame;
+	m_pVideoCodecContext->skip_idct = ( m_DegradationLevel >= DEGRADATION_SKIP_IDCT ) ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
+}
 
-		if( dataSize > 0 ) {
-			frameDecoded = true;
-			frame.setDataSize( dataSize );
-			frame.setFrameData( m_AudioBuffer );
-			frame.setPts( packet.pts * av_q2d( m_pAudioStream->time_base ) );
-		}
-	}
+void MovieDecoder::setTargetSize( int width, int height )
+{
+	// while hibernating, wake() opens the codec at the lowres of the stored target
+	m_TargetWidth = width;
+	m_TargetHeight = height;
 
-	av_free_packet( &packet );
+	if( !m_pVideoCodecContext )
+		return;
 
-	if( decodedFrame )
-		av_frame_free( &decodedFrame );
+	// a failed reopen keeps decoding at the previous resolution
+	const int lowres = getTargetLowres();
+	if( lowres != m_pVideoCodecContext->lowres )
+		reopenVideoCodec( lowres );
 
-	return frameDecoded;
+	applyDiscardSettings();
 }
 
-void MovieDecoder::readPackets()
+int MovieDecoder::getTargetLowres() const
 {
-	AVPacket packet;
+	if( !m_pVideoCodec || m_TargetWidth <= 0 || m_TargetHeight <= 0 )
+		return 0;
 
-	while( !m_bDone || m_bSeeking ) {
-		if( m_bSeeking ) {
-			m_bSeeking = false;
+	int lowres = 0;
+	while( lowres < m_pVideoCodec->max_lowres && ( getFrameWidth() >> ( lowres + 1 ) ) >= m_TargetWidth && ( getFrameHeight() >> ( lowres + 1 ) ) >= m_TargetHeight )
+		++lowres;
 
-			const int ret = av_seek_frame( m_pFormatContext, -1, m_SeekTimestamp, m_SeekFlags );
-			if( ret >= 0 ) {
-				{
-					std::lock_guard<std::mutex> audioLock( m_AudioQueueMutex );
-					std::lock_guard<std::mutex> videoLock( m_VideoQueueMutex );
+	return lowres;
+}
 
-					clearQueue( m_AudioQueue );
-					clearQueue( m_VideoQueue );
-				}
+void MovieDecoder::setVisible( bool visible )
+{
+	if( m_bVisible == visible )
+		return;
 
-				if( m_AudioStream >= 0 )
-					queueAudioPacket( &m_FlushPacket );
+	m_bVisible = visible;
+	applyDiscardSettings();
 
-				if( m_VideoStream >= 0 )
-					queueVideoPacket( &m_FlushPacket );
-			}
-		}
-		else if( int( m_VideoQueue.size() ) >= m_MaxVideoQueueSize || int( m_AudioQueue.size() ) >= m_MaxAudioQueueSize ) {
-			this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
-		}
-		else if( m_bPlaying && av_read_frame( m_pFormatContext, &packet ) >= 0 ) {
-			if( packet.stream_index == m_VideoStream ) {
-				queueVideoPacket( &packet );
-			}
-			else if( packet.stream_index == m_AudioStream ) {
-				queueAudioPacket( &packet );
-			}
-			else {
-				av_free_packet( &packet );
-			}
-		}
-		else if( m_bLoop && !m_bPaused ) {
-			const auto stream = m_pFormatContext->streams[m_VideoStream];
-			avio_seek( m_pFormatContext->pb, 0, SEEK_SET );
-			avformat_seek_file( m_pFormatContext, m_VideoStream, 0, 0, stream->duration, 0 );
-		}
-		else {
-			this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+	// only keyframes were decoded while hidden, so the codec has no valid references for the frames in between
+	if( visible && m_pVideoCodecContext && !m_bHibernating ) {
+		{
+			std::lock_guard<std::mutex> lock( m_DecodeVideoMutex );
+			avcodec_flush_buffers( m_pVideoCodecContext );
 		}
+
+		resetVideoFilters();
+		m_bWaitForKeyFrame = true;
 	}
 }
 
-void MovieDecoder::start()
+bool MovieDecoder::reopenVideoCodec( int lowres )
 {
-	stop();
-
-	m_bPlaying = true;
-	m_bSingleFrame = false;
-	m_bPaused = false;
-	m_bDone = false;
-	if( !m_pPacketReaderThread ) {
-		m_pPacketReaderThread = new std::thread( std::bind( &MovieDecoder::readPackets, this ) );
+	AVCodecContext *context = openCodecContext( m_pVideoStream, m_pVideoCodec, lowres );
+	if( !context ) {
+		ci::app::console() << "MovieDecoder: Could not reopen video codec at lowres " << lowres << endl;
+		return false;
 	}
+
+	std::lock_guard<std::mutex> lock( m_DecodeVideoMutex );
+
+	freeCodecContext( m_pVideoCodecContext, m_pVideoStream );
+	m_pVideoCodecContext = context;
+
+	// the new codec instance has no reference frames
+	m_bWaitForKeyFrame = true;
+	return true;
 }
 
-void MovieDecoder::pause()
+AVCodecContext *MovieDecoder::openCodecContext( AVStream *stream, AVCodec *codec, int lowres )
 {
-	if( m_bPlaying && !m_bPaused ) {
-		m_bPlaying = false;
-		m_bPaused = true;
+	AVCodecContext *context = avcodec_alloc_context3( codec );
+	if( !context )
+		return NULL;
+
+	if( avcodec_parameters_to_context( context, stream->codecpar ) < 0 ) {
+		avcodec_free_context( &context );
+		return NULL;
 	}
-}
+
+	context->pkt_timebase = stream->time_base;
+	context->workaround_bugs = 1;
+
+	if( codec->type == AVMEDIA_TYPE_VIDEO ) {
+		context->thread_count = 0;
+		context->refcounted_frames = 1; // decoded frames are shared with VideoFrame
+		context->opaque = &m_FramePool;
+		context->get_buffer2 = &FramePool::getBuffer;
+		context->thread_safe_callbacks = 1;
+	}
+	else if( context->channel_layout == 0 || context->channels != av_get_channel_layout_nb_channels( context->channel_layout ) ) {
+		context->channel_layout = av_get_default_channel_layout( context->channels );
+	}
+
+	AVDictionary *options = NULL;
+	if( lowres > 0 )
+		av_dict_set_int( &options, "lowres", lowres, 0 );
+
+	const int result = avcodec_open2( context, codec, &options );
+	av_dict_free( &options );
+
+	if( result < 0 ) {
+		avcodec_free_context( &context );
+		return NULL;
+	}
+
+	return context;
+}
+
+void MovieDecoder::freeCodecContext( AVCodecContext *&context, AVStream *stream )
+{
+	if( !context )
+		return;
+
+	// the context embedded in the stream belongs to the format context
+	if( stream && context == stream->codec ) {
+		avcodec_close( context );
+		context = NULL;
+	}
+	else {
+		avcodec_free_context( &context );
+	}
+}
+
+void MovieDecoder::getOutputSize( int &width, int &height ) const
+{
+	if( m_TargetWidth <= 0 || m_TargetHeight <= 0 )
+		return;
+
+	if( width < DOWNSCALE_THRESHOLD * m_TargetWidth || height < DOWNSCALE_THRESHOLD * m_TargetHeight )
+		return;
+
+	// keep the aspect ratio and cover the target size
+	const double scale = std::max( m_TargetWidth / double( width ), m_TargetHeight / double( height ) );
+	width = ( int( width * scale ) + 1 ) & ~1;
+	height = ( int( height * scale ) + 1 ) & ~1;
+}
+
+bool MovieDecoder::catchUp( double targetPts )
+{
+	if( !m_bHasVideo || m_CatchUpThreshold <= 0.0 || m_bCatchingUp || m_bVideoFromCache )
+		return false;
+
+	const double lag = targetPts - m_VideoClock;
+	if( lag < m_CatchUpThreshold )
+		return false;
+
+	const double timeBase = av_q2d( m_pVideoStream->time_base );
+
+	std::lock_guard<std::mutex> lock( m_VideoQueueMutex );
+
+	// find the last keyframe at or before the target, or else the first one after it
+	int    keyFrame = -1;
+	double keyFramePts = 0.0;
+	for( size_t i = 0; i < m_VideoQueue.size(); ++i ) {
+		const AVPacket &packet = m_VideoQueue[i];
+		if( packet.data == m_FlushPacket.data ) {
+			// don't skip across a seek
+			if( keyFrame < 0 )
+				return false;
+			break;
+		}
+
+		if( !( packet.flags & AV_PKT_FLAG_KEY ) )
+			continue;
+
+		const double pts = packet.dts * timeBase;
+		if( pts <= m_VideoClock )
+			continue;
+
+		if( pts <= targetPts || keyFrame < 0 ) {
+			keyFrame = int( i );
+			keyFramePts = pts;
+		}
+
+		if( pts > targetPts )
+			break;
+	}
+
+	if( keyFrame == 0 ) {
+		// already next in line
+		return false;
+	}
+	else if( keyFrame > 0 ) {
+		// a keyframe past the target is only worth it if waiting for the audio to reach it is shorter than decoding forward
+		if( keyFramePts > targetPts && keyFramePts - targetPts > lag )
+			return false;
+
+		for( int i = 0; i < keyFrame; ++i ) {
+			freePacket( m_VideoQueue.front() );
+			m_VideoQueue.pop_front();
+		}
+
+		ci::app::console() << "MovieDecoder: video is " << lag << " seconds behind, skipped to keyframe at seconds = " << keyFramePts << endl;
+	}
+	else {
+		// no keyframe has been read yet: drop what is queued and let the demuxer skip to the next one
+		clearQueue( m_VideoQueue );
+		m_bCatchingUp = true;
+
+		ci::app::console() << "MovieDecoder: video is " << lag << " seconds behind, skipping to the next keyframe" << endl;
+	}
+
+	// references to the skipped frames are no longer valid
+	m_VideoQueue.push_front( m_FlushPacket );
+
+	// a pass with gaps is not worth caching
+	m_bRecordingVideo = false;
+
+	return true;
+}
+
+bool MovieDecoder::decodeAudioFrame( AudioFrame &frame )
+{
+	if( !m_bHasAudio || m_bHibernating )
+		return false;
+
+	if( m_bAudioFromCache ) {
+		if( !m_bPlaying )
+			return false;
+
+		std::lock_guard<std::mutex> lock( m_LoopCacheMutex );
+		return m_pLoopCache && m_pLoopCache->nextAudioFrame( frame );
+	}
+
+	bool frameDecoded = false;
+
+	// the filter graph may output several frames per packet
+	if( m_pAudioFilter ) {
+		double pts = 0.0;
+
+		if( m_pAudioFrame && pullFilteredFrame( m_pAudioFilter, m_AudioFilterMutex, m_pAudioFrame, pts ) ) {
+			const int dataSize = m_AudioResampler.convert( m_pAudioFrame, m_AudioBuffer.data(), int( m_AudioBuffer.size() ) );
+			if( dataSize > 0 ) {
+				frameDecoded = true;
+				frame.setDataSize( dataSize );
+				frame.setFrameData( m_AudioBuffer.data() );
+				frame.setPts( pts );
+			}
+		}
+
+		if( frameDecoded ) {
+			cacheAudioFrame( frame );
+			return true;
+		}
+	}
+
+	AVPacket packet;
+	if( !popAudioPacket( &packet ) )
+		return false;
+
+	// handle flush packets
+	if( packet.data == m_FlushPacket.data ) {
+		avcodec_flush_buffers( m_pAudioCodecContext );
+		m_AudioResampler.reset();
+
+		std::lock_guard<std::mutex> lock( m_AudioFilterMutex );
+		if( m_pAudioFilter )
+			m_pAudioFilter->reset();
+		return false;
+	}
+
+	// decode into the same frame every time, the decoder unreferences its previous contents
+	AVFrame *decodedFrame = m_pAudioFrame;
+
+	int gotFrame = 0;
+	int bytesRemaining = decodedFrame ? packet.size : 0;
+	while( bytesRemaining > 0 ) {
+		int bytesDecoded;
+		{
+			std::lock_guard<std::mutex> lock( m_DecodeAudioMutex );
+			bytesDecoded = avcodec_decode_audio4( m_pAudioCodecContext, decodedFrame, &gotFrame, &packet );
+		}
+
+		if( bytesDecoded < 0 ) {
+			// error while decoding
+			break;
+		}
+
+		bytesRemaining -= bytesDecoded;
+
+		int    dataSize = 0;
+		double pts = packet.pts * av_q2d( m_pAudioStream->time_base );
+		if( gotFrame && filterFrame( m_pAudioFilter, m_AudioFilterMutex, decodedFrame, pts ) ) {
+			dataSize = m_AudioResampler.convert( decodedFrame, m_AudioBuffer.data(), int( m_AudioBuffer.size() ) );
+			if( dataSize < 0 )
+				break;
+		}
+
+		// after an accurate seek, skip samples up to the requested position
+		if( dataSize > 0 && m_AudioSeekTarget >= 0.0 ) {
+			const double duration = decodedFrame->nb_samples / double( m_pAudioCodecContext->sample_rate );
+			if( pts + duration < m_AudioSeekTarget )
+				dataSize = 0;
+			else
+				m_AudioSeekTarget = -1.0;
+		}
+
+		if( dataSize > 0 ) {
+			frameDecoded = true;
+			frame.setDataSize( dataSize );
+			frame.setFrameData( m_AudioBuffer.data() );
+			frame.setPts( pts );
+		}
+	}
+
+	av_free_packet( &packet );
+
+	if( frameDecoded )
+		cacheAudioFrame( frame );
+
+	return frameDecoded;
+}
+
+bool MovieDecoder::filterFrame( std::unique_ptr<FilterGraph> &filter, std::mutex &mutex, AVFrame *frame, double &pts )
+{
+	std::lock_guard<std::mutex> lock( mutex );
+
+	// frames the graph cannot take are passed on unfiltered
+	if( !filter || !filter->push( frame, pts ) )
+		return true;
+
+	return filter->pull( frame, pts );
+}
+
+bool MovieDecoder::pullFilteredFrame( std::unique_ptr<FilterGraph> &filter, std::mutex &mutex, AVFrame *frame, double &pts )
+{
+	std::lock_guard<std::mutex> lock( mutex );
+	return filter && filter->pull( frame, pts );
+}
+
+void MovieDecoder::setVideoFilter( const string &description )
+{
+	std::lock_guard<std::mutex> lock( m_VideoFilterMutex );
+	m_pVideoFilter.reset( description.empty() ? NULL : new FilterGraph( description, AVMEDIA_TYPE_VIDEO ) );
+}
+
+void MovieDecoder::setAudioFilter( const string &description )
+{
+	std::lock_guard<std::mutex> lock( m_AudioFilterMutex );
+	m_pAudioFilter.reset( description.empty() ? NULL : new FilterGraph( description, AVMEDIA_TYPE_AUDIO ) );
+}
+
+void MovieDecoder::readPackets()
+{
+	AVPacket packet;
+
+	m_bEndOfStream = false;
+
+	// only this thread touches the discard setting of the video stream, catchUp() merely raises m_bCatchingUp
+	while( !m_bDone || m_bSeeking ) {
+		if( m_bCatchingUp && m_pVideoStream->discard != AVDISCARD_NONKEY ) {
+			// let the demuxer skip everything but keyframes of the video stream
+			m_pVideoStream->discard = AVDISCARD_NONKEY;
+		}
+
+		if( m_bSeeking ) {
+			m_bSeeking = false;
+			m_bEndOfStream = false;
+
+			m_bCatchingUp = false;
+			if( m_pVideoStream )
+				m_pVideoStream->discard = AVDISCARD_DEFAULT;
+
+			const int ret = seekPacketCache() ? 0 : av_seek_frame( m_pFormatContext, -1, m_SeekTimestamp, m_SeekFlags );
+			if( ret >= 0 ) {
+				{
+					std::lock_guard<std::mutex> audioLock( m_AudioQueueMutex );
+					std::lock_guard<std::mutex> videoLock( m_VideoQueueMutex );
+
+					clearQueue( m_AudioQueue );
+					clearQueue( m_VideoQueue );
+				}
+
+				if( m_AudioStream >= 0 && !m_bAudioFromCache )
+					queueAudioPacket( &m_FlushPacket );
+
+				if( m_VideoStream >= 0 && !m_bVideoFromCache )
+					queueVideoPacket( &m_FlushPacket );
+			}
+		}
+		else if( int( m_VideoQueue.size() ) >= m_MaxVideoQueueSize || int( m_AudioQueue.size() ) >= m_MaxAudioQueueSize ) {
+			this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+		}
+		else if( ( !m_bHasVideo || m_bVideoFromCache ) && ( !m_bHasAudio || m_bAudioFromCache ) ) {
+			// everything is served from the loop cache
+			this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+		}
+		else if( m_bPlaying && readPacket( &packet ) ) {
+			if( packet.stream_index == m_VideoStream && m_bCatchingUp && !( packet.flags & AV_PKT_FLAG_KEY ) ) {
+				// not all demuxers honor AVDISCARD_NONKEY
+				av_free_packet( &packet );
+			}
+			else if( ( packet.stream_index == m_VideoStream && m_bVideoFromCache ) || ( packet.stream_index == m_AudioStream && m_bAudioFromCache ) ) {
+				av_free_packet( &packet );
+			}
+			else if( packet.stream_index == m_VideoStream ) {
+				if( m_bCatchingUp.exchange( false ) )
+					m_pVideoStream->discard = AVDISCARD_DEFAULT;
+
+				queueVideoPacket( &packet );
+			}
+			else if( packet.stream_index == m_AudioStream ) {
+				queueAudioPacket( &packet );
+			}
+			else {
+				av_free_packet( &packet );
+			}
+		}
+		else if( m_bLoop && !m_bPaused ) {
+			if( !rewindPacketCache() ) {
+				const auto stream = m_pFormatContext->streams[m_VideoStream];
+				avio_seek( m_pFormatContext->pb, 0, SEEK_SET );
+				avformat_seek_file( m_pFormatContext, m_VideoStream, 0, 0, stream->duration, 0 );
+			}
+		}
+		else {
+			// at the end of the file, let the video decoder output the frames it holds back
+			if( m_bPlaying && !m_bEndOfStream && m_VideoStream >= 0 ) {
+				m_bEndOfStream = true;
+				queueVideoPacket( &m_EndOfStreamPacket );
+			}
+
+			this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+		}
+	}
+
+	if( m_pVideoStream )
+		m_pVideoStream->discard = AVDISCARD_DEFAULT;
+}
+
+bool MovieDecoder::readPacket( AVPacket *packet )
+{
+	std::lock_guard<std::mutex> lock( m_PacketCacheMutex );
+
+	if( m_pPacketCache && m_pPacketCache->isComplete() )
+		return m_pPacketCache->next( packet );
+
+	if( av_read_frame( m_pFormatContext, packet ) < 0 )
+		return false;
+
+	if( m_bRecordingPackets ) {
+		if( m_bCatchingUp ) {
+			// the demuxer is skipping packets, this pass is incomplete
+			m_pPacketCache->clear();
+			m_bRecordingPackets = false;
+		}
+		else if( !m_pPacketCache->add( packet ) ) {
+			ci::app::console() << "MovieDecoder: a single pass does not fit in the packet cache of " << m_pPacketCache->getMaxSize() << " bytes" << endl;
+
+			m_pPacketCache.reset();
+			m_bRecordingPackets = false;
+		}
+	}
+
+	return true;
+}
+
+bool MovieDecoder::seekPacketCache()
+{
+	std::lock_guard<std::mutex> lock( m_PacketCacheMutex );
+
+	if( !m_pPacketCache )
+		return false;
+
+	if( !m_pPacketCache->isComplete() ) {
+		// a partial pass cannot be resumed from anywhere but the start
+		m_pPacketCache->clear();
+		m_bRecordingPackets = ( m_SeekTimestamp <= 0 );
+		return false;
+	}
+
+	const int      streamIndex = ( m_VideoStream >= 0 ) ? m_VideoStream : m_AudioStream;
+	const AVStream *stream = m_pFormatContext->streams[streamIndex];
+	m_pPacketCache->seek( streamIndex, av_rescale_q( m_SeekTimestamp, AV_TIME_BASE_Q, stream->time_base ) );
+
+	return true;
+}
+
+bool MovieDecoder::rewindPacketCache()
+{
+	std::lock_guard<std::mutex> lock( m_PacketCacheMutex );
+
+	if( !m_pPacketCache )
+		return false;
+
+	if( m_bRecordingPackets ) {
+		m_bRecordingPackets = false;
+		m_pPacketCache->finish();
+	}
+
+	if( m_pPacketCache->isComplete() ) {
+		m_pPacketCache->rewind();
+		return true;
+	}
+
+	// the file is about to be read from the start, record this pass
+	m_bRecordingPackets = true;
+	return false;
+}
+
+void MovieDecoder::setDeinterlacing( Deinterlacer::Mode mode, bool fieldRate )
+{
+	m_DeinterlaceMode = mode;
+	m_bDeinterlaceFieldRate = fieldRate;
+
+	if( m_pDeinterlacer ) {
+		m_pDeinterlacer->setMode( mode );
+		m_pDeinterlacer->setFieldRate( fieldRate );
+	}
+}
+
+void MovieDecoder::setPacketCache( bool enabled, size_t maxBytes )
+{
+	std::lock_guard<std::mutex> lock( m_PacketCacheMutex );
+
+	const bool wasReplaying = m_pPacketCache && m_pPacketCache->isComplete();
+
+	m_pPacketCache.reset( enabled ? new PacketCache( maxBytes ) : NULL );
+	m_bRecordingPackets = false;
+
+	if( wasReplaying ) {
+		// the demuxer is not where the replay left off
+		seekToTime( m_bHasVideo ? m_VideoClock : m_AudioClock, true );
+	}
+}
+
+void MovieDecoder::start()
+{
+	stop();
+
+	m_bPlaying = true;
+	m_bSingleFrame = false;
+	m_bPaused = false;
+	m_bDone = false;
+
+	// random access moved the demuxer
+	if( m_bRandomAccessed ) {
+		m_bRandomAccessed = false;
+		m_RandomAccessFrame = -1;
+		seekToTime( 0.0 );
+	}
+
+	// playback starts at the beginning or at a pending seek, so a new pass can be recorded right away
+	resetLoopCache( m_AudioClock );
+
+	{
+		// recording starts once the reader rewinds the file, which is the only point known to be the start of a pass
+		std::lock_guard<std::mutex> lock( m_PacketCacheMutex );
+		if( m_pPacketCache ) {
+			if( m_pPacketCache->isComplete() )
+				m_pPacketCache->rewind();
+			else
+				m_pPacketCache->clear();
+		}
+
+		m_bRecordingPackets = false;
+	}
+
+	if( !m_pPacketReaderThread ) {
+		m_pPacketReaderThread = new std::thread( std::bind( &MovieDecoder::readPackets, this ) );
+	}
+}
+
+void MovieDecoder::pause()
+{
+	if( m_bPlaying && !m_bPaused ) {
+		m_bPlaying = false;
+		m_bPaused = true;
+	}
+}
 
 void MovieDecoder::resume()
 {
-	if( !m_bPlaying && m_bPaused ) {
+	// a movie woken up paused is still playing until the frame at the hibernate position is decoded
+	if( m_bPaused ) {
 		m_bPlaying = true;
 		m_bSingleFrame = false;
 		m_bPaused = false;
@@ -578,11 +1386,20 @@ void MovieDecoder::resume()
 
 void MovieDecoder::stop()
 {
-	m_VideoClock = 0;
-	m_AudioClock = 0;
+	// without a reader, a pending seek is where the next start() begins
+	if( !m_bSeeking || m_pPacketReaderThread ) {
+		m_VideoClock = 0;
+		m_AudioClock = 0;
+	}
 
 	m_bPlaying = false;
 	m_bPaused = false;
+
+	stopReader();
+}
+
+void MovieDecoder::stopReader()
+{
 	m_bDone = true;
 	if( m_pPacketReaderThread ) {
 		m_pPacketReaderThread->join();
@@ -590,10 +1407,298 @@ void MovieDecoder::stop()
 		m_pPacketReaderThread = NULL;
 	}
 
+	// the reader restored the discard setting on its way out
+	m_bCatchingUp = false;
+
+	// audio may be decoded on a thread of its own
+	std::lock_guard<std::mutex> audioLock( m_AudioQueueMutex );
+	std::lock_guard<std::mutex> videoLock( m_VideoQueueMutex );
+
 	clearQueue( m_AudioQueue );
 	clearQueue( m_VideoQueue );
 }
 
+void MovieDecoder::hibernate()
+{
+	if( m_bHibernating || !m_bInitialized )
+		return;
+
+	m_bWasStarted = ( m_pPacketReaderThread != NULL );
+	m_bWasPaused = m_bPaused;
+	m_HibernatePosition = m_bHasVideo ? m_VideoClock : m_AudioClock;
+
+	m_bPlaying = false;
+	stopReader();
+
+	// give the memory of the (now empty) queues back
+	std::deque<AVPacket>().swap( m_VideoQueue );
+	std::deque<AVPacket>().swap( m_AudioQueue );
+
+	// wake() opens new contexts from the stream parameters
+	{
+		std::lock_guard<std::mutex> lock( m_DecodeVideoMutex );
+		freeCodecContext( m_pVideoCodecContext, m_pVideoStream );
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( m_DecodeAudioMutex );
+		freeCodecContext( m_pAudioCodecContext, m_pAudioStream );
+	}
+
+	if( m_pConvertedFrame )
+		av_frame_free( &m_pConvertedFrame );
+
+	if( m_pFrame )
+		av_frame_free( &m_pFrame );
+
+	if( m_pSwsContext ) {
+		sws_freeContext( m_pSwsContext );
+		m_pSwsContext = NULL;
+	}
+
+	m_AudioResampler.reset();
+
+	if( m_pAudioFrame )
+		av_frame_free( &m_pAudioFrame );
+
+	std::vector<uint8_t>().swap( m_AudioBuffer );
+
+	m_FrameCache.clear();
+	m_RandomAccessFrame = -1;
+
+	{
+		std::lock_guard<std::mutex> lock( m_LoopCacheMutex );
+		if( m_pLoopCache )
+			m_pLoopCache->clear();
+
+		m_bVideoFromCache = false;
+		m_bAudioFromCache = false;
+		m_bRecordingVideo = false;
+		m_bRecordingAudio = false;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock( m_PacketCacheMutex );
+		if( m_pPacketCache )
+			m_pPacketCache->clear();
+
+		m_bRecordingPackets = false;
+	}
+
+	// frees the slice threads as well
+	m_pDeinterlacer.reset();
+	m_FramePool.clear();
+
+	// drop packets buffered by the demuxer, but keep the stream information and seek index
+	avformat_flush( m_pFormatContext );
+
+	m_bHibernating = true;
+}
+
+bool MovieDecoder::wake()
+{
+	if( !m_bHibernating )
+		return true;
+
+	AVCodecContext *videoContext = NULL;
+	if( m_pVideoStream && m_pVideoCodec ) {
+		videoContext = openCodecContext( m_pVideoStream, m_pVideoCodec, getTargetLowres() );
+		if( !videoContext ) {
+			ci::app::console() << "MovieDecoder: Could not reopen video codec" << endl;
+			return false;
+		}
+	}
+
+	AVCodecContext *audioContext = NULL;
+	if( m_pAudioStream && m_pAudioCodec ) {
+		audioContext = openCodecContext( m_pAudioStream, m_pAudioCodec, 0 );
+		if( !audioContext ) {
+			ci::app::console() << "MovieDecoder: Could not reopen audio codec" << endl;
+			if( videoContext )
+				avcodec_free_context( &videoContext );
+			return false;
+		}
+	}
+
+	if( videoContext ) {
+		std::lock_guard<std::mutex> lock( m_DecodeVideoMutex );
+		m_pVideoCodecContext = videoContext;
+		m_pFrame = av_frame_alloc();
+	}
+
+	if( audioContext ) {
+		std::lock_guard<std::mutex> lock( m_DecodeAudioMutex );
+		m_pAudioCodecContext = audioContext;
+		m_AudioBuffer.resize( MAX_AUDIO_FRAME_SIZE * 4 );
+		m_pAudioFrame = av_frame_alloc();
+	}
+
+	applyDiscardSettings();
+
+	m_bHibernating = false;
+	m_bWaitForKeyFrame = false;
+
+	seekToTime( m_HibernatePosition, true );
+
+	if( m_bWasStarted ) {
+		// when paused, decode the frame at the position and pause again
+		m_bPlaying = true;
+		m_bPaused = m_bWasPaused;
+		m_bSingleFrame = m_bWasPaused;
+		m_bDone = false;
+
+		m_pPacketReaderThread = new std::thread( std::bind( &MovieDecoder::readPackets, this ) );
+	}
+
+	return true;
+}
+
+void MovieDecoder::loop( bool enabled )
+{
+	m_bLoop = enabled;
+
+	if( !enabled && isLoopCached() ) {
+		// continue decoding from the file at the current position
+		seekToTime( m_bHasVideo ? m_VideoClock : m_AudioClock, true );
+	}
+}
+
+void MovieDecoder::setLoopCache( bool enabled, size_t maxBytes, bool compress )
+{
+	const bool wasCached = isLoopCached();
+
+	{
+		std::lock_guard<std::mutex> lock( m_LoopCacheMutex );
+
+		m_pLoopCache.reset( enabled ? new LoopCache( maxBytes, compress ) : NULL );
+
+		m_bVideoFromCache = false;
+		m_bAudioFromCache = false;
+		m_bRecordingVideo = false;
+		m_bRecordingAudio = false;
+		m_LastCachedVideoPts = -1.0;
+		m_LastCachedAudioPts = -1.0;
+	}
+
+	if( wasCached )
+		seekToTime( m_bHasVideo ? m_VideoClock : m_AudioClock, true );
+}
+
+void MovieDecoder::resetLoopCache( double seconds )
+{
+	std::lock_guard<std::mutex> lock( m_LoopCacheMutex );
+
+	if( !m_pLoopCache )
+		return;
+
+	m_LastCachedVideoPts = -1.0;
+	m_LastCachedAudioPts = -1.0;
+
+	const bool complete = ( !m_bHasVideo || m_pLoopCache->isVideoComplete() ) && ( !m_bHasAudio || m_pLoopCache->isAudioComplete() );
+	if( complete ) {
+		m_pLoopCache->seek( seconds );
+		return;
+	}
+
+	// a partial pass cannot be resumed from anywhere but the start
+	m_pLoopCache->clear();
+
+	m_bVideoFromCache = false;
+	m_bAudioFromCache = false;
+	m_bRecordingVideo = ( seconds <= 0.0 );
+	m_bRecordingAudio = ( seconds <= 0.0 );
+}
+
+bool MovieDecoder::cacheVideoFrame( VideoFrame &frame )
+{
+	std::lock_guard<std::mutex> lock( m_LoopCacheMutex );
+
+	if( !m_pLoopCache || !m_bLoop )
+		return false;
+
+	// offscreen movies only decode keyframes
+	if( !m_bVisible )
+		m_bRecordingVideo = false;
+
+	const bool wrapped = frame.getPts() < m_LastCachedVideoPts;
+	m_LastCachedVideoPts = frame.getPts();
+
+	if( wrapped ) {
+		if( m_bRecordingVideo ) {
+			m_bRecordingVideo = false;
+			m_pLoopCache->finishVideo();
+
+			if( m_pLoopCache->isVideoComplete() ) {
+				m_bVideoFromCache = true;
+
+				{
+					std::lock_guard<std::mutex> videoLock( m_VideoQueueMutex );
+					clearQueue( m_VideoQueue );
+				}
+
+				// the frame just decoded is the first frame of the cached pass
+				return m_pLoopCache->nextVideoFrame( frame );
+			}
+		}
+
+		m_bRecordingVideo = m_bVisible;
+	}
+
+	if( m_bRecordingVideo && !m_pLoopCache->addVideoFrame( frame ) ) {
+		ci::app::console() << "MovieDecoder: a single pass does not fit in the loop cache of " << m_pLoopCache->getMaxSize() << " bytes" << endl;
+
+		// over budget, give up on caching this movie
+		m_pLoopCache.reset();
+		m_bRecordingVideo = false;
+		m_bRecordingAudio = false;
+		m_FramePool.clear();
+	}
+
+	return false;
+}
+
+bool MovieDecoder::cacheAudioFrame( AudioFrame &frame )
+{
+	std::lock_guard<std::mutex> lock( m_LoopCacheMutex );
+
+	if( !m_pLoopCache || !m_bLoop )
+		return false;
+
+	const bool wrapped = frame.getPts() < m_LastCachedAudioPts;
+	m_LastCachedAudioPts = frame.getPts();
+
+	if( wrapped ) {
+		if( m_bRecordingAudio ) {
+			m_bRecordingAudio = false;
+			m_pLoopCache->finishAudio();
+
+			if( m_pLoopCache->isAudioComplete() ) {
+				m_bAudioFromCache = true;
+
+				{
+					std::lock_guard<std::mutex> audioLock( m_AudioQueueMutex );
+					clearQueue( m_AudioQueue );
+				}
+
+				return m_pLoopCache->nextAudioFrame( frame );
+			}
+		}
+
+		m_bRecordingAudio = true;
+	}
+
+	if( m_bRecordingAudio && !m_pLoopCache->addAudioFrame( frame ) ) {
+		ci::app::console() << "MovieDecoder: a single pass does not fit in the loop cache of " << m_pLoopCache->getMaxSize() << " bytes" << endl;
+
+		m_pLoopCache.reset();
+		m_bRecordingVideo = false;
+		m_bRecordingAudio = false;
+		m_FramePool.clear();
+	}
+
+	return false;
+}
+
 bool MovieDecoder::queueVideoPacket( AVPacket *packet )
 {
 	std::lock_guard<std::mutex> lock( m_VideoQueueMutex );
@@ -603,38 +1708,65 @@ bool MovieDecoder::queueVideoPacket( AVPacket *packet )
 bool MovieDecoder::queueAudioPacket( AVPacket *packet )
 {
 	std::lock_guard<std::mutex> lock( m_AudioQueueMutex );
-	return queuePacket( m_AudioQueue, packet );
+	if( !queuePacket( m_AudioQueue, packet ) )
+		return false;
+
+	if( m_AudioPacketCallback )
+		m_AudioPacketCallback();
+
+	return true;
 }
 
-bool MovieDecoder::queuePacket( queue<AVPacket> &packetQueue, AVPacket *packet ) const
+bool MovieDecoder::hasAudioPackets()
+{
+	std::lock_guard<std::mutex> lock( m_AudioQueueMutex );
+	return !m_AudioQueue.empty();
+}
+
+void MovieDecoder::setAudioPacketCallback( const std::function<void()> &callback )
+{
+	// the queue mutex keeps the reader from calling a callback that is being replaced
+	std::lock_guard<std::mutex> lock( m_AudioQueueMutex );
+	m_AudioPacketCallback = callback;
+}
+
+bool MovieDecoder::queuePacket( deque<AVPacket> &packetQueue, AVPacket *packet ) const
 {
 	if( av_dup_packet( packet ) < 0 ) {
 		return false;
 	}
-	packetQueue.push( *packet );
+	packetQueue.push_back( *packet );
 
 	return true;
 }
 
-bool MovieDecoder::popPacket( queue<AVPacket> &packetQueue, AVPacket *packet ) const
+bool MovieDecoder::popPacket( deque<AVPacket> &packetQueue, AVPacket *packet ) const
 {
 	if( packetQueue.empty() ) {
 		return false;
 	}
 
 	*packet = packetQueue.front();
-	packetQueue.pop();
+	packetQueue.pop_front();
 
 	return true;
 }
 
-void MovieDecoder::clearQueue( std::queue<AVPacket> &packetQueue ) const
+void MovieDecoder::clearQueue( std::deque<AVPacket> &packetQueue ) const
 {
 	while( !packetQueue.empty() ) {
-		packetQueue.pop();
+		freePacket( packetQueue.front() );
+		packetQueue.pop_front();
 	}
 }
 
+void MovieDecoder::freePacket( AVPacket &packet ) const
+{
+	// flush and end of stream packets share their data with m_FlushPacket and m_EndOfStreamPacket
+	if( packet.data != m_FlushPacket.data && packet.data != m_EndOfStreamPacket.data )
+		av_free_packet( &packet );
+}
+
 bool MovieDecoder::popAudioPacket( AVPacket *packet )
 {
 	std::lock_guard<std::mutex> lock( m_AudioQueueMutex );
@@ -647,6 +1779,16 @@ bool MovieDecoder::popVideoPacket( AVPacket *packet )
 	return popPacket( m_VideoQueue, packet );
 }
 
+bool MovieDecoder::popVideoFlushPacket()
+{
+	std::lock_guard<std::mutex> lock( m_VideoQueueMutex );
+	if( m_VideoQueue.empty() || m_VideoQueue.front().data != m_FlushPacket.data )
+		return false;
+
+	m_VideoQueue.pop_front();
+	return true;
+}
+
 double MovieDecoder::getAudioTimeBase() const
 {
 	return m_pAudioStream ? av_q2d( m_pAudioStream->time_base ) : 0.0;
@@ -655,6 +1797,7 @@ double MovieDecoder::getAudioTimeBase() const
 AudioFormat MovieDecoder::getAudioFormat()
 {
 	AudioFormat format;
+	format.isFloat = false;
 
 	if( m_pAudioCodecContext ) {
 		switch( m_pAudioCodecContext->sample_fmt ) {
@@ -670,12 +1813,17 @@ AudioFormat MovieDecoder::getAudioFormat()
 			break;
 		case AV_SAMPLE_FMT_S32:
 		case AV_SAMPLE_FMT_S32P:
-			format.bits = 32;
+			format.bits = 16;
 			m_TargetFormat = AV_SAMPLE_FMT_S16;
 			break;
+		case AV_SAMPLE_FMT_FLT:
 		case AV_SAMPLE_FMT_FLTP:
-			format.bits = 16;
-			m_TargetFormat = AV_SAMPLE_FMT_S16;
+		case AV_SAMPLE_FMT_DBL:
+		case AV_SAMPLE_FMT_DBLP:
+			// keep floating point all the way to the renderer, which converts only if the device needs integers
+			format.bits = 32;
+			format.isFloat = true;
+			m_TargetFormat = AV_SAMPLE_FMT_FLT;
 			break;
 		default:
 			// try to resample the audio to 16-but signed integers
@@ -683,10 +1831,18 @@ AudioFormat MovieDecoder::getAudioFormat()
 			m_TargetFormat = AV_SAMPLE_FMT_S16;
 		}
 
-		format.rate = m_pAudioCodecContext->sample_rate;
-		format.numChannels = m_pAudioCodecContext->channels;
+		format.rate = m_AudioOutputSampleRate > 0 ? m_AudioOutputSampleRate : m_pAudioCodecContext->sample_rate;
+		format.numChannels = m_AudioOutputChannels > 0 ? m_AudioOutputChannels : m_pAudioCodecContext->channels;
 		format.framesPerPacket = m_pAudioCodecContext->frame_size;
+
+		m_AudioResampler.setOutput( m_TargetFormat, format.rate, format.numChannels );
 	}
 
 	return format;
 }
+
+void MovieDecoder::setAudioOutput( int sampleRate, int numChannels )
+{
+	m_AudioOutputSampleRate = sampleRate;
+	m_AudioOutputChannels = numChannels;
+}
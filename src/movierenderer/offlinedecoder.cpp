@@ -0,0 +1,377 @@
+#include "movierenderer/offlinedecoder.h"
+#include "movierenderer/moviedecoder.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+// segments per worker thread, so that segments of uneven cost still balance out
+#define SEGMENTS_PER_THREAD 4
+
+using namespace std;
+
+OfflineDecoder::OfflineDecoder( const string &filename, int numThreads, size_t maxBufferedFrames )
+    : m_Filename( filename )
+    , m_pFormatContext( NULL )
+    , m_pVideoStream( NULL )
+    , m_VideoStream( -1 )
+    , m_NumThreads( numThreads > 0 ? numThreads : std::max( 1, int( std::thread::hardware_concurrency() ) ) )
+    , m_MaxBufferedFrames( std::max<size_t>( 1, maxBufferedFrames ) )
+    , m_NextSegmentToDecode( 0 )
+    , m_NextSegmentToDeliver( 0 )
+    , m_NumBufferedFrames( 0 )
+    , m_bCancelled( false )
+{
+	MovieDecoder::startFFmpeg();
+
+	if( avformat_open_input( &m_pFormatContext, filename.c_str(), NULL, NULL ) != 0 )
+		throw logic_error( "OfflineDecoder: Could not open input file" );
+
+	if( avformat_find_stream_info( m_pFormatContext, NULL ) < 0 ) {
+		avformat_close_input( &m_pFormatContext );
+		throw logic_error( "OfflineDecoder: Could not find stream information" );
+	}
+
+	m_VideoStream = av_find_best_stream( m_pFormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0 );
+	if( m_VideoStream < 0 ) {
+		avformat_close_input( &m_pFormatContext );
+		throw logic_error( "OfflineDecoder: Could not find video stream" );
+	}
+
+	m_pVideoStream = m_pFormatContext->streams[m_VideoStream];
+
+	if( !avcodec_find_decoder( m_pVideoStream->codecpar->codec_id ) ) {
+		avformat_close_input( &m_pFormatContext );
+		throw logic_error( "OfflineDecoder: Video Codec not found" );
+	}
+
+	createSegments();
+}
+
+OfflineDecoder::~OfflineDecoder()
+{
+	m_Segments.clear();
+
+	if( m_pFormatContext )
+		avformat_close_input( &m_pFormatContext );
+}
+
+int OfflineDecoder::getFrameWidth() const
+{
+	return m_pVideoStream->codecpar->width;
+}
+
+int OfflineDecoder::getFrameHeight() const
+{
+	return m_pVideoStream->codecpar->height;
+}
+
+double OfflineDecoder::getDuration() const
+{
+	return m_pFormatContext->duration / double( AV_TIME_BASE );
+}
+
+double OfflineDecoder::getFramesPerSecond() const
+{
+	return m_pVideoStream->avg_frame_rate.num / double( m_pVideoStream->avg_frame_rate.den );
+}
+
+void OfflineDecoder::createSegments()
+{
+	vector<int64_t> keyFrames;
+	for( int i = 0; i < m_pVideoStream->nb_index_entries; ++i ) {
+		const AVIndexEntry &entry = m_pVideoStream->index_entries[i];
+		if( entry.flags & AVINDEX_KEYFRAME )
+			keyFrames.push_back( entry.timestamp );
+	}
+
+	// without an index the file can only be decoded front to back
+	if( keyFrames.empty() )
+		keyFrames.push_back( m_pVideoStream->start_time != AV_NOPTS_VALUE ? m_pVideoStream->start_time : 0 );
+
+	const size_t numSegments = std::min( keyFrames.size(), size_t( m_NumThreads * SEGMENTS_PER_THREAD ) );
+	const size_t keyFramesPerSegment = ( keyFrames.size() + numSegments - 1 ) / numSegments;
+
+	m_Segments.clear();
+	for( size_t i = 0; i < keyFrames.size(); i += keyFramesPerSegment ) {
+		Segment segment;
+		segment.start = keyFrames[i];
+		segment.end = ( i + keyFramesPerSegment < keyFrames.size() ) ? keyFrames[i + keyFramesPerSegment] : AV_NOPTS_VALUE;
+
+		m_Segments.push_back( segment );
+	}
+}
+
+void OfflineDecoder::cancel()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+
+	m_bCancelled = true;
+	m_Condition.notify_all();
+}
+
+uint64_t OfflineDecoder::decode( const FrameCallback &callback )
+{
+	m_bCancelled = false;
+	m_NextSegmentToDecode = 0;
+	m_NextSegmentToDeliver = 0;
+	m_NumBufferedFrames = 0;
+
+	for( auto &segment : m_Segments ) {
+		segment.frames.clear();
+		segment.done = false;
+	}
+
+	vector<std::thread> workers;
+	for( size_t i = 0; i < std::min( size_t( m_NumThreads ), m_Segments.size() ); ++i )
+		workers.emplace_back( &OfflineDecoder::decodeSegments, this );
+
+	// deliver the frames in order, segment by segment
+	uint64_t numFrames = 0;
+	while( true ) {
+		VideoFrame frame;
+		{
+			std::unique_lock<std::mutex> lock( m_Mutex );
+			if( m_NextSegmentToDeliver >= m_Segments.size() )
+				break;
+
+			Segment &segment = m_Segments[m_NextSegmentToDeliver];
+			m_Condition.wait( lock, [&] { return m_bCancelled || !segment.frames.empty() || segment.done; } );
+
+			if( m_bCancelled )
+				break;
+
+			if( segment.frames.empty() ) {
+				++m_NextSegmentToDeliver;
+				m_Condition.notify_all();
+				continue;
+			}
+
+			frame = std::move( segment.frames.front() );
+			segment.frames.pop_front();
+			--m_NumBufferedFrames;
+			m_Condition.notify_all();
+		}
+
+		if( !callback( frame ) ) {
+			cancel();
+			break;
+		}
+
+		++numFrames;
+	}
+
+	for( auto &worker : workers )
+		worker.join();
+
+	for( auto &segment : m_Segments )
+		segment.frames.clear();
+
+	return numFrames;
+}
+
+void OfflineDecoder::decodeSegments()
+{
+	// every worker has its own demuxer and codec, nothing is shared but the frame pool
+	AVFormatContext *          formatContext = NULL;
+	AVCodecContext *           codecContext = NULL;
+	AVFrame *                  frame = av_frame_alloc();
+	SwsContext *               swsContext = NULL;
+	MovieDecoder::PaletteAlpha paletteAlpha;
+
+	bool ready = frame && avformat_open_input( &formatContext, m_Filename.c_str(), NULL, NULL ) == 0 && avformat_find_stream_info( formatContext, NULL ) >= 0;
+	if( ready ) {
+		const AVCodecParameters *parameters = formatContext->streams[m_VideoStream]->codecpar;
+		const AVCodec *          codec = avcodec_find_decoder( parameters->codec_id );
+
+		codecContext = avcodec_alloc_context3( codec );
+		ready = codecContext && avcodec_parameters_to_context( codecContext, parameters ) >= 0;
+		if( ready ) {
+			// parallelism comes from the segments, frame threading would only add latency
+			codecContext->thread_count = 1;
+			codecContext->refcounted_frames = 1;
+			codecContext->opaque = &m_FramePool;
+			codecContext->get_buffer2 = &FramePool::getBuffer;
+			codecContext->pkt_timebase = formatContext->streams[m_VideoStream]->time_base;
+
+			ready = avcodec_open2( codecContext, codec, NULL ) >= 0;
+		}
+	}
+
+	while( !m_bCancelled ) {
+		const size_t index = m_NextSegmentToDecode++;
+		if( index >= m_Segments.size() )
+			break;
+
+		// a worker that failed to initialize still marks its segments as done, so delivery can move on
+		if( ready )
+			decodeSegment( index, formatContext, codecContext, frame, &swsContext, paletteAlpha );
+
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_Segments[index].done = true;
+		m_Condition.notify_all();
+	}
+
+	if( swsContext )
+		sws_freeContext( swsContext );
+
+	if( codecContext )
+		avcodec_free_context( &codecContext );
+
+	if( formatContext )
+		avformat_close_input( &formatContext );
+
+	if( frame )
+		av_frame_free( &frame );
+}
+
+bool OfflineDecoder::decodeSegment( size_t index, AVFormatContext *formatContext, AVCodecContext *codecContext, AVFrame *frame, SwsContext **swsContext, MovieDecoder::PaletteAlpha &paletteAlpha )
+{
+	const Segment &segment = m_Segments[index];
+
+	if( av_seek_frame( formatContext, m_VideoStream, segment.start, AVSEEK_FLAG_BACKWARD ) < 0 && index > 0 )
+		return false;
+
+	avcodec_flush_buffers( codecContext );
+
+	// the boundaries in presentation time are only known once the keyframes are read
+	int64_t startPts = AV_NOPTS_VALUE;
+	int64_t endPts = AV_NOPTS_VALUE;
+	bool    draining = false;
+
+	AVPacket packet;
+	while( !m_bCancelled ) {
+		if( !draining ) {
+			if( av_read_frame( formatContext, &packet ) < 0 ) {
+				draining = true;
+			}
+			else {
+				const bool    keyFrame = ( packet.flags & AV_PKT_FLAG_KEY ) != 0;
+				const int64_t dts = ( packet.dts != AV_NOPTS_VALUE ) ? packet.dts : packet.pts;
+				const int64_t pts = ( packet.pts != AV_NOPTS_VALUE ) ? packet.pts : packet.dts;
+
+				bool skip = ( packet.stream_index != m_VideoStream );
+				if( !skip && startPts == AV_NOPTS_VALUE ) {
+					// start at the keyframe the segment begins with
+					skip = !keyFrame || dts < segment.start;
+					if( !skip )
+						startPts = pts;
+				}
+				else if( !skip && segment.end != AV_NOPTS_VALUE ) {
+					if( endPts == AV_NOPTS_VALUE ) {
+						// the keyframe of the next segment is still decoded, in case leading frames of an open GOP precede it
+						if( keyFrame && dts >= segment.end )
+							endPts = pts;
+					}
+					else if( pts >= endPts ) {
+						skip = true;
+						draining = true;
+					}
+				}
+
+				if( skip ) {
+					av_free_packet( &packet );
+					if( !draining )
+						continue;
+				}
+			}
+		}
+
+		if( draining ) {
+			av_init_packet( &packet );
+			packet.data = NULL;
+			packet.size = 0;
+		}
+
+		int gotFrame = 0;
+		avcodec_decode_video2( codecContext, frame, &gotFrame, &packet );
+		av_free_packet( &packet );
+
+		if( !gotFrame ) {
+			if( draining )
+				break;
+
+			continue;
+		}
+
+		const int64_t pts = frame->best_effort_timestamp;
+		const bool    inside = pts != AV_NOPTS_VALUE && pts >= startPts && ( endPts == AV_NOPTS_VALUE || pts < endPts );
+
+		const bool delivered = !inside || deliverFrame( index, frame, swsContext, paletteAlpha );
+		av_frame_unref( frame );
+
+		if( !delivered )
+			return false;
+	}
+
+	return !m_bCancelled;
+}
+
+bool OfflineDecoder::deliverFrame( size_t index, AVFrame *frame, SwsContext **swsContext, MovieDecoder::PaletteAlpha &paletteAlpha )
+{
+	const AVPixelFormat source = AVPixelFormat( frame->format );
+	const AVPixelFormat target = MovieDecoder::getTargetPixelFormat( source );
+
+	VideoFrame::PixelFormat format;
+	switch( target ) {
+	case AV_PIX_FMT_RGBA:
+		format = VideoFrame::PIXEL_FORMAT_RGBA;
+		break;
+	case AV_PIX_FMT_YUVA420P:
+		format = VideoFrame::PIXEL_FORMAT_YUVA420P;
+		break;
+	default:
+		format = VideoFrame::PIXEL_FORMAT_YUV420P;
+		break;
+	}
+
+	VideoFrame videoFrame;
+	if( source == target ) {
+		if( !videoFrame.reference( frame, format ) )
+			return false;
+	}
+	else {
+		AVFrame *converted = av_frame_alloc();
+		if( !converted )
+			return false;
+
+		converted->format = target;
+		converted->width = frame->width;
+		converted->height = frame->height;
+
+		*swsContext = sws_getCachedContext( *swsContext, frame->width, frame->height, source, frame->width, frame->height, target, 0, NULL, NULL, NULL );
+
+		const bool result = *swsContext && m_FramePool.allocate( converted ) && sws_scale( *swsContext, frame->data, frame->linesize, 0, frame->height, converted->data, converted->linesize ) > 0 && videoFrame.reference( converted, format );
+		av_frame_free( &converted );
+
+		if( !result )
+			return false;
+	}
+
+	videoFrame.setPts( frame->best_effort_timestamp * av_q2d( m_pVideoStream->time_base ) );
+	if( format == VideoFrame::PIXEL_FORMAT_RGBA )
+		videoFrame.setHasAlpha( MovieDecoder::hasAlpha( frame, paletteAlpha ) );
+
+	std::unique_lock<std::mutex> lock( m_Mutex );
+
+	// the segment being delivered is limited by its own frames only, otherwise frames buffered ahead by later segments could stall delivery forever
+	m_Condition.wait( lock, [&] {
+		if( m_bCancelled )
+			return true;
+		if( index == m_NextSegmentToDeliver )
+			return m_Segments[index].frames.size() < m_MaxBufferedFrames;
+		return m_NumBufferedFrames < m_MaxBufferedFrames;
+	} );
+	if( m_bCancelled )
+		return false;
+
+	m_Segments[index].frames.push_back( std::move( videoFrame ) );
+	++m_NumBufferedFrames;
+	m_Condition.notify_all();
+
+	return true;
+}
@@ -0,0 +1,76 @@
+#include "movierenderer/packetcache.h"
+
+PacketCache::PacketCache( size_t maxBytes )
+    : m_NextPacket( 0 )
+    , m_Size( 0 )
+    , m_MaxSize( maxBytes )
+    , m_bComplete( false )
+{
+}
+
+PacketCache::~PacketCache()
+{
+	clear();
+}
+
+void PacketCache::clear()
+{
+	for( auto &packet : m_Packets )
+		av_packet_free( &packet );
+
+	std::vector<AVPacket *>().swap( m_Packets );
+
+	m_NextPacket = 0;
+	m_Size = 0;
+	m_bComplete = false;
+}
+
+bool PacketCache::add( const AVPacket *packet )
+{
+	if( m_bComplete )
+		return false;
+
+	const size_t size = sizeof( AVPacket ) + packet->size;
+	if( m_Size + size > m_MaxSize ) {
+		clear();
+		return false;
+	}
+
+	// shares the data of refcounted packets, copies it otherwise
+	AVPacket *cached = av_packet_clone( packet );
+	if( !cached ) {
+		clear();
+		return false;
+	}
+
+	m_Size += size;
+	m_Packets.push_back( cached );
+
+	return true;
+}
+
+bool PacketCache::next( AVPacket *packet )
+{
+	if( !m_bComplete || m_NextPacket >= m_Packets.size() )
+		return false;
+
+	av_init_packet( packet );
+	return av_packet_ref( packet, m_Packets[m_NextPacket++] ) >= 0;
+}
+
+void PacketCache::seek( int streamIndex, int64_t timestamp )
+{
+	m_NextPacket = 0;
+
+	for( size_t i = 0; i < m_Packets.size(); ++i ) {
+		const AVPacket *packet = m_Packets[i];
+		if( packet->stream_index != streamIndex || !( packet->flags & AV_PKT_FLAG_KEY ) )
+			continue;
+
+		const int64_t ts = ( packet->dts != AV_NOPTS_VALUE ) ? packet->dts : packet->pts;
+		if( ts != AV_NOPTS_VALUE && ts > timestamp )
+			break;
+
+		m_NextPacket = i;
+	}
+}
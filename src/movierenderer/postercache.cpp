@@ -0,0 +1,158 @@
+#include "movierenderer/postercache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <sys/stat.h>
+#include <vector>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+// identifies poster files, bump the version when the layout changes
+#define POSTER_FILE_MAGIC 0x52545350 // "PSTR"
+#define POSTER_FILE_VERSION 1
+
+using namespace std;
+
+namespace {
+
+struct PosterFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	int32_t  pixelFormat; // VideoFrame::PixelFormat
+	int32_t  avPixelFormat;
+	int32_t  width;
+	int32_t  height;
+	int32_t  numPlanes;
+	int32_t  movieWidth;
+	int32_t  movieHeight;
+	double   duration;
+	double   position;
+	double   pts;
+};
+
+} // namespace
+
+string PosterCache::getPath( const string &directory, const string &filename, const string &name )
+{
+	struct stat info;
+	if( directory.empty() || stat( filename.c_str(), &info ) != 0 )
+		return string();
+
+	char key[512];
+	snprintf( key, sizeof( key ), "%s|%lld|%lld", filename.c_str(), (long long)info.st_size, (long long)info.st_mtime );
+
+	char file[64];
+	snprintf( file, sizeof( file ), "%016llx_%s.poster", (unsigned long long)std::hash<string>()( key ), name.c_str() );
+
+	return directory + "/" + file;
+}
+
+bool PosterCache::write( const string &path, const VideoFrame &frame, const Info &info )
+{
+	if( path.empty() || !frame.isValid() )
+		return false;
+
+	PosterFileHeader header;
+	header.magic = POSTER_FILE_MAGIC;
+	header.version = POSTER_FILE_VERSION;
+	header.pixelFormat = frame.getPixelFormat();
+	header.avPixelFormat = frame.getAVFrame()->format;
+	header.width = frame.getWidth();
+	header.height = frame.getHeight();
+	header.numPlanes = frame.getNumPlanes();
+	header.movieWidth = info.width;
+	header.movieHeight = info.height;
+	header.duration = info.duration;
+	header.position = info.position;
+	header.pts = frame.getPts();
+
+	// write to a temporary file first, so that a crash never leaves a partial poster behind
+	const string temporaryPath = path + ".tmp";
+
+	FILE *file = fopen( temporaryPath.c_str(), "wb" );
+	if( !file )
+		return false;
+
+	bool result = fwrite( &header, sizeof( header ), 1, file ) == 1;
+	for( int i = 0; result && i < frame.getNumPlanes(); ++i ) {
+		const VideoFrame::Plane &plane = frame.getPlane( i );
+
+		const int32_t size[2] = { plane.lineSize, plane.height };
+		result = fwrite( size, sizeof( size ), 1, file ) == 1 && fwrite( plane.data, plane.lineSize, plane.height, file ) == size_t( plane.height );
+	}
+
+	fclose( file );
+
+	remove( path.c_str() );
+	result = result && rename( temporaryPath.c_str(), path.c_str() ) == 0;
+	if( !result )
+		remove( temporaryPath.c_str() );
+
+	return result;
+}
+
+bool PosterCache::read( const string &path, VideoFrame &frame, Info &info )
+{
+	if( path.empty() )
+		return false;
+
+	FILE *file = fopen( path.c_str(), "rb" );
+	if( !file )
+		return false;
+
+	PosterFileHeader header;
+	bool             result = fread( &header, sizeof( header ), 1, file ) == 1 && header.magic == POSTER_FILE_MAGIC && header.version == POSTER_FILE_VERSION
+	              && header.width > 0 && header.height > 0 && header.numPlanes > 0 && header.numPlanes <= VideoFrame::MAX_PLANES
+	              && av_pix_fmt_desc_get( AVPixelFormat( header.avPixelFormat ) ) != NULL;
+
+	AVFrame *avFrame = result ? av_frame_alloc() : NULL;
+	if( avFrame ) {
+		const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get( AVPixelFormat( header.avPixelFormat ) );
+
+		avFrame->format = header.avPixelFormat;
+		avFrame->width = header.width;
+		avFrame->height = header.height;
+
+		result = av_frame_get_buffer( avFrame, 64 ) >= 0;
+
+		vector<uint8_t> row;
+		for( int i = 0; result && i < header.numPlanes; ++i ) {
+			int32_t size[2];
+			result = fread( size, sizeof( size ), 1, file ) == 1 && size[0] > 0 && size[1] > 0 && avFrame->data[i];
+			if( !result )
+				break;
+
+			// the stride of the new buffer may differ from the stored one
+			const int rowSize = std::min( size[0], avFrame->linesize[i] );
+			const int planeHeight = ( i == 1 || i == 2 ) && !( desc->flags & AV_PIX_FMT_FLAG_RGB ) ? AV_CEIL_RSHIFT( header.height, desc->log2_chroma_h ) : header.height;
+
+			row.resize( size[0] );
+			for( int y = 0; result && y < size[1]; ++y ) {
+				result = fread( row.data(), size[0], 1, file ) == 1;
+				if( result && y < planeHeight )
+					memcpy( avFrame->data[i] + y * avFrame->linesize[i], row.data(), rowSize );
+			}
+		}
+
+		result = result && frame.reference( avFrame, VideoFrame::PixelFormat( header.pixelFormat ) );
+		av_frame_free( &avFrame );
+	}
+
+	fclose( file );
+
+	if( !result )
+		return false;
+
+	frame.setPts( header.pts );
+
+	info.width = header.movieWidth;
+	info.height = header.movieHeight;
+	info.duration = header.duration;
+	info.position = header.position;
+
+	return true;
+}
@@ -0,0 +1,421 @@
+#include "movierenderer/thumbnailgenerator.h"
+#include "movierenderer/moviedecoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+
+// identifies strip files in the cache, bump the version when the layout changes
+#define STRIP_FILE_MAGIC 0x53544850 // "PHTS"
+#define STRIP_FILE_VERSION 1
+
+// gives up on a sample if no keyframe shows up within this many packets
+#define MAX_PACKETS_PER_SAMPLE 1000
+
+// JPEG quality of cached strips, as a quantizer (2 is best, 31 is worst)
+#define STRIP_JPEG_QUALITY 3
+
+using namespace std;
+
+namespace {
+
+struct StripFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	int32_t  columns;
+	int32_t  rows;
+	int32_t  thumbnailWidth;
+	int32_t  thumbnailHeight;
+	int32_t  count;
+	uint32_t jpegSize;
+};
+
+} // namespace
+
+ThumbnailGenerator::ThumbnailGenerator( int numThreads )
+    : m_bDone( false )
+{
+	MovieDecoder::startFFmpeg();
+
+	if( numThreads <= 0 )
+		numThreads = std::max( 1, int( std::thread::hardware_concurrency() ) );
+
+	for( int i = 0; i < numThreads; ++i )
+		m_Workers.emplace_back( &ThumbnailGenerator::run, this );
+}
+
+ThumbnailGenerator::~ThumbnailGenerator()
+{
+	{
+		std::lock_guard<std::mutex> lock( m_Mutex );
+		m_bDone = true;
+		m_Condition.notify_all();
+	}
+
+	for( auto &worker : m_Workers )
+		worker.join();
+}
+
+void ThumbnailGenerator::setCacheDirectory( const string &path )
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	m_CacheDirectory = path;
+}
+
+std::future<ThumbnailGenerator::Strip> ThumbnailGenerator::generate( const string &filename, int count, int thumbnailWidth, int columns )
+{
+	Job job;
+	job.filename = filename;
+	job.count = std::max( 1, count );
+	job.thumbnailWidth = std::max( 2, thumbnailWidth );
+	job.columns = std::max( 1, std::min( columns, job.count ) );
+
+	std::future<Strip> result = job.promise.get_future();
+
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	m_Jobs.push_back( std::move( job ) );
+	m_Condition.notify_one();
+
+	return result;
+}
+
+size_t ThumbnailGenerator::getNumPending()
+{
+	std::lock_guard<std::mutex> lock( m_Mutex );
+	return m_Jobs.size();
+}
+
+void ThumbnailGenerator::run()
+{
+	// the scaler is reused across files, most clips in a library share a handful of formats
+	SwsContext *swsContext = NULL;
+
+	while( true ) {
+		Job         job;
+		std::string cachePath;
+		{
+			std::unique_lock<std::mutex> lock( m_Mutex );
+			m_Condition.wait( lock, [&] { return m_bDone || !m_Jobs.empty(); } );
+
+			if( m_bDone )
+				break;
+
+			job = std::move( m_Jobs.front() );
+			m_Jobs.pop_front();
+
+			cachePath = getCachePath( job );
+		}
+
+		Strip strip;
+		if( cachePath.empty() || !readStrip( cachePath, strip, &swsContext ) ) {
+			strip = Strip();
+			if( createStrip( job, strip, &swsContext ) && !cachePath.empty() )
+				writeStrip( cachePath, strip, &swsContext );
+		}
+
+		job.promise.set_value( std::move( strip ) );
+	}
+
+	if( swsContext )
+		sws_freeContext( swsContext );
+}
+
+string ThumbnailGenerator::getCachePath( const Job &job ) const
+{
+	if( m_CacheDirectory.empty() )
+		return string();
+
+	// a strip is outdated as soon as its file is modified
+	struct stat info;
+	if( stat( job.filename.c_str(), &info ) != 0 )
+		return string();
+
+	char key[512];
+	snprintf( key, sizeof( key ), "%s|%lld|%lld|%d|%d|%d", job.filename.c_str(), (long long)info.st_size, (long long)info.st_mtime, job.count, job.thumbnailWidth, job.columns );
+
+	char name[32];
+	snprintf( name, sizeof( name ), "%016llx.thumbs", (unsigned long long)std::hash<string>()( key ) );
+
+	return m_CacheDirectory + "/" + name;
+}
+
+bool ThumbnailGenerator::createStrip( const Job &job, Strip &strip, SwsContext **swsContext )
+{
+	AVFormatContext *formatContext = NULL;
+	if( avformat_open_input( &formatContext, job.filename.c_str(), NULL, NULL ) != 0 )
+		return false;
+
+	AVCodecContext *codecContext = NULL;
+	AVFrame *       frame = NULL;
+	bool            result = false;
+
+	const int videoStream = ( avformat_find_stream_info( formatContext, NULL ) >= 0 ) ? av_find_best_stream( formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0 ) : -1;
+	if( videoStream >= 0 ) {
+		AVStream *     stream = formatContext->streams[videoStream];
+		const AVCodec *codec = avcodec_find_decoder( stream->codecpar->codec_id );
+
+		codecContext = codec ? avcodec_alloc_context3( codec ) : NULL;
+		frame = av_frame_alloc();
+
+		if( codecContext && frame && avcodec_parameters_to_context( codecContext, stream->codecpar ) >= 0 ) {
+			// many files are processed at once, so every file gets a single thread
+			codecContext->thread_count = 1;
+			codecContext->skip_frame = AVDISCARD_NONKEY;
+
+			result = avcodec_open2( codecContext, codec, NULL ) >= 0;
+		}
+
+		if( result && stream->codecpar->width > 0 && stream->codecpar->height > 0 ) {
+			// let the demuxer drop everything but keyframes of the video stream
+			for( unsigned int i = 0; i < formatContext->nb_streams; ++i )
+				formatContext->streams[i]->discard = AVDISCARD_ALL;
+			stream->discard = AVDISCARD_NONKEY;
+
+			AVRational sampleAspect = stream->codecpar->sample_aspect_ratio;
+			if( sampleAspect.num <= 0 || sampleAspect.den <= 0 )
+				sampleAspect = av_make_q( 1, 1 );
+
+			const double aspect = stream->codecpar->width * av_q2d( sampleAspect ) / stream->codecpar->height;
+
+			strip.columns = job.columns;
+			strip.rows = ( job.count + job.columns - 1 ) / job.columns;
+			strip.thumbnailWidth = job.thumbnailWidth;
+			strip.thumbnailHeight = std::max( 2, int( lrint( job.thumbnailWidth / aspect ) ) );
+			strip.times.resize( job.count );
+			strip.pixels.assign( size_t( strip.getWidth() ) * strip.getHeight() * 4, 0 );
+
+			const int     stride = strip.getWidth() * 4;
+			const double  duration = formatContext->duration / double( AV_TIME_BASE );
+			const int64_t startTime = ( stream->start_time != AV_NOPTS_VALUE ) ? stream->start_time : 0;
+
+			int64_t lastKeyFrame = AV_NOPTS_VALUE;
+			int     lastThumbnail = -1;
+
+			for( int i = 0; i < job.count; ++i ) {
+				strip.times[i] = duration * ( i + 0.5 ) / job.count;
+
+				uint8_t *cell = &strip.pixels[size_t( i / job.columns ) * strip.thumbnailHeight * stride + size_t( i % job.columns ) * strip.thumbnailWidth * 4];
+
+				const int64_t target = startTime + av_rescale_q( int64_t( strip.times[i] * AV_TIME_BASE ), AV_TIME_BASE_Q, stream->time_base );
+				if( av_seek_frame( formatContext, videoStream, target, AVSEEK_FLAG_BACKWARD ) < 0 )
+					continue;
+
+				avcodec_flush_buffers( codecContext );
+
+				AVPacket packet;
+				bool     decoded = false;
+				for( int n = 0; n < MAX_PACKETS_PER_SAMPLE && !decoded; ++n ) {
+					if( av_read_frame( formatContext, &packet ) < 0 )
+						break;
+
+					if( packet.stream_index != videoStream || !( packet.flags & AV_PKT_FLAG_KEY ) ) {
+						av_free_packet( &packet );
+						continue;
+					}
+
+					const int64_t pts = ( packet.pts != AV_NOPTS_VALUE ) ? packet.pts : packet.dts;
+					if( pts == lastKeyFrame && lastThumbnail >= 0 ) {
+						// short clips or long GOPs map several samples to the same keyframe
+						const uint8_t *source = &strip.pixels[size_t( lastThumbnail / job.columns ) * strip.thumbnailHeight * stride + size_t( lastThumbnail % job.columns ) * strip.thumbnailWidth * 4];
+						for( int y = 0; y < strip.thumbnailHeight; ++y )
+							memcpy( cell + y * stride, source + y * stride, strip.thumbnailWidth * 4 );
+
+						av_free_packet( &packet );
+						lastThumbnail = i;
+						break;
+					}
+
+					int gotFrame = 0;
+					avcodec_decode_video2( codecContext, frame, &gotFrame, &packet );
+					av_free_packet( &packet );
+
+					if( !gotFrame ) {
+						// drain codecs that delay their output
+						av_init_packet( &packet );
+						packet.data = NULL;
+						packet.size = 0;
+						avcodec_decode_video2( codecContext, frame, &gotFrame, &packet );
+					}
+
+					if( !gotFrame )
+						continue;
+
+					// scale straight into the atlas
+					*swsContext = sws_getCachedContext( *swsContext, frame->width, frame->height, AVPixelFormat( frame->format ), strip.thumbnailWidth, strip.thumbnailHeight, AV_PIX_FMT_RGBA, SWS_AREA, NULL, NULL, NULL );
+					if( *swsContext )
+						sws_scale( *swsContext, frame->data, frame->linesize, 0, frame->height, &cell, &stride );
+
+					av_frame_unref( frame );
+
+					decoded = true;
+					lastKeyFrame = pts;
+					lastThumbnail = i;
+				}
+			}
+		}
+		else {
+			result = false;
+		}
+	}
+
+	if( frame )
+		av_frame_free( &frame );
+
+	if( codecContext )
+		avcodec_free_context( &codecContext );
+
+	avformat_close_input( &formatContext );
+
+	return result;
+}
+
+bool ThumbnailGenerator::writeStrip( const string &path, const Strip &strip, SwsContext **swsContext )
+{
+	const AVCodec *codec = avcodec_find_encoder( AV_CODEC_ID_MJPEG );
+	if( !codec )
+		return false;
+
+	AVCodecContext *codecContext = avcodec_alloc_context3( codec );
+	AVFrame *       frame = av_frame_alloc();
+	AVPacket *      packet = av_packet_alloc();
+	bool            result = false;
+
+	if( codecContext && frame && packet ) {
+		codecContext->width = strip.getWidth();
+		codecContext->height = strip.getHeight();
+		codecContext->pix_fmt = AV_PIX_FMT_YUVJ420P;
+		codecContext->time_base = av_make_q( 1, 25 );
+		codecContext->flags |= AV_CODEC_FLAG_QSCALE;
+		codecContext->global_quality = FF_QP2LAMBDA * STRIP_JPEG_QUALITY;
+
+		frame->format = AV_PIX_FMT_YUVJ420P;
+		frame->width = strip.getWidth();
+		frame->height = strip.getHeight();
+		frame->quality = codecContext->global_quality;
+		frame->pts = 0;
+
+		const uint8_t *source = strip.pixels.data();
+		const int      stride = strip.getWidth() * 4;
+
+		result = avcodec_open2( codecContext, codec, NULL ) >= 0 && av_frame_get_buffer( frame, 32 ) >= 0;
+		if( result ) {
+			*swsContext = sws_getCachedContext( *swsContext, strip.getWidth(), strip.getHeight(), AV_PIX_FMT_RGBA, strip.getWidth(), strip.getHeight(), AV_PIX_FMT_YUVJ420P, SWS_POINT, NULL, NULL, NULL );
+			result = *swsContext && sws_scale( *swsContext, &source, &stride, 0, strip.getHeight(), frame->data, frame->linesize ) > 0;
+		}
+
+		result = result && avcodec_send_frame( codecContext, frame ) >= 0 && avcodec_receive_packet( codecContext, packet ) >= 0;
+	}
+
+	if( result ) {
+		StripFileHeader header;
+		header.magic = STRIP_FILE_MAGIC;
+		header.version = STRIP_FILE_VERSION;
+		header.columns = strip.columns;
+		header.rows = strip.rows;
+		header.thumbnailWidth = strip.thumbnailWidth;
+		header.thumbnailHeight = strip.thumbnailHeight;
+		header.count = int32_t( strip.times.size() );
+		header.jpegSize = uint32_t( packet->size );
+
+		// write to a temporary file first, so that other processes never read a partial strip
+		const string temporaryPath = path + ".tmp";
+
+		FILE *file = fopen( temporaryPath.c_str(), "wb" );
+		result = file != NULL;
+		if( file ) {
+			result = fwrite( &header, sizeof( header ), 1, file ) == 1
+			         && fwrite( strip.times.data(), sizeof( double ), strip.times.size(), file ) == strip.times.size()
+			         && fwrite( packet->data, 1, packet->size, file ) == size_t( packet->size );
+			fclose( file );
+
+			remove( path.c_str() );
+			result = result && rename( temporaryPath.c_str(), path.c_str() ) == 0;
+			if( !result )
+				remove( temporaryPath.c_str() );
+		}
+	}
+
+	if( packet )
+		av_packet_free( &packet );
+
+	if( frame )
+		av_frame_free( &frame );
+
+	if( codecContext )
+		avcodec_free_context( &codecContext );
+
+	return result;
+}
+
+bool ThumbnailGenerator::readStrip( const string &path, Strip &strip, SwsContext **swsContext )
+{
+	FILE *file = fopen( path.c_str(), "rb" );
+	if( !file )
+		return false;
+
+	StripFileHeader header;
+	bool            valid = fread( &header, sizeof( header ), 1, file ) == 1 && header.magic == STRIP_FILE_MAGIC && header.version == STRIP_FILE_VERSION
+	             && header.columns > 0 && header.rows > 0 && header.thumbnailWidth > 0 && header.thumbnailHeight > 0 && header.count > 0 && header.jpegSize > 0;
+
+	std::vector<uint8_t> jpeg;
+	if( valid ) {
+		strip.columns = header.columns;
+		strip.rows = header.rows;
+		strip.thumbnailWidth = header.thumbnailWidth;
+		strip.thumbnailHeight = header.thumbnailHeight;
+		strip.times.resize( header.count );
+
+		jpeg.resize( header.jpegSize + AV_INPUT_BUFFER_PADDING_SIZE, 0 );
+
+		valid = fread( strip.times.data(), sizeof( double ), header.count, file ) == size_t( header.count ) && fread( jpeg.data(), 1, header.jpegSize, file ) == header.jpegSize;
+	}
+
+	fclose( file );
+
+	if( !valid )
+		return false;
+
+	const AVCodec *codec = avcodec_find_decoder( AV_CODEC_ID_MJPEG );
+	if( !codec )
+		return false;
+
+	AVCodecContext *codecContext = avcodec_alloc_context3( codec );
+	AVFrame *       frame = av_frame_alloc();
+	bool            result = false;
+
+	if( codecContext && frame && avcodec_open2( codecContext, codec, NULL ) >= 0 ) {
+		AVPacket packet;
+		av_init_packet( &packet );
+		packet.data = jpeg.data();
+		packet.size = int( header.jpegSize );
+
+		if( avcodec_send_packet( codecContext, &packet ) >= 0 && avcodec_receive_frame( codecContext, frame ) >= 0 && frame->width == strip.getWidth() && frame->height == strip.getHeight() ) {
+			strip.pixels.resize( size_t( strip.getWidth() ) * strip.getHeight() * 4 );
+
+			uint8_t * destination = strip.pixels.data();
+			const int stride = strip.getWidth() * 4;
+
+			*swsContext = sws_getCachedContext( *swsContext, frame->width, frame->height, AVPixelFormat( frame->format ), frame->width, frame->height, AV_PIX_FMT_RGBA, SWS_POINT, NULL, NULL, NULL );
+			result = *swsContext && sws_scale( *swsContext, frame->data, frame->linesize, 0, frame->height, &destination, &stride ) > 0;
+		}
+	}
+
+	if( frame )
+		av_frame_free( &frame );
+
+	if( codecContext )
+		avcodec_free_context( &codecContext );
+
+	if( !result )
+		strip = Strip();
+
+	return result;
+}
@@ -1,46 +1,213 @@
 #include "movierenderer/videoframe.h"
 
+#include <utility>
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
 VideoFrame::VideoFrame()
-    : m_YPlane( 0 )
-    , m_UPlane( 0 )
-    , m_VPlane( 0 )
+    : m_pFrame( nullptr )
+    , m_NumPlanes( 0 )
+    , m_PixelFormat( PIXEL_FORMAT_YUV420P )
     , m_Pts( 0.0 )
     , m_Width( 0 )
     , m_Height( 0 )
-    , m_YLineSize( 0 )
-    , m_ULineSize( 0 )
-    , m_VLineSize( 0 )
 {
 }
 
+VideoFrame::VideoFrame( const VideoFrame &other )
+    : VideoFrame()
+{
+	*this = other;
+}
+
+VideoFrame::VideoFrame( VideoFrame &&other ) noexcept
+    : VideoFrame()
+{
+	*this = std::move( other );
+}
+
+VideoFrame::~VideoFrame()
+{
+	release();
+}
+
+VideoFrame &VideoFrame::operator=( const VideoFrame &other )
+{
+	if( this == &other )
+		return *this;
+
+	release();
+
+	if( other.m_pFrame ) {
+		m_pFrame = av_frame_clone( other.m_pFrame );
+		if( !m_pFrame )
+			return *this;
+	}
+
+	// the cloned frame shares the same buffers, so the plane pointers remain valid
+	for( int i = 0; i < MAX_PLANES; ++i )
+		m_Planes[i] = other.m_Planes[i];
+
+	m_NumPlanes = other.m_NumPlanes;
+	m_PixelFormat = other.m_PixelFormat;
+	m_bHasAlpha = other.m_bHasAlpha;
+	m_Pts = other.m_Pts;
+	m_Width = other.m_Width;
+	m_Height = other.m_Height;
+
+	return *this;
+}
+
+VideoFrame &VideoFrame::operator=( VideoFrame &&other ) noexcept
+{
+	if( this == &other )
+		return *this;
+
+	release();
+
+	m_pFrame = other.m_pFrame;
+	other.m_pFrame = nullptr;
+
+	for( int i = 0; i < MAX_PLANES; ++i ) {
+		m_Planes[i] = other.m_Planes[i];
+		other.m_Planes[i] = Plane();
+	}
+
+	m_NumPlanes = other.m_NumPlanes;
+	m_PixelFormat = other.m_PixelFormat;
+	m_bHasAlpha = other.m_bHasAlpha;
+	m_Pts = other.m_Pts;
+	m_Width = other.m_Width;
+	m_Height = other.m_Height;
+
+	other.m_NumPlanes = 0;
+	other.m_Width = 0;
+	other.m_Height = 0;
+
+	return *this;
+}
+
+bool VideoFrame::reference( const AVFrame *frame, PixelFormat format )
+{
+	release();
+
+	if( !frame || !frame->buf[0] )
+		return false;
+
+	m_pFrame = av_frame_alloc();
+	if( !m_pFrame )
+		return false;
+
+	if( av_frame_ref( m_pFrame, frame ) < 0 ) {
+		av_frame_free( &m_pFrame );
+		return false;
+	}
+
+	m_PixelFormat = format;
+	m_bHasAlpha = ( format == PIXEL_FORMAT_YUVA420P );
+	m_Width = m_pFrame->width;
+	m_Height = m_pFrame->height;
+
+	const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get( AVPixelFormat( m_pFrame->format ) );
+	if( !desc )
+		return true;
+
+	m_NumPlanes = 0;
+	for( int c = 0; c < desc->nb_components; ++c ) {
+		const int index = desc->comp[c].plane;
+		if( index >= MAX_PLANES )
+			continue;
+
+		// chroma planes of YUV formats are subsampled
+		const bool isChroma = ( index == 1 || index == 2 ) && !( desc->flags & AV_PIX_FMT_FLAG_RGB );
+
+		Plane &plane = m_Planes[index];
+		plane.data = m_pFrame->data[index];
+		plane.lineSize = m_pFrame->linesize[index];
+		plane.width = isChroma ? AV_CEIL_RSHIFT( m_Width, desc->log2_chroma_w ) : m_Width;
+		plane.height = isChroma ? AV_CEIL_RSHIFT( m_Height, desc->log2_chroma_h ) : m_Height;
+		plane.bitDepth = desc->comp[c].depth;
+
+		if( index + 1 > m_NumPlanes )
+			m_NumPlanes = index + 1;
+	}
+
+	return true;
+}
+
+void VideoFrame::release()
+{
+	if( m_pFrame )
+		av_frame_free( &m_pFrame );
+
+	for( int i = 0; i < MAX_PLANES; ++i )
+		m_Planes[i] = Plane();
+
+	m_NumPlanes = 0;
+	m_Width = 0;
+	m_Height = 0;
+}
+
+size_t VideoFrame::getDataSize( int index ) const
+{
+	return index < m_NumPlanes ? size_t( m_Planes[index].lineSize ) * m_Planes[index].height : 0;
+}
+
 size_t VideoFrame::getYDataSize() const
 {
-	return getYLineSize() * getHeight();
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? 0 : getDataSize( 0 );
 }
 
 size_t VideoFrame::getUDataSize() const
 {
-	return getULineSize() * getHeight() / 2;
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? 0 : getDataSize( 1 );
 }
 
 size_t VideoFrame::getVDataSize() const
 {
-	return getVLineSize() * getHeight() / 2;
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? 0 : getDataSize( 2 );
+}
+
+size_t VideoFrame::getADataSize() const
+{
+	return m_PixelFormat == PIXEL_FORMAT_YUVA420P ? getDataSize( 3 ) : 0;
+}
+
+size_t VideoFrame::getRGBADataSize() const
+{
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? getDataSize( 0 ) : 0;
 }
 
 byte *VideoFrame::getYPlane() const
 {
-	return m_YPlane;
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? nullptr : m_Planes[0].data;
 }
 
 byte *VideoFrame::getUPlane() const
 {
-	return m_UPlane;
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? nullptr : m_Planes[1].data;
 }
 
 byte *VideoFrame::getVPlane() const
 {
-	return m_VPlane;
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? nullptr : m_Planes[2].data;
+}
+
+byte *VideoFrame::getAPlane() const
+{
+	return m_PixelFormat == PIXEL_FORMAT_YUVA420P ? m_Planes[3].data : nullptr;
+}
+
+byte *VideoFrame::getRGBAPlane() const
+{
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? m_Planes[0].data : nullptr;
+}
+
+VideoFrame::PixelFormat VideoFrame::getPixelFormat() const
+{
+	return m_PixelFormat;
 }
 
 double VideoFrame::getPts() const
@@ -60,48 +227,30 @@ int VideoFrame::getHeight() const
 
 int VideoFrame::getYLineSize() const
 {
-	return m_YLineSize;
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? 0 : m_Planes[0].lineSize;
 }
 
 int VideoFrame::getULineSize() const
 {
-	return m_ULineSize;
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? 0 : m_Planes[1].lineSize;
 }
 
 int VideoFrame::getVLineSize() const
 {
-	return m_VLineSize;
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? 0 : m_Planes[2].lineSize;
 }
 
-void VideoFrame::storeYPlane( byte *data, int lineSize )
+int VideoFrame::getALineSize() const
 {
-	m_YPlane = data;
-	m_YLineSize = lineSize;
+	return m_PixelFormat == PIXEL_FORMAT_YUVA420P ? m_Planes[3].lineSize : 0;
 }
 
-void VideoFrame::storeUPlane( byte *data, int lineSize )
+int VideoFrame::getRGBALineSize() const
 {
-	m_UPlane = data;
-	m_ULineSize = lineSize;
-}
-
-void VideoFrame::storeVPlane( byte *data, int lineSize )
-{
-	m_VPlane = data;
-	m_VLineSize = lineSize;
+	return m_PixelFormat == PIXEL_FORMAT_RGBA ? m_Planes[0].lineSize : 0;
 }
 
 void VideoFrame::setPts( double pts )
 {
 	m_Pts = pts;
 }
-
-void VideoFrame::setWidth( int width )
-{
-	m_Width = width;
-}
-
-void VideoFrame::setHeight( int height )
-{
-	m_Height = height;
-}